@@ -0,0 +1,216 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares the time it takes to match packets against a set of module
+ * filters by running each filter's BPF program in turn, as the sensor used
+ * to, with the time it takes the classifier to do the same. By default, the
+ * filters are those of the modules that ship with the sensor; others can be
+ * given on the command line.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <pcap.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <include/classifier.h>
+
+using namespace std;
+
+static const size_t numPackets = 1024;
+
+/* Builds a mix of IPv4 TCP, UDP and ICMP packets and IPv6 TCP packets. */
+void makePackets(vector <vector <u_char> > &packets) {
+  static const uint16_t ports[] = { 80, 443, 9100, 53, 6881, 1024 };
+  vector <u_char> packet;
+  uint16_t port;
+  srandom(0);
+  for (size_t i = 0; i < numPackets; ++i) {
+    packet.assign(74, 0);
+    port = ports[random() % (sizeof(ports) / sizeof(ports[0]))];
+    switch (random() % 8) {
+      case 0:
+        /* IPv6 TCP. */
+        packet[12] = 0x86;
+        packet[13] = 0xdd;
+        packet[14] = 0x60;
+        packet[20] = 6;
+        packet[56] = port >> 8;
+        packet[57] = port & 0xff;
+        break;
+      case 1:
+        /* IPv4 ICMP. */
+        packet[12] = 0x08;
+        packet[14] = 0x45;
+        packet[23] = 1;
+        break;
+      case 2:
+      case 3:
+        /* IPv4 UDP. */
+        packet[12] = 0x08;
+        packet[14] = 0x45;
+        packet[23] = 17;
+        packet[36] = port >> 8;
+        packet[37] = port & 0xff;
+        break;
+      default:
+        /* IPv4 TCP. */
+        packet[12] = 0x08;
+        packet[14] = 0x45;
+        packet[23] = 6;
+        packet[36] = port >> 8;
+        packet[37] = port & 0xff;
+        packet[46] = 0x50;
+        break;
+    }
+    packets.push_back(packet);
+  }
+}
+
+double now() {
+  timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+void usage(const char *program) {
+  cerr << "usage: " << program << " [-i iterations] [filter ...]" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  vector <string> filters;
+  vector <bpf_program> bpfPrograms;
+  vector <vector <u_char> > packets;
+  Classifier classifier;
+  pcap_t *pcapDescriptor;
+  pcap_pkthdr pcapHeader;
+  size_t iterations = 10000;
+  uint64_t matches, checksum = 0;
+  double start, bpfTime, classifierTime;
+  char option;
+  while ((option = getopt(argc, argv, "i:")) != -1) {
+    switch (option) {
+      case 'i':
+        iterations = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  for (int i = optind; i < argc; ++i) {
+    filters.push_back(argv[i]);
+  }
+  if (filters.size() == 0) {
+    filters.push_back("udp");
+    filters.push_back("tcp");
+    filters.push_back("tcp and dst port 9100");
+    filters.push_back("ip");
+    filters.push_back("");
+  }
+  pcapDescriptor = pcap_open_dead(DLT_EN10MB,
+                                  numeric_limits <uint16_t>::max());
+  if (pcapDescriptor == NULL) {
+    cerr << argv[0] << ": pcap_open_dead() failed" << endl;
+    return 1;
+  }
+  bpfPrograms.resize(filters.size());
+  for (size_t i = 0; i < filters.size(); ++i) {
+    if (pcap_compile(pcapDescriptor, &bpfPrograms[i],
+                     (char*)filters[i].c_str(), 1, 0) == -1) {
+      cerr << argv[0] << ": pcap_compile(): " << filters[i] << ": "
+           << pcap_geterr(pcapDescriptor) << endl;
+      return 1;
+    }
+    if (!classifier.add(filters[i], bpfPrograms[i])) {
+      cerr << argv[0] << ": " << classifier.error() << endl;
+      return 1;
+    }
+    cout << '"' << filters[i] << "\": "
+         << ((classifier.compiled(i) == true) ? "classifier" : "BPF")
+         << endl;
+  }
+  makePackets(packets);
+  /* Make sure both methods agree before timing them. */
+  for (size_t i = 0; i < packets.size(); ++i) {
+    pcapHeader.caplen = pcapHeader.len = packets[i].size();
+    matches = 0;
+    for (size_t j = 0; j < bpfPrograms.size(); ++j) {
+      if (bpf_filter(bpfPrograms[j].bf_insns, &packets[i][0], pcapHeader.len,
+                     pcapHeader.caplen) != 0) {
+        matches |= (uint64_t)1 << j;
+      }
+    }
+    if (matches != classifier.classify <DLT_EN10MB>(pcapHeader, &packets[i][0])) {
+      cerr << argv[0] << ": classifier disagrees with BPF on packet " << i
+           << endl;
+      return 1;
+    }
+  }
+  start = now();
+  for (size_t i = 0; i < iterations; ++i) {
+    for (size_t j = 0; j < packets.size(); ++j) {
+      pcapHeader.caplen = pcapHeader.len = packets[j].size();
+      for (size_t k = 0; k < bpfPrograms.size(); ++k) {
+        if (bpf_filter(bpfPrograms[k].bf_insns, &packets[j][0],
+                       pcapHeader.len, pcapHeader.caplen) != 0) {
+          ++checksum;
+        }
+      }
+    }
+  }
+  bpfTime = now() - start;
+  start = now();
+  for (size_t i = 0; i < iterations; ++i) {
+    for (size_t j = 0; j < packets.size(); ++j) {
+      pcapHeader.caplen = pcapHeader.len = packets[j].size();
+      checksum += classifier.classify <DLT_EN10MB>(pcapHeader, &packets[j][0]);
+    }
+  }
+  classifierTime = now() - start;
+  cout << fixed << setprecision(1)
+       << "bpf_filter() per module: "
+       << bpfTime * 1000000000 / (iterations * packets.size())
+       << " ns/packet" << endl
+       << "Classifier:              "
+       << classifierTime * 1000000000 / (iterations * packets.size())
+       << " ns/packet" << endl;
+  /* Keep the compiler from discarding the loops. */
+  if (checksum == 0) {
+    cout << endl;
+  }
+  pcap_close(pcapDescriptor);
+  return 0;
+}
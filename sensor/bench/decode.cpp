@@ -0,0 +1,332 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Times Packet::initialize() and a read of the fields that the sensor and
+ * its modules look at on every packet, over a mix of untagged, 802.1Q and
+ * QinQ-tagged IPv4 packets, some with IP options, and IPv6 packets, some
+ * with extension headers. A capture file of any link type the sensor
+ * decodes can be used instead with -r.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <pcap.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <include/packet.h>
+
+using namespace std;
+
+static const size_t numPackets = 1024;
+
+static const char *kinds[] = { "IPv4 TCP", "IPv4 TCP, IP options",
+                               "IPv4 UDP", "IPv4 ICMP", "802.1Q IPv4 TCP",
+                               "QinQ IPv4 TCP", "IPv6 TCP",
+                               "IPv6 hop-by-hop UDP" };
+static const size_t numKinds = sizeof(kinds) / sizeof(kinds[0]);
+
+/*
+ * Appends an IPv4 header with "options" words of options, followed by a
+ * header for "protocol" and 64 bytes of payload.
+ */
+void ipv4(vector <u_char> &packet, const uint8_t &protocol,
+          const size_t &options) {
+  size_t start = packet.size(), length;
+  length = 20 + options * 4 +
+           ((protocol == 6) ? 20 : 8) + 64;
+  packet.resize(start + length, 0);
+  packet[start] = 0x45 + options;
+  packet[start + 2] = length >> 8;
+  packet[start + 3] = length & 0xff;
+  packet[start + 8] = 64;
+  packet[start + 9] = protocol;
+  packet[start + 12] = 10;
+  packet[start + 15] = random() % 256;
+  packet[start + 16] = 10;
+  packet[start + 19] = random() % 256;
+  start += 20 + options * 4;
+  packet[start] = random() % 256;
+  packet[start + 1] = random() % 256;
+  packet[start + 3] = 80;
+  if (protocol == 6) {
+    packet[start + 12] = 0x50;
+    packet[start + 13] = 0x18;
+  }
+}
+
+/*
+ * Appends an IPv6 header, a hop-by-hop options header if "options" is true,
+ * a header for "protocol" and 64 bytes of payload.
+ */
+void ipv6(vector <u_char> &packet, const uint8_t &protocol,
+          const bool &options) {
+  size_t start = packet.size(), length;
+  length = (options ? 8 : 0) + ((protocol == 6) ? 20 : 8) + 64;
+  packet.resize(start + 40 + length, 0);
+  packet[start] = 0x60;
+  packet[start + 4] = length >> 8;
+  packet[start + 5] = length & 0xff;
+  packet[start + 6] = options ? 0 : protocol;
+  packet[start + 7] = 64;
+  packet[start + 8] = 0x20;
+  packet[start + 23] = random() % 256;
+  packet[start + 24] = 0x20;
+  packet[start + 39] = random() % 256;
+  start += 40;
+  if (options) {
+    packet[start] = protocol;
+    start += 8;
+  }
+  packet[start] = random() % 256;
+  packet[start + 1] = random() % 256;
+  packet[start + 3] = 80;
+  if (protocol == 6) {
+    packet[start + 12] = 0x50;
+    packet[start + 13] = 0x18;
+  }
+}
+
+/* Appends an Ethernet header and "tags" VLAN tags, the outer one QinQ. */
+void ethernet(vector <u_char> &packet, const size_t &tags,
+              const uint16_t &etherType) {
+  packet.assign(12, 0);
+  for (size_t i = 0; i < tags; ++i) {
+    packet.push_back((i == 0 && tags > 1) ? 0x88 : 0x81);
+    packet.push_back((i == 0 && tags > 1) ? 0xa8 : 0x00);
+    packet.push_back(0);
+    packet.push_back(1 + i);
+  }
+  packet.push_back(etherType >> 8);
+  packet.push_back(etherType & 0xff);
+}
+
+void makePackets(vector <vector <u_char> > &packets, vector <size_t> &types) {
+  vector <u_char> packet;
+  size_t kind;
+  srandom(0);
+  for (size_t i = 0; i < numPackets; ++i) {
+    kind = random() % numKinds;
+    switch (kind) {
+      case 0:
+        ethernet(packet, 0, 0x0800);
+        ipv4(packet, 6, 0);
+        break;
+      case 1:
+        ethernet(packet, 0, 0x0800);
+        ipv4(packet, 6, 3);
+        break;
+      case 2:
+        ethernet(packet, 0, 0x0800);
+        ipv4(packet, 17, 0);
+        break;
+      case 3:
+        ethernet(packet, 0, 0x0800);
+        ipv4(packet, 1, 0);
+        break;
+      case 4:
+        ethernet(packet, 1, 0x0800);
+        ipv4(packet, 6, 0);
+        break;
+      case 5:
+        ethernet(packet, 2, 0x0800);
+        ipv4(packet, 6, 0);
+        break;
+      case 6:
+        ethernet(packet, 0, 0x86dd);
+        ipv6(packet, 6, false);
+        break;
+      default:
+        ethernet(packet, 0, 0x86dd);
+        ipv6(packet, 17, true);
+        break;
+    }
+    packets.push_back(packet);
+    types.push_back(kind);
+  }
+}
+
+/* Reads up to "numPackets" packets from a capture file. */
+bool readPackets(const char *fileName, vector <vector <u_char> > &packets,
+                 vector <size_t> &types, int &linkType) {
+  char errorBuffer[PCAP_ERRBUF_SIZE];
+  pcap_t *pcapDescriptor = pcap_open_offline(fileName, errorBuffer);
+  pcap_pkthdr *pcapHeader;
+  const u_char *pcapPacket;
+  if (pcapDescriptor == NULL) {
+    cerr << "pcap_open_offline(): " << errorBuffer << endl;
+    return false;
+  }
+  linkType = pcap_datalink(pcapDescriptor);
+  while (packets.size() < numPackets &&
+         pcap_next_ex(pcapDescriptor, &pcapHeader, &pcapPacket) == 1) {
+    packets.push_back(vector <u_char>(pcapPacket,
+                                      pcapPacket + pcapHeader -> caplen));
+    types.push_back(numKinds);
+  }
+  pcap_close(pcapDescriptor);
+  return (packets.size() > 0);
+}
+
+/* Decodes a packet and reads the fields a module typically looks at. */
+template <int linkType>
+static inline uint64_t decode(Packet &packet, const pcap_pkthdr &pcapHeader,
+                              const u_char *pcapPacket) {
+  if (packet.initialize <linkType>(pcapHeader, pcapPacket) == false) {
+    return 0;
+  }
+  return packet.protocol() + packet.sourcePort() + packet.destinationPort() +
+         packet.tcpFlags() + packet.payloadSize() + packet.flowHash();
+}
+
+double now() {
+  timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+/*
+ * Returns the time it takes to decode the packets at "indices" "iterations"
+ * times over, after counting how many of them are rejected.
+ */
+template <int linkType>
+double run(const vector <vector <u_char> > &packets,
+           const vector <size_t> &indices, const size_t &iterations,
+           size_t &rejected, uint64_t &checksum) {
+  Packet packet;
+  pcap_pkthdr pcapHeader;
+  double start;
+  memset(&pcapHeader, 0, sizeof(pcapHeader));
+  rejected = 0;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    pcapHeader.caplen = pcapHeader.len = packets[indices[i]].size();
+    if (packet.initialize <linkType>(pcapHeader,
+                                     &packets[indices[i]][0]) == false) {
+      ++rejected;
+    }
+  }
+  start = now();
+  for (size_t i = 0; i < iterations; ++i) {
+    for (size_t j = 0; j < indices.size(); ++j) {
+      pcapHeader.caplen = pcapHeader.len = packets[indices[j]].size();
+      checksum += decode <linkType>(packet, pcapHeader,
+                                    &packets[indices[j]][0]);
+    }
+  }
+  return now() - start;
+}
+
+void usage(const char *program) {
+  cerr << "usage: " << program << " [-i iterations] [-r file]" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  vector <vector <u_char> > packets;
+  vector <size_t> types, all;
+  vector <vector <size_t> > byKind(numKinds + 1);
+  vector <double> times(numKinds, 0);
+  double (*_run)(const vector <vector <u_char> >&, const vector <size_t>&,
+                 const size_t&, size_t&, uint64_t&);
+  const char *fileName = NULL;
+  size_t iterations = 10000, rejected = 0, _rejected;
+  uint64_t checksum = 0;
+  double total;
+  int linkType = DLT_EN10MB;
+  char option;
+  while ((option = getopt(argc, argv, "i:r:")) != -1) {
+    switch (option) {
+      case 'i':
+        iterations = strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        fileName = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (fileName != NULL) {
+    if (!readPackets(fileName, packets, types, linkType)) {
+      cerr << argv[0] << ": " << fileName << ": no packets read" << endl;
+      return 1;
+    }
+  }
+  else {
+    makePackets(packets, types);
+  }
+  switch (linkType) {
+    case DLT_EN10MB:
+      _run = &run <DLT_EN10MB>;
+      break;
+    case DLT_LINUX_SLL:
+      _run = &run <DLT_LINUX_SLL>;
+      break;
+    case DLT_RAW:
+#ifdef DLT_IPV4
+    case DLT_IPV4:
+    case DLT_IPV6:
+#endif
+      _run = &run <DLT_RAW>;
+      break;
+    default:
+      cerr << argv[0] << ": " << fileName << ": unsupported link type" << endl;
+      return 1;
+  }
+  for (size_t i = 0; i < packets.size(); ++i) {
+    all.push_back(i);
+    byKind[types[i]].push_back(i);
+  }
+  /* The whole corpus, in its mixed order. */
+  total = _run(packets, all, iterations, rejected, checksum);
+  /* Each kind of packet on its own. */
+  for (size_t kind = 0; kind < numKinds && fileName == NULL; ++kind) {
+    times[kind] = _run(packets, byKind[kind], iterations, _rejected,
+                       checksum);
+  }
+  cout << fixed << setprecision(1);
+  for (size_t kind = 0; kind < numKinds && fileName == NULL; ++kind) {
+    cout << setw(22) << left << (string(kinds[kind]) + ':')
+         << times[kind] * 1000000000 / (byKind[kind].size() * iterations)
+         << " ns/packet" << endl;
+  }
+  cout << setw(22) << left << "All:"
+       << total * 1000000000 / (packets.size() * iterations) << " ns/packet ("
+       << rejected << " of " << packets.size() << " packets rejected)" << endl;
+  /* Keep the compiler from discarding the loops. */
+  if (checksum == 0) {
+    cout << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Compares session table lookups keyed by the string-based FlowID in an
+ * unordered_map, as the modules used to do them, with lookups keyed by
+ * FlowKey in a FlowMap. Packets pick a flow at random and go in either
+ * direction; a FlowID lookup that misses is retried with the endpoints
+ * swapped, as it had to be to find the other direction's session.
+ */
+
+#include <cstdlib>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+#include <tr1/unordered_map>
+
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <include/flowID.h>
+#include <include/flowKey.h>
+#include <include/flowMap.hpp>
+
+using namespace std;
+using namespace tr1;
+
+struct Tuple {
+  uint32_t sourceIP;
+  uint32_t destinationIP;
+  uint16_t sourcePort;
+  uint16_t destinationPort;
+};
+
+double now() {
+  timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+void usage(const char *program) {
+  cerr << "usage: " << program << " [-f flows] [-l lookups]" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  vector <Tuple> flows, packets;
+  Tuple tuple;
+  unordered_map <string, shared_ptr <int> > stringMap;
+  unordered_map <string, shared_ptr <int> >::iterator stringItr;
+  FlowMap <shared_ptr <int> > flowMap;
+  FlowMap <shared_ptr <int> >::iterator flowItr;
+  FlowID flowID;
+  FlowKey flowKey;
+  shared_ptr <int> value(new int(1));
+  size_t numFlows = 100000, numLookups = 10000000;
+  uint64_t checksum = 0;
+  double start, insertTime[2], lookupTime[2];
+  char option;
+  while ((option = getopt(argc, argv, "f:l:")) != -1) {
+    switch (option) {
+      case 'f':
+        numFlows = strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        numLookups = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  srandom(0);
+  for (size_t i = 0; i < numFlows; ++i) {
+    tuple.sourceIP = random();
+    tuple.destinationIP = random();
+    tuple.sourcePort = random();
+    tuple.destinationPort = 80;
+    flows.push_back(tuple);
+  }
+  for (size_t i = 0; i < numLookups; ++i) {
+    tuple = flows[random() % numFlows];
+    if (random() % 2 == 1) {
+      swap(tuple.sourceIP, tuple.destinationIP);
+      swap(tuple.sourcePort, tuple.destinationPort);
+    }
+    packets.push_back(tuple);
+  }
+  stringMap.rehash(numFlows);
+  if (!flowMap.initialize(numFlows)) {
+    cerr << argv[0] << ": " << flowMap.error() << endl;
+    return 1;
+  }
+  start = now();
+  for (size_t i = 0; i < numFlows; ++i) {
+    flowID.set(6, flows[i].sourceIP, flows[i].destinationIP,
+               flows[i].sourcePort, flows[i].destinationPort);
+    stringMap.insert(make_pair(flowID.data(), value));
+  }
+  insertTime[0] = now() - start;
+  start = now();
+  for (size_t i = 0; i < numFlows; ++i) {
+    flowKey.set(6, flows[i].sourceIP, flows[i].destinationIP,
+                flows[i].sourcePort, flows[i].destinationPort);
+    if (flowMap.insert(make_pair(flowKey, value)).second == false) {
+      cerr << argv[0] << ": FlowMap is full" << endl;
+      return 1;
+    }
+  }
+  insertTime[1] = now() - start;
+  start = now();
+  for (size_t i = 0; i < numLookups; ++i) {
+    flowID.set(6, packets[i].sourceIP, packets[i].destinationIP,
+               packets[i].sourcePort, packets[i].destinationPort);
+    stringItr = stringMap.find(flowID.data());
+    if (stringItr == stringMap.end()) {
+      flowID.set(6, packets[i].destinationIP, packets[i].sourceIP,
+                 packets[i].destinationPort, packets[i].sourcePort);
+      stringItr = stringMap.find(flowID.data());
+    }
+    checksum += *(stringItr -> second);
+  }
+  lookupTime[0] = now() - start;
+  start = now();
+  for (size_t i = 0; i < numLookups; ++i) {
+    flowKey.set(6, packets[i].sourceIP, packets[i].destinationIP,
+                packets[i].sourcePort, packets[i].destinationPort);
+    flowItr = flowMap.find(flowKey);
+    checksum += *(flowItr -> second);
+  }
+  lookupTime[1] = now() - start;
+  if (checksum != numLookups * 2) {
+    cerr << argv[0] << ": lookups disagree" << endl;
+    return 1;
+  }
+  cout << fixed << setprecision(1)
+       << "FlowID and unordered_map: "
+       << insertTime[0] * 1000000000 / numFlows << " ns/insert, "
+       << lookupTime[0] * 1000000000 / numLookups << " ns/lookup" << endl
+       << "FlowKey and FlowMap:      "
+       << insertTime[1] * 1000000000 / numFlows << " ns/insert, "
+       << lookupTime[1] * 1000000000 / numLookups << " ns/lookup" << endl;
+  return 0;
+}
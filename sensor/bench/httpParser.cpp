@@ -0,0 +1,280 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Times http_parser_execute() over a stream of requests and a stream of
+ * responses, fed to it a segment at a time as the http module would see
+ * them. The built-in corpora are browser-like requests, with long cookies and
+ * query strings, and responses with identity and chunked bodies. Recorded
+ * streams can be used instead with -q and -p: each file should hold one
+ * direction of a connection, such as Wireshark's "Follow TCP Stream" saves as
+ * raw data.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <include/httpParser.h>
+
+using namespace std;
+
+static const size_t numMessages = 1024;
+
+/* Counts what the parser hands to the callbacks, so none of it is skipped. */
+static uint64_t bytes;
+static uint64_t completed;
+
+static int data(http_parser *parser __attribute__((unused)),
+                const char *data __attribute__((unused)), size_t length) {
+  bytes += length;
+  return 0;
+}
+
+static int messageComplete(http_parser *parser __attribute__((unused))) {
+  ++completed;
+  return 0;
+}
+
+string randomString(const size_t &length) {
+  static const char characters[] = "abcdefghijklmnopqrstuvwxyz"
+                                   "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  string _string;
+  for (size_t i = 0; i < length; ++i) {
+    _string += characters[random() % (sizeof(characters) - 1)];
+  }
+  return _string;
+}
+
+void makeRequests(string &stream) {
+  ostringstream request;
+  string body;
+  srandom(0);
+  for (size_t i = 0; i < numMessages; ++i) {
+    body = (random() % 8 == 0) ? randomString(random() % 1024) : "";
+    request.str("");
+    request << (body.empty() ? "GET" : "POST") << " /"
+            << randomString(1 + random() % 16) << '/'
+            << randomString(1 + random() % 32) << ".html";
+    if (random() % 2 == 0) {
+      request << '?';
+      for (size_t j = 0, n = 1 + random() % 8; j < n; ++j) {
+        request << (j > 0 ? "&" : "") << randomString(1 + random() % 8) << '='
+                << randomString(random() % 32);
+      }
+    }
+    request << " HTTP/1.1\r\n"
+            << "Host: www." << randomString(4 + random() % 12) << ".com\r\n"
+            << "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:2.0.1) "
+               "Gecko/20100101 Firefox/4.0.1\r\n"
+            << "Accept: text/html,application/xhtml+xml,application/xml;"
+               "q=0.9,*/*;q=0.8\r\n"
+            << "Accept-Language: en-us,en;q=0.5\r\n"
+            << "Accept-Encoding: gzip, deflate\r\n"
+            << "Referer: http://www." << randomString(8) << ".com/"
+            << randomString(random() % 64) << "\r\n"
+            << "Cookie: " << randomString(64 + random() % 2048) << "\r\n"
+            << "Connection: keep-alive\r\n";
+    if (!body.empty()) {
+      request << "Content-Type: application/x-www-form-urlencoded\r\n"
+              << "Content-Length: " << body.size() << "\r\n";
+    }
+    request << "\r\n" << body;
+    stream += request.str();
+  }
+}
+
+void makeResponses(string &stream) {
+  ostringstream response;
+  string body;
+  size_t chunk;
+  srandom(1);
+  for (size_t i = 0; i < numMessages; ++i) {
+    body = randomString(random() % 8192);
+    response.str("");
+    response << "HTTP/1.1 200 OK\r\n"
+             << "Date: Mon, 23 May 2011 22:38:34 GMT\r\n"
+             << "Server: Apache/2.2.17 (Unix)\r\n"
+             << "Last-Modified: Wed, 08 Jan 2011 23:11:55 GMT\r\n"
+             << "ETag: \"" << randomString(16) << "\"\r\n"
+             << "Cache-Control: max-age=3600, public\r\n"
+             << "Content-Type: text/html; charset=UTF-8\r\n";
+    if (random() % 4 == 0) {
+      response << "Set-Cookie: " << randomString(8) << '='
+               << randomString(32 + random() % 256)
+               << "; path=/; expires=Wed, 09 Jun 2021 10:18:14 GMT\r\n";
+    }
+    if (random() % 4 == 0) {
+      response << "Transfer-Encoding: chunked\r\n\r\n";
+      for (size_t j = 0; j < body.size(); j += chunk) {
+        chunk = min(body.size() - j, (size_t)(1 + random() % 2048));
+        response << hex << chunk << dec << "\r\n" << body.substr(j, chunk)
+                 << "\r\n";
+      }
+      response << "0\r\n\r\n";
+    }
+    else {
+      response << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+    }
+    stream += response.str();
+  }
+}
+
+bool readStream(const char *fileName, string &stream) {
+  ifstream file(fileName, ios::in | ios::binary);
+  if (!file) {
+    return false;
+  }
+  stream.assign(istreambuf_iterator <char>(file), istreambuf_iterator <char>());
+  return (stream.size() > 0);
+}
+
+double now() {
+  timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+/*
+ * Returns the time it takes to parse "stream" "iterations" times over, in
+ * segments of "segmentSize" bytes, or a negative number if the parser
+ * rejects it.
+ */
+double run(const string &stream, const http_parser_type &type,
+           const size_t &iterations, const size_t &segmentSize) {
+  http_parser parser;
+  http_parser_settings settings;
+  size_t length;
+  double start;
+  memset(&settings, 0, sizeof(settings));
+  settings.on_path = &data;
+  settings.on_query_string = &data;
+  settings.on_url = &data;
+  settings.on_fragment = &data;
+  settings.on_header_field = &data;
+  settings.on_header_value = &data;
+  settings.on_body = &data;
+  settings.on_message_complete = &messageComplete;
+  completed = 0;
+  start = now();
+  for (size_t i = 0; i < iterations; ++i) {
+    http_parser_init(&parser, type);
+    for (size_t j = 0; j < stream.size(); j += segmentSize) {
+      length = min(segmentSize, stream.size() - j);
+      if (http_parser_execute(&parser, &settings, stream.data() + j,
+                              length) != length) {
+        return -1;
+      }
+    }
+  }
+  return now() - start;
+}
+
+/* Prints the throughput of parsing one stream. */
+bool report(const char *name, const string &stream,
+            const http_parser_type &type, const size_t &iterations,
+            const size_t &segmentSize) {
+  double time = run(stream, type, iterations, segmentSize);
+  if (time < 0) {
+    cerr << name << ": parse error" << endl;
+    return false;
+  }
+  cout << setw(11) << left << (string(name) + ':')
+       << stream.size() * iterations / time / 1048576 << " MiB/s, "
+       << time * 1000000000 / completed << " ns/message ("
+       << completed / iterations << " messages, " << stream.size()
+       << " bytes)" << endl;
+  return true;
+}
+
+void usage(const char *program) {
+  cerr << "usage: " << program
+       << " [-i iterations] [-s segment size] [-q requests] [-p responses]"
+       << endl;
+}
+
+int main(int argc, char *argv[]) {
+  string requests, responses;
+  size_t iterations = 100, segmentSize = 1448;
+  char option;
+  while ((option = getopt(argc, argv, "i:s:q:p:")) != -1) {
+    switch (option) {
+      case 'i':
+        iterations = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        segmentSize = strtoul(optarg, NULL, 10);
+        break;
+      case 'q':
+        if (!readStream(optarg, requests)) {
+          cerr << argv[0] << ": " << optarg << ": nothing read" << endl;
+          return 1;
+        }
+        break;
+      case 'p':
+        if (!readStream(optarg, responses)) {
+          cerr << argv[0] << ": " << optarg << ": nothing read" << endl;
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (iterations == 0 || segmentSize == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (requests.empty()) {
+    makeRequests(requests);
+  }
+  if (responses.empty()) {
+    makeResponses(responses);
+  }
+  cout << fixed << setprecision(1);
+  if (!report("Requests", requests, HTTP_REQUEST, iterations, segmentSize) ||
+      !report("Responses", responses, HTTP_RESPONSE, iterations,
+              segmentSize)) {
+    return 1;
+  }
+  /* Keep the compiler from discarding the loops. */
+  if (bytes == 0) {
+    cout << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdlib>
+
+#include "arena.h"
+
+Arena::Usage::Usage() {
+  arenas = 0;
+  bytes = 0;
+  chunks = 0;
+}
+
+Arena::Arena() {
+  top = NULL;
+  end = NULL;
+  chunks = NULL;
+  numChunks = 0;
+  chunkSize = 4096;
+  _size = 0;
+  usage = NULL;
+}
+
+/*
+ * Gives the arena its first chunk, "buffer", which the arena never frees.
+ * Must be called before anything is allocated.
+ */
+void Arena::initialize(char *buffer, const size_t length,
+                       const size_t chunkSize, Usage *usage) {
+  top = buffer;
+  end = buffer + length;
+  if (chunkSize > 0) {
+    this -> chunkSize = chunkSize;
+  }
+  this -> usage = usage;
+}
+
+/*
+ * Returns "size" bytes aligned to "alignment", which must be a power of two.
+ * Throws std::bad_alloc, as STL allocators must, if a new chunk is needed
+ * and can't be had.
+ */
+void *Arena::allocate(const size_t size, const size_t alignment) {
+  char *address = (char*)(((uintptr_t)top + alignment - 1) &
+                          ~(uintptr_t)(alignment - 1));
+  size_t length;
+  Chunk *chunk;
+  if (top == NULL || address + size > end) {
+    length = sizeof(Chunk) + size + alignment;
+    if (length < chunkSize) {
+      length = chunkSize;
+    }
+    chunk = (Chunk*)malloc(length);
+    if (chunk == NULL) {
+      throw std::bad_alloc();
+    }
+    chunk -> next = chunks;
+    chunks = chunk;
+    ++numChunks;
+    top = (char*)(chunk + 1);
+    end = (char*)chunk + length;
+    address = (char*)(((uintptr_t)top + alignment - 1) &
+                      ~(uintptr_t)(alignment - 1));
+  }
+  top = address + size;
+  _size += size;
+  return address;
+}
+
+/*
+ * Grows the allocation of "length" bytes at "data" by "more" bytes in place,
+ * if it was the last one made and there is room after it.
+ */
+bool Arena::extend(const char *data, const size_t length, const size_t more) {
+  if (data + length != top || (size_t)(end - top) < more) {
+    return false;
+  }
+  top += more;
+  _size += more;
+  return true;
+}
+
+/*
+ * Takes back the allocation of "length" bytes at "data", if it was the last
+ * one made.
+ */
+bool Arena::retract(const char *data, const size_t length) {
+  if (data + length != top) {
+    return false;
+  }
+  top = (char*)data;
+  _size -= length;
+  return true;
+}
+
+/* Returns the number of bytes handed out since the arena was released. */
+size_t Arena::size() const {
+  return _size;
+}
+
+/*
+ * Frees every chunk that the arena allocated. Anything allocated from it is
+ * gone, including anything in the first chunk, which is no longer used.
+ */
+void Arena::release() {
+  Chunk *next;
+  if (usage != NULL && _size > 0) {
+    __sync_add_and_fetch(&(usage -> arenas), 1);
+    __sync_add_and_fetch(&(usage -> bytes), _size);
+    __sync_add_and_fetch(&(usage -> chunks), numChunks);
+  }
+  while (chunks != NULL) {
+    next = chunks -> next;
+    free(chunks);
+    chunks = next;
+  }
+  numChunks = 0;
+  top = NULL;
+  end = NULL;
+  _size = 0;
+  usage = NULL;
+}
+
+Arena::~Arena() {
+  release();
+}
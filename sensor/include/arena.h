@@ -0,0 +1,128 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+
+#include <stdint.h>
+
+/*
+ * A bump allocator for data that all goes away at once. allocate() hands out
+ * the next bytes of the current chunk, and nothing is freed until release(),
+ * or the destructor, frees everything in one go. The first chunk is
+ * supplied by the owner, typically as the tail of the block that the owner
+ * itself lives in, so an arena that stays within it never touches the heap.
+ * Further chunks of at least "chunkSize" bytes are allocated as needed.
+ *
+ * If a Usage is given, release() adds what the arena used to it, if it used
+ * anything, so that the size of the first chunk can be tuned.
+ */
+class Arena {
+  public:
+    struct Usage {
+      Usage();
+      volatile uint64_t arenas;
+      volatile uint64_t bytes;
+      volatile uint64_t chunks;
+    };
+    Arena();
+    void initialize(char *buffer, const size_t length,
+                    const size_t chunkSize, Usage *usage);
+    void *allocate(const size_t size, const size_t alignment);
+    bool extend(const char *data, const size_t length, const size_t more);
+    bool retract(const char *data, const size_t length);
+    size_t size() const;
+    void release();
+    ~Arena();
+  private:
+    struct Chunk {
+      Chunk *next;
+    };
+    char *top;
+    char *end;
+    Chunk *chunks;
+    size_t numChunks;
+    size_t chunkSize;
+    size_t _size;
+    Usage *usage;
+    Arena(const Arena&);
+    Arena &operator=(const Arena&);
+};
+
+/*
+ * An STL allocator that allocates from an Arena. Deallocation does nothing;
+ * the memory is reclaimed when the arena is released.
+ */
+template <class T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template <class U>
+    struct rebind {
+      typedef ArenaAllocator <U> other;
+    };
+    ArenaAllocator(Arena &arena) : arena(&arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator <U> &allocator)
+      : arena(allocator.arena) {}
+    pointer address(reference value) const {
+      return &value;
+    }
+    const_pointer address(const_reference value) const {
+      return &value;
+    }
+    pointer allocate(size_type count, const void* = 0) {
+      return (pointer)arena -> allocate(count * sizeof(T), __alignof__(T));
+    }
+    void deallocate(pointer, size_type) {}
+    size_type max_size() const {
+      return (size_t)-1 / sizeof(T);
+    }
+    void construct(pointer address, const T &value) {
+      new((void*)address) T(value);
+    }
+    void destroy(pointer address) {
+      address -> ~T();
+    }
+    template <class U>
+    bool operator==(const ArenaAllocator <U> &allocator) const {
+      return arena == allocator.arena;
+    }
+    template <class U>
+    bool operator!=(const ArenaAllocator <U> &allocator) const {
+      return arena != allocator.arena;
+    }
+    Arena *arena;
+};
+
+#endif
@@ -32,6 +32,7 @@
 #include <sys/stat.h>
 
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "berkeleyDB.h"
@@ -214,6 +215,9 @@ std::tr1::unordered_map <uint32_t, BerkeleyDB::_BerkeleyDB>::iterator BerkeleyDB
  * database, creating it if it doesn't exist.
  */
 bool BerkeleyDB::write(const void* data, const size_t dataSize, const uint32_t time) {
+  timespec start, end;
+  bool written = false;
+  clock_gettime(CLOCK_MONOTONIC, &start);
   std::tr1::unordered_map <uint32_t, _BerkeleyDB>::iterator db = find(time - (time % 3600));
   if (db != databases.end()) {
     db -> second.key.size = sizeof(db -> second.recordNumber);
@@ -223,10 +227,21 @@ bool BerkeleyDB::write(const void* data, const size_t dataSize, const uint32_t t
     if (db -> second.db -> put(db -> second.db, NULL, &(db -> second.key),
                                &(db -> second.data), 0) == 0) {
       ++(db -> second.recordNumber);
-      return true;
+      written = true;
     }
   }
-  return false;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  _writeLatency.record((end.tv_sec - start.tv_sec) * 1000000000ULL +
+                       end.tv_nsec - start.tv_nsec);
+  return written;
+}
+
+/*
+ * Returns a histogram of how long write() has taken, including opening a new
+ * database when a record starts a new hour. It may be read from any thread.
+ */
+const Histogram &BerkeleyDB::writeLatency() const {
+  return _writeLatency;
 }
 
 /*
@@ -31,6 +31,8 @@
 #include <db.h>
 #include <pthread.h>
 
+#include <include/histogram.h>
+
 class BerkeleyDB {
   public:
     BerkeleyDB();
@@ -44,6 +46,7 @@ class BerkeleyDB {
     int unlock();
     bool write(const void *data, const size_t size, const uint32_t time);
     bool flush();
+    const Histogram &writeLatency() const;
     ~BerkeleyDB();
   private:
     std::string _directory;
@@ -52,6 +55,8 @@ class BerkeleyDB {
     pthread_mutex_t _lock;
     bool _error;
     std::string errorMessage;
+    /* How long each call to write() took, in nanoseconds. */
+    Histogram _writeLatency;
     /*
      * A hash table of _BerkeleyDB classes allows us to find the one that we
      * will write to quickly given the start time of the record to be written.
@@ -0,0 +1,663 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#ifdef __FreeBSD__
+#include <sys/ioctl.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "capture.h"
+
+Capture::Capture() {
+  _error = true;
+  errorMessage = "Capture::Capture(): class not initialized";
+  pcapDescriptor = NULL;
+  _datalink = DLT_EN10MB;
+  _done = false;
+#ifdef __linux__
+  ringDescriptor = -1;
+  ring = NULL;
+  ringReceived = 0;
+  ringDropped = 0;
+#endif
+}
+
+bool Capture::initialize(const Configuration &conf,
+                         const std::string &filter) {
+  if (conf.getString("capture") == "" || conf.getString("capture") == "pcap") {
+    _type = PCAP_CAPTURE;
+    return openPcap(conf, filter);
+  }
+  if (conf.getString("capture") == "ring") {
+    _type = RING_CAPTURE;
+    return openRing(conf, filter);
+  }
+  _error = true;
+  errorMessage = "Capture::initialize(): unknown capture type \"" +
+                 conf.getString("capture") + "\"";
+  return false;
+}
+
+/*
+ * Prepares to replay a list of pcap files in order. Directories in the list
+ * are replaced by the files in them, sorted by name. A "speed" of 0 replays
+ * packets as fast as possible; any other value paces them by their
+ * timestamps, sped up by that factor.
+ */
+bool Capture::initialize(const std::vector <std::string> &paths,
+                         const std::string &filter, const double &speed) {
+  std::vector <std::string> directoryFiles;
+  DIR *directory;
+  dirent *entry;
+  struct stat status;
+  _type = OFFLINE_CAPTURE;
+  files.clear();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (stat(paths[i].c_str(), &status) == -1) {
+      _error = true;
+      errorMessage = "Capture::initialize(): stat(): " + paths[i] + ": " +
+                     strerror(errno);
+      return false;
+    }
+    if (!S_ISDIR(status.st_mode)) {
+      files.push_back(paths[i]);
+      continue;
+    }
+    directory = opendir(paths[i].c_str());
+    if (directory == NULL) {
+      _error = true;
+      errorMessage = "Capture::initialize(): opendir(): " + paths[i] + ": " +
+                     strerror(errno);
+      return false;
+    }
+    directoryFiles.clear();
+    while ((entry = readdir(directory)) != NULL) {
+      if (entry -> d_name[0] != '.') {
+        directoryFiles.push_back(paths[i] + '/' + entry -> d_name);
+      }
+    }
+    closedir(directory);
+    sort(directoryFiles.begin(), directoryFiles.end());
+    files.insert(files.end(), directoryFiles.begin(), directoryFiles.end());
+  }
+  if (files.size() == 0) {
+    _error = true;
+    errorMessage = "Capture::initialize(): no capture files to replay";
+    return false;
+  }
+  _filter = filter;
+  this -> speed = speed;
+  paced = false;
+  file = 0;
+  _done = false;
+  if (!openFile()) {
+    return false;
+  }
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+bool Capture::openPcap(const Configuration &conf, const std::string &filter) {
+  char errorBuffer[PCAP_ERRBUF_SIZE];
+  bpf_program bpfProgram;
+#ifdef __FreeBSD__
+  u_int immediate = 1;
+#endif
+  /*
+   * Time out reads on an idle link, so that the sensor can hand off packets
+   * it has batched up instead of waiting for more traffic.
+   */
+  pcapDescriptor = pcap_open_live(conf.getString("interface").c_str(),
+                                  std::numeric_limits <uint16_t>::max(), 1,
+                                  100, errorBuffer);
+  if (pcapDescriptor == NULL) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_open_live(): ";
+    errorMessage += errorBuffer;
+    return false;
+  }
+  _datalink = pcap_datalink(pcapDescriptor);
+  /*
+   * Older versions of libpcap expect the third argument of pcap_compile()
+   * to be of type "char*".
+   */
+  if (pcap_compile(pcapDescriptor, &bpfProgram, (char*)filter.c_str(), 1,
+                   0) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_compile(): ";
+    errorMessage += pcap_geterr(pcapDescriptor);
+    return false;
+  }
+  if (pcap_setfilter(pcapDescriptor, &bpfProgram) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_setfilter(): ";
+    errorMessage += pcap_geterr(pcapDescriptor);
+    pcap_freecode(&bpfProgram);
+    return false;
+  }
+  pcap_freecode(&bpfProgram);
+/* If running on FreeBSD, put the BPF device into immediate mode. */
+#ifdef __FreeBSD__
+  if (ioctl(pcap_fileno(pcapDescriptor), BIOCIMMEDIATE, &immediate) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): ioctl(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+#endif
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+bool Capture::openRing(const Configuration &conf, const std::string &filter) {
+#ifdef __linux__
+  pcap_t *deadDescriptor;
+  bpf_program bpfProgram;
+  sock_fprog socketFilter;
+  tpacket_req3 request;
+  sockaddr_ll address;
+  packet_mreq membership;
+  ifreq interface;
+  int version = TPACKET_V3;
+  unsigned int interfaceIndex;
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  /* The ring size is given in MiB and the block size in KiB. */
+  if (conf.getString("ringSize") == "") {
+    ringSize = 64 * 1024 * 1024;
+  }
+  else {
+    ringSize = conf.getNumber("ringSize") * 1024 * 1024;
+  }
+  if (conf.getString("ringBlockSize") == "") {
+    blockSize = 1024 * 1024;
+  }
+  else {
+    blockSize = conf.getNumber("ringBlockSize") * 1024;
+  }
+  if (conf.getString("ringTimeout") == "") {
+    timeout = 100;
+  }
+  else {
+    timeout = conf.getNumber("ringTimeout");
+  }
+  if (blockSize == 0 || blockSize % pageSize != 0) {
+    _error = true;
+    errorMessage = "Capture::initialize(): ring block size must be a "
+                   "multiple of the page size";
+    return false;
+  }
+  if (ringSize < blockSize) {
+    _error = true;
+    errorMessage = "Capture::initialize(): ring size must be at least as "
+                   "large as the ring block size";
+    return false;
+  }
+  numBlocks = ringSize / blockSize;
+  ringSize = numBlocks * blockSize;
+  interfaceIndex = if_nametoindex(conf.getString("interface").c_str());
+  if (interfaceIndex == 0) {
+    _error = true;
+    errorMessage = "Capture::initialize(): if_nametoindex(): " +
+                   conf.getString("interface") + ": " + strerror(errno);
+    return false;
+  }
+  /*
+   * A packet socket opened for protocol 0 receives nothing until it is bound,
+   * so frames from other interfaces can't slip into the ring before bind()
+   * ties it to ours and asks for every protocol.
+   */
+  ringDescriptor = socket(AF_PACKET, SOCK_RAW, 0);
+  if (ringDescriptor == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): socket(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  /*
+   * Frames in the ring start with whatever link-layer header the interface
+   * has, which for a tunnel is none at all.
+   */
+  memset(&interface, 0, sizeof(interface));
+  strncpy(interface.ifr_name, conf.getString("interface").c_str(),
+          sizeof(interface.ifr_name) - 1);
+  if (ioctl(ringDescriptor, SIOCGIFHWADDR, &interface) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): ioctl(): SIOCGIFHWADDR: ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  switch (interface.ifr_hwaddr.sa_family) {
+    case ARPHRD_ETHER:
+    case ARPHRD_LOOPBACK:
+      _datalink = DLT_EN10MB;
+      break;
+    case ARPHRD_NONE:
+      _datalink = DLT_RAW;
+      break;
+    default:
+      _error = true;
+      errorMessage = "Capture::initialize(): " + conf.getString("interface") +
+                     ": only Ethernet and raw IP interfaces can be captured "
+                     "with a ring";
+      return false;
+  }
+  /*
+   * The kernel runs the same classic BPF that libpcap does, so we let libpcap
+   * compile the filter and attach the result to the socket ourselves. This is
+   * done before the ring is set up so that no unfiltered traffic ends up in
+   * it.
+   */
+  deadDescriptor = pcap_open_dead(_datalink,
+                                  std::numeric_limits <uint16_t>::max());
+  if (deadDescriptor == NULL) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_open_dead() failed";
+    return false;
+  }
+  if (pcap_compile(deadDescriptor, &bpfProgram, (char*)filter.c_str(), 1,
+                   0) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_compile(): ";
+    errorMessage += pcap_geterr(deadDescriptor);
+    pcap_close(deadDescriptor);
+    return false;
+  }
+  pcap_close(deadDescriptor);
+  socketFilter.len = bpfProgram.bf_len;
+  socketFilter.filter = (sock_filter*)bpfProgram.bf_insns;
+  if (setsockopt(ringDescriptor, SOL_SOCKET, SO_ATTACH_FILTER, &socketFilter,
+                 sizeof(socketFilter)) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): setsockopt(): SO_ATTACH_FILTER: ";
+    errorMessage += strerror(errno);
+    pcap_freecode(&bpfProgram);
+    return false;
+  }
+  pcap_freecode(&bpfProgram);
+  if (setsockopt(ringDescriptor, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): setsockopt(): PACKET_VERSION: ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  /*
+   * With TPACKET_V3, frames are packed back-to-back inside of each block, so
+   * the frame size only matters to the kernel's sanity checks.
+   */
+  memset(&request, 0, sizeof(request));
+  request.tp_block_size = blockSize;
+  request.tp_block_nr = numBlocks;
+  request.tp_frame_size = TPACKET_ALIGNMENT << 7;
+  request.tp_frame_nr = ringSize / request.tp_frame_size;
+  request.tp_retire_blk_tov = timeout;
+  if (setsockopt(ringDescriptor, SOL_PACKET, PACKET_RX_RING, &request,
+                 sizeof(request)) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): setsockopt(): PACKET_RX_RING: ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  ring = (u_char*)mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       ringDescriptor, 0);
+  if (ring == MAP_FAILED) {
+    ring = NULL;
+    _error = true;
+    errorMessage = "Capture::initialize(): mmap(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sll_family = AF_PACKET;
+  address.sll_protocol = htons(ETH_P_ALL);
+  address.sll_ifindex = interfaceIndex;
+  if (bind(ringDescriptor, (sockaddr*)&address, sizeof(address)) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): bind(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  memset(&membership, 0, sizeof(membership));
+  membership.mr_ifindex = interfaceIndex;
+  membership.mr_type = PACKET_MR_PROMISC;
+  if (setsockopt(ringDescriptor, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                 &membership, sizeof(membership)) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): setsockopt(): "
+                   "PACKET_ADD_MEMBERSHIP: ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  block = 0;
+  blockHeader = NULL;
+  frame = NULL;
+  framesLeft = 0;
+  _error = false;
+  errorMessage.clear();
+  return true;
+#else
+  (void)conf;
+  (void)filter;
+  _error = true;
+  errorMessage = "Capture::initialize(): ring capture is only supported on "
+                 "Linux";
+  return false;
+#endif
+}
+
+Capture::operator bool() const {
+  return !_error;
+}
+
+const std::string &Capture::error() const {
+  return errorMessage;
+}
+
+const CaptureType &Capture::type() const {
+  return _type;
+}
+
+/* The pcap datalink type of the packets next() returns. */
+const int &Capture::datalink() const {
+  return _datalink;
+}
+
+/* Returns whether every packet in a replay has been read. */
+const bool &Capture::done() const {
+  return _done;
+}
+
+/*
+ * Joins a ring to a PACKET_FANOUT_HASH group, so that the kernel spreads
+ * traffic across every ring in the group by a hash of its flow. The hash is
+ * symmetric, and fragments are reassembled before they are hashed, so both
+ * directions of a flow and all of its fragments reach the same ring.
+ */
+bool Capture::fanout(const uint16_t &group) {
+#ifdef __linux__
+  int argument = group | ((PACKET_FANOUT_HASH |
+                           PACKET_FANOUT_FLAG_DEFRAG) << 16);
+  if (_type != RING_CAPTURE) {
+    _error = true;
+    errorMessage = "Capture::fanout(): fanout requires ring capture";
+    return false;
+  }
+  if (setsockopt(ringDescriptor, SOL_PACKET, PACKET_FANOUT, &argument,
+                 sizeof(argument)) == -1) {
+    _error = true;
+    errorMessage = "Capture::fanout(): setsockopt(): PACKET_FANOUT: ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  return true;
+#else
+  (void)group;
+  _error = true;
+  errorMessage = "Capture::fanout(): fanout is only supported on Linux";
+  return false;
+#endif
+}
+
+/*
+ * Returns the next captured packet and fills in its pcap header, or returns
+ * NULL if no packet arrived in time. Like pcap_next(), the returned packet is
+ * only valid until the next call.
+ */
+const u_char *Capture::next(pcap_pkthdr &pcapHeader) {
+  if (_type == OFFLINE_CAPTURE) {
+    return nextPacket(pcapHeader);
+  }
+#ifdef __linux__
+  if (_type == RING_CAPTURE) {
+    return nextFrame(pcapHeader);
+  }
+#endif
+  return pcap_next(pcapDescriptor, &pcapHeader);
+}
+
+/*
+ * Returns the number of packets that next() can return before the memory
+ * holding the packets it has already returned is reused. With ring capture,
+ * this is the number of frames left in the current block, so packets can be
+ * held on to without copying them until it drops to 0.
+ */
+size_t Capture::pending() const {
+#ifdef __linux__
+  if (_type == RING_CAPTURE) {
+    return framesLeft;
+  }
+#endif
+  return 0;
+}
+
+/*
+ * Fills in how many packets the kernel has passed to the capture, how many it
+ * dropped for lack of room, and how many the interface dropped, since the
+ * capture was opened. Returns false if the backend keeps no such counts, as
+ * with replays. It may be called from a thread other than the one capturing.
+ */
+bool Capture::statistics(uint64_t &received, uint64_t &dropped,
+                         uint64_t &ifDropped) {
+  pcap_stat pcapStatistics;
+#ifdef __linux__
+  tpacket_stats_v3 ringStatistics;
+  socklen_t length = sizeof(ringStatistics);
+  if (_type == RING_CAPTURE) {
+    if (getsockopt(ringDescriptor, SOL_PACKET, PACKET_STATISTICS,
+                   &ringStatistics, &length) == -1) {
+      return false;
+    }
+    /* The kernel counts dropped packets as received, like libpcap. */
+    ringReceived += ringStatistics.tp_packets;
+    ringDropped += ringStatistics.tp_drops;
+    received = ringReceived;
+    dropped = ringDropped;
+    ifDropped = 0;
+    return true;
+  }
+#endif
+  if (_type == PCAP_CAPTURE && pcapDescriptor != NULL &&
+      pcap_stats(pcapDescriptor, &pcapStatistics) == 0) {
+    received = pcapStatistics.ps_recv;
+    dropped = pcapStatistics.ps_drop;
+    ifDropped = pcapStatistics.ps_ifdrop;
+    return true;
+  }
+  return false;
+}
+
+bool Capture::openFile() {
+  char errorBuffer[PCAP_ERRBUF_SIZE];
+  bpf_program bpfProgram;
+  pcapDescriptor = pcap_open_offline(files[file].c_str(), errorBuffer);
+  if (pcapDescriptor == NULL) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_open_offline(): ";
+    errorMessage += errorBuffer;
+    return false;
+  }
+  /* Packets from every file go through the decoder picked for the first. */
+  if (file == 0) {
+    _datalink = pcap_datalink(pcapDescriptor);
+  }
+  else if (pcap_datalink(pcapDescriptor) != _datalink) {
+    _error = true;
+    errorMessage = "Capture::initialize(): " + files[file] +
+                   ": link type differs from that of " + files[0];
+    return false;
+  }
+  if (pcap_compile(pcapDescriptor, &bpfProgram, (char*)_filter.c_str(), 1,
+                   0) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_compile(): ";
+    errorMessage += pcap_geterr(pcapDescriptor);
+    return false;
+  }
+  if (pcap_setfilter(pcapDescriptor, &bpfProgram) == -1) {
+    _error = true;
+    errorMessage = "Capture::initialize(): pcap_setfilter(): ";
+    errorMessage += pcap_geterr(pcapDescriptor);
+    pcap_freecode(&bpfProgram);
+    return false;
+  }
+  pcap_freecode(&bpfProgram);
+  return true;
+}
+
+/*
+ * Returns the next packet of a replay, moving on to the next file at the end
+ * of each one. A file that can't be read to the end leaves its error message
+ * behind, but doesn't stop the replay.
+ */
+const u_char *Capture::nextPacket(pcap_pkthdr &pcapHeader) {
+  pcap_pkthdr *_pcapHeader;
+  const u_char *packet;
+  timeval now;
+  double due, elapsed;
+  int ret;
+  while (_done == false) {
+    ret = pcap_next_ex(pcapDescriptor, &_pcapHeader, &packet);
+    if (ret == 1) {
+      pcapHeader = *_pcapHeader;
+      if (speed > 0) {
+        gettimeofday(&now, NULL);
+        if (paced == false) {
+          firstPacket = pcapHeader.ts;
+          start = now;
+          paced = true;
+        }
+        /* Sleep until the packet is due, relative to the first one. */
+        due = ((pcapHeader.ts.tv_sec - firstPacket.tv_sec) +
+               (pcapHeader.ts.tv_usec - firstPacket.tv_usec) / 1000000.0) /
+              speed;
+        elapsed = (now.tv_sec - start.tv_sec) +
+                  (now.tv_usec - start.tv_usec) / 1000000.0;
+        if (due > elapsed) {
+          usleep((useconds_t)((due - elapsed) * 1000000));
+        }
+      }
+      return packet;
+    }
+    if (ret == -1) {
+      _error = true;
+      errorMessage = "Capture::next(): pcap_next_ex(): " + files[file] + ": " +
+                     pcap_geterr(pcapDescriptor);
+    }
+    pcap_close(pcapDescriptor);
+    pcapDescriptor = NULL;
+    if (++file == files.size() || !openFile()) {
+      _done = true;
+    }
+  }
+  return NULL;
+}
+
+#ifdef __linux__
+const u_char *Capture::nextFrame(pcap_pkthdr &pcapHeader) {
+  pollfd descriptor;
+  tpacket3_hdr *_frame;
+  /*
+   * Once every frame in the block we were walking has been handed out, give
+   * the block back to the kernel and wait for the next one to be retired to
+   * us.
+   */
+  while (framesLeft == 0) {
+    if (blockHeader != NULL) {
+      releaseBlock();
+    }
+    blockHeader = (tpacket_block_desc*)(ring + block * blockSize);
+    if ((blockHeader -> hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+      descriptor.fd = ringDescriptor;
+      descriptor.events = POLLIN | POLLERR;
+      descriptor.revents = 0;
+      poll(&descriptor, 1, timeout);
+      if ((blockHeader -> hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+        blockHeader = NULL;
+        return NULL;
+      }
+    }
+    /* Don't read the block's contents before its status. */
+    __sync_synchronize();
+    framesLeft = blockHeader -> hdr.bh1.num_pkts;
+    frame = (tpacket3_hdr*)((u_char*)blockHeader +
+                            blockHeader -> hdr.bh1.offset_to_first_pkt);
+  }
+  _frame = frame;
+  frame = (tpacket3_hdr*)((u_char*)frame + frame -> tp_next_offset);
+  --framesLeft;
+  pcapHeader.ts.tv_sec = _frame -> tp_sec;
+  pcapHeader.ts.tv_usec = _frame -> tp_nsec / 1000;
+  pcapHeader.caplen = _frame -> tp_snaplen;
+  pcapHeader.len = _frame -> tp_len;
+  return (const u_char*)_frame + _frame -> tp_mac;
+}
+
+void Capture::releaseBlock() {
+  __sync_synchronize();
+  blockHeader -> hdr.bh1.block_status = TP_STATUS_KERNEL;
+  blockHeader = NULL;
+  block = (block + 1) % numBlocks;
+}
+#endif
+
+Capture::~Capture() {
+  if (pcapDescriptor != NULL) {
+    pcap_close(pcapDescriptor);
+  }
+#ifdef __linux__
+  if (ring != NULL) {
+    munmap(ring, ringSize);
+  }
+  if (ringDescriptor != -1) {
+    close(ringDescriptor);
+  }
+#endif
+}
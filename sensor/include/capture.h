@@ -0,0 +1,107 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+
+#include <pcap.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/if_packet.h>
+#endif
+
+#include <include/configuration.h>
+
+/*
+ * Capture backends. PCAP_CAPTURE reads packets one at a time with
+ * pcap_next(), which works everywhere libpcap does. RING_CAPTURE maps an
+ * AF_PACKET TPACKET_V3 ring into the sensor's address space and walks whole
+ * blocks of frames in place, which avoids a copy and a library call per
+ * packet, but is only available on Linux. OFFLINE_CAPTURE replays pcap
+ * files, either as fast as possible or paced by their timestamps.
+ */
+enum CaptureType { PCAP_CAPTURE, RING_CAPTURE, OFFLINE_CAPTURE };
+
+class Capture {
+  public:
+    Capture();
+    bool initialize(const Configuration &conf, const std::string &filter);
+    bool initialize(const std::vector <std::string> &paths,
+                    const std::string &filter, const double &speed);
+    operator bool() const;
+    const std::string &error() const;
+    const CaptureType &type() const;
+    const int &datalink() const;
+    bool fanout(const uint16_t &group);
+    const u_char *next(pcap_pkthdr &pcapHeader);
+    size_t pending() const;
+    const bool &done() const;
+    bool statistics(uint64_t &received, uint64_t &dropped,
+                    uint64_t &ifDropped);
+    ~Capture();
+  private:
+    bool _error;
+    std::string errorMessage;
+    CaptureType _type;
+    pcap_t *pcapDescriptor;
+    int _datalink;
+    bool openPcap(const Configuration &conf, const std::string &filter);
+    bool openRing(const Configuration &conf, const std::string &filter);
+    std::vector <std::string> files;
+    size_t file;
+    std::string _filter;
+    double speed;
+    bool _done;
+    bool paced;
+    timeval firstPacket;
+    timeval start;
+    bool openFile();
+    const u_char *nextPacket(pcap_pkthdr &pcapHeader);
+#ifdef __linux__
+    int ringDescriptor;
+    u_char *ring;
+    size_t ringSize;
+    size_t blockSize;
+    size_t numBlocks;
+    size_t block;
+    int timeout;
+    tpacket_block_desc *blockHeader;
+    tpacket3_hdr *frame;
+    uint32_t framesLeft;
+    /* The kernel's counts for the ring, which it resets when they are read. */
+    uint64_t ringReceived;
+    uint64_t ringDropped;
+    const u_char *nextFrame(pcap_pkthdr &pcapHeader);
+    void releaseBlock();
+#endif
+};
+
+#endif
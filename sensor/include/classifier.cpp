@@ -0,0 +1,537 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cctype>
+#include <cstdlib>
+
+#include <sys/types.h>
+
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#include "classifier.h"
+#include "linkLayer.hpp"
+
+/*
+ * Both predicates and filters are tracked with bits in 64-bit masks. A
+ * filter whose sum of products would grow past "maxTerms" terms is left to
+ * its BPF program.
+ */
+static const size_t maxPredicates = 64;
+static const size_t maxFilters = 64;
+static const size_t maxTerms = 64;
+
+#ifndef IPPROTO_SCTP
+#define IPPROTO_SCTP 132
+#endif
+
+/*
+ * Splits a filter into words, parentheses and the symbolic forms of "and",
+ * "or" and "not".
+ */
+static void tokenize(const std::string &filter,
+                     std::vector <std::string> &tokens) {
+  size_t i = 0, start;
+  while (i < filter.size()) {
+    if (isspace(filter[i])) {
+      ++i;
+    }
+    else if (filter[i] == '(' || filter[i] == ')') {
+      tokens.push_back(std::string(1, filter[i]));
+      ++i;
+    }
+    else if (filter[i] == '!') {
+      tokens.push_back("not");
+      ++i;
+    }
+    else if (filter.compare(i, 2, "&&") == 0) {
+      tokens.push_back("and");
+      i += 2;
+    }
+    else if (filter.compare(i, 2, "||") == 0) {
+      tokens.push_back("or");
+      i += 2;
+    }
+    else {
+      start = i;
+      while (i < filter.size() && !isspace(filter[i]) && filter[i] != '(' &&
+             filter[i] != ')' && filter[i] != '!' && filter[i] != '&' &&
+             filter[i] != '|') {
+        ++i;
+      }
+      /* A lone '&' or '|' is not something we understand. */
+      if (i == start) {
+        tokens.push_back(std::string(1, filter[i]));
+        ++i;
+      }
+      else {
+        tokens.push_back(filter.substr(start, i - start));
+      }
+    }
+  }
+}
+
+bool Classifier::Predicate::operator==(const Predicate &predicate) const {
+  return (type == predicate.type && protocol == predicate.protocol &&
+          port == predicate.port);
+}
+
+/*
+ * Appends a term to a sum, skipping contradictions and duplicates. Returns
+ * false if the sum would have too many terms.
+ */
+bool Classifier::append(Sum &sum, const Term &term) {
+  if ((term.set & term.clear) != 0) {
+    return true;
+  }
+  for (size_t i = 0; i < sum.size(); ++i) {
+    if (sum[i].set == term.set && sum[i].clear == term.clear) {
+      return true;
+    }
+  }
+  if (sum.size() == maxTerms) {
+    return false;
+  }
+  sum.push_back(term);
+  return true;
+}
+
+bool Classifier::disjunction(const Sum &left, const Sum &right, Sum &sum) {
+  sum = left;
+  for (size_t i = 0; i < right.size(); ++i) {
+    if (!append(sum, right[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Classifier::conjunction(const Sum &left, const Sum &right, Sum &sum) {
+  Term term;
+  sum.clear();
+  for (size_t i = 0; i < left.size(); ++i) {
+    for (size_t j = 0; j < right.size(); ++j) {
+      term.set = left[i].set | right[j].set;
+      term.clear = left[i].clear | right[j].clear;
+      if (!append(sum, term)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+ * The complement of a sum is the product, over all of its terms, of the sums
+ * of each term's negated predicates.
+ */
+bool Classifier::negation(const Sum &sum, Sum &_negation) {
+  Sum negatedTerm, product;
+  Term term;
+  term.set = 0;
+  term.clear = 0;
+  _negation.assign(1, term);
+  for (size_t i = 0; i < sum.size(); ++i) {
+    negatedTerm.clear();
+    for (size_t bit = 0; bit < maxPredicates; ++bit) {
+      term.set = sum[i].clear & ((uint64_t)1 << bit);
+      term.clear = sum[i].set & ((uint64_t)1 << bit);
+      if (term.set != 0 || term.clear != 0) {
+        negatedTerm.push_back(term);
+      }
+    }
+    if (!conjunction(_negation, negatedTerm, product)) {
+      return false;
+    }
+    _negation.swap(product);
+  }
+  return true;
+}
+
+/*
+ * Rewrites a filter as a sum of products over "_predicates", adding any
+ * predicates it needs. Returns false if the filter uses anything that the
+ * classifier doesn't understand.
+ */
+bool Classifier::parse(const std::string &filter,
+                       std::vector <Predicate> &_predicates, Sum &sum) const {
+  std::vector <std::string> tokens;
+  size_t token = 0;
+  Term term;
+  tokenize(filter, tokens);
+  /* An empty filter matches everything. */
+  if (tokens.size() == 0) {
+    term.set = 0;
+    term.clear = 0;
+    sum.assign(1, term);
+    return true;
+  }
+  if (!expression(tokens, token, _predicates, sum)) {
+    return false;
+  }
+  return (token == tokens.size());
+}
+
+/*
+ * As in pcap-filter(7), "and" and "or" have the same precedence and
+ * associate to the left.
+ */
+bool Classifier::expression(const std::vector <std::string> &tokens,
+                            size_t &token,
+                            std::vector <Predicate> &_predicates,
+                            Sum &sum) const {
+  Sum right, result;
+  std::string _operator;
+  if (!term(tokens, token, _predicates, sum)) {
+    return false;
+  }
+  while (token < tokens.size() &&
+         (tokens[token] == "and" || tokens[token] == "or")) {
+    _operator = tokens[token++];
+    if (!term(tokens, token, _predicates, right)) {
+      return false;
+    }
+    if (_operator == "and") {
+      if (!conjunction(sum, right, result)) {
+        return false;
+      }
+    }
+    else {
+      if (!disjunction(sum, right, result)) {
+        return false;
+      }
+    }
+    sum.swap(result);
+  }
+  return true;
+}
+
+bool Classifier::term(const std::vector <std::string> &tokens, size_t &token,
+                      std::vector <Predicate> &_predicates, Sum &sum) const {
+  Sum operand;
+  if (token == tokens.size()) {
+    return false;
+  }
+  if (tokens[token] == "not") {
+    ++token;
+    if (!term(tokens, token, _predicates, operand)) {
+      return false;
+    }
+    return negation(operand, sum);
+  }
+  if (tokens[token] == "(") {
+    ++token;
+    if (!expression(tokens, token, _predicates, sum)) {
+      return false;
+    }
+    if (token == tokens.size() || tokens[token] != ")") {
+      return false;
+    }
+    ++token;
+    return true;
+  }
+  return primitive(tokens, token, _predicates, sum);
+}
+
+bool Classifier::primitive(const std::vector <std::string> &tokens,
+                           size_t &token,
+                           std::vector <Predicate> &_predicates,
+                           Sum &sum) const {
+  Predicate predicate;
+  Term term;
+  char *end;
+  unsigned long port;
+  size_t index;
+  predicate.protocol = 0;
+  predicate.port = 0;
+  if (tokens[token] == "ip") {
+    predicate.type = IPV4;
+    ++token;
+  }
+  else if (tokens[token] == "ip6") {
+    predicate.type = IPV6;
+    ++token;
+  }
+  else if (tokens[token] == "icmp") {
+    predicate.type = PROTOCOL;
+    predicate.protocol = IPPROTO_ICMP;
+    ++token;
+  }
+  else if ((tokens[token] == "tcp" || tokens[token] == "udp") &&
+           (token + 1 == tokens.size() ||
+            (tokens[token + 1] != "src" && tokens[token + 1] != "dst" &&
+             tokens[token + 1] != "port"))) {
+    predicate.type = PROTOCOL;
+    predicate.protocol = (tokens[token] == "tcp") ? IPPROTO_TCP : IPPROTO_UDP;
+    ++token;
+  }
+  /* "[tcp|udp] [src|dst] port <number>" */
+  else {
+    if (tokens[token] == "tcp" || tokens[token] == "udp") {
+      predicate.protocol = (tokens[token] == "tcp") ? IPPROTO_TCP
+                                                    : IPPROTO_UDP;
+      ++token;
+    }
+    predicate.type = PORT;
+    if (token < tokens.size() && tokens[token] == "src") {
+      predicate.type = SOURCE_PORT;
+      ++token;
+    }
+    else if (token < tokens.size() && tokens[token] == "dst") {
+      predicate.type = DESTINATION_PORT;
+      ++token;
+    }
+    if (token == tokens.size() || tokens[token] != "port") {
+      return false;
+    }
+    ++token;
+    if (token == tokens.size() || !isdigit(tokens[token][0])) {
+      return false;
+    }
+    port = strtoul(tokens[token].c_str(), &end, 10);
+    if (*end != '\0' || port > 65535) {
+      return false;
+    }
+    predicate.port = port;
+    ++token;
+  }
+  /*
+   * Anything other than a connective after a primitive, like "ip host" or
+   * "port 80 or 443", is left to pcap.
+   */
+  if (token < tokens.size() && tokens[token] != "and" &&
+      tokens[token] != "or" && tokens[token] != ")") {
+    return false;
+  }
+  for (index = 0; index < _predicates.size(); ++index) {
+    if (_predicates[index] == predicate) {
+      break;
+    }
+  }
+  if (index == _predicates.size()) {
+    if (index == maxPredicates) {
+      return false;
+    }
+    _predicates.push_back(predicate);
+  }
+  term.set = (uint64_t)1 << index;
+  term.clear = 0;
+  sum.assign(1, term);
+  return true;
+}
+
+/*
+ * Decodes the fields that the predicates look at, the same way the BPF code
+ * generated by pcap_compile() does, and sets a bit in "matches" for each
+ * predicate that holds. Returns false if the packet is too short to decode,
+ * since a BPF program rejects a packet outright when a load falls off its
+ * end, regardless of the expression being evaluated.
+ */
+template <int linkType>
+bool Classifier::evaluate(const pcap_pkthdr &pcapHeader,
+                          const u_char *pcapPacket, uint64_t &matches) const {
+  const size_t link = LinkLayer <linkType>::headerLength;
+  const u_char *ipHeader = pcapPacket + link;
+  const u_char *transportHeader = NULL;
+  uint16_t etherType;
+  uint8_t protocol = 0, fragmentProtocol = 0;
+  uint16_t sourcePort = 0, destinationPort = 0;
+  bool ipv4 = false, ipv6 = false, ports = false, match = false;
+  if (pcapHeader.caplen <= link) {
+    return false;
+  }
+  etherType = LinkLayer <linkType>::etherType(pcapPacket);
+  if (etherType == ETHERTYPE_IP) {
+    ipv4 = true;
+    if (pcapHeader.caplen < link + 10) {
+      return false;
+    }
+    protocol = ipHeader[9];
+    /*
+     * Ports are only looked for in TCP, UDP and SCTP packets that are not
+     * non-initial fragments.
+     */
+    if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP ||
+         protocol == IPPROTO_SCTP) &&
+        (((ipHeader[6] << 8) | ipHeader[7]) & 0x1fff) == 0) {
+      transportHeader = ipHeader + ((ipHeader[0] & 0x0f) << 2);
+      if (pcapHeader.caplen < (size_t)(transportHeader - pcapPacket) + 4) {
+        return false;
+      }
+      ports = true;
+    }
+  }
+  else if (etherType == ETHERTYPE_IPV6) {
+    ipv6 = true;
+    if (pcapHeader.caplen < link + 7) {
+      return false;
+    }
+    protocol = ipHeader[6];
+    /* A fragment header directly after the IPv6 header is looked through. */
+    if (protocol == IPPROTO_FRAGMENT) {
+      if (pcapHeader.caplen < link + 41) {
+        return false;
+      }
+      fragmentProtocol = ipHeader[40];
+    }
+    else if (protocol == IPPROTO_TCP || protocol == IPPROTO_UDP ||
+             protocol == IPPROTO_SCTP) {
+      transportHeader = ipHeader + 40;
+      if (pcapHeader.caplen < link + 44) {
+        return false;
+      }
+      ports = true;
+    }
+  }
+  if (ports == true) {
+    sourcePort = (transportHeader[0] << 8) | transportHeader[1];
+    destinationPort = (transportHeader[2] << 8) | transportHeader[3];
+  }
+  matches = 0;
+  for (size_t i = 0; i < predicates.size(); ++i) {
+    switch (predicates[i].type) {
+      case IPV4:
+        match = ipv4;
+        break;
+      case IPV6:
+        match = ipv6;
+        break;
+      case PROTOCOL:
+        /* "icmp" means ICMP over IPv4 only. */
+        match = ((ipv4 == true && protocol == predicates[i].protocol) ||
+                 (ipv6 == true && predicates[i].protocol != IPPROTO_ICMP &&
+                  (protocol == predicates[i].protocol ||
+                   (protocol == IPPROTO_FRAGMENT &&
+                    fragmentProtocol == predicates[i].protocol))));
+        break;
+      case SOURCE_PORT:
+      case DESTINATION_PORT:
+      case PORT:
+        match = (ports == true &&
+                 (predicates[i].protocol == 0 ||
+                  predicates[i].protocol == protocol) &&
+                 ((predicates[i].type != DESTINATION_PORT &&
+                   sourcePort == predicates[i].port) ||
+                  (predicates[i].type != SOURCE_PORT &&
+                   destinationPort == predicates[i].port)));
+        break;
+    }
+    matches |= (uint64_t)match << i;
+  }
+  return true;
+}
+
+Classifier::Classifier() {
+  _error = false;
+}
+
+/*
+ * Adds a filter, given both as the string it was compiled from and as its
+ * compiled BPF program. Filters are numbered in the order they are added,
+ * and classify() returns a mask with a bit set for each matching filter.
+ */
+bool Classifier::add(const std::string &filter,
+                     const bpf_program &bpfProgram) {
+  std::vector <Predicate> _predicates = predicates;
+  Filter _filter;
+  if (filters.size() == maxFilters) {
+    _error = true;
+    errorMessage = "Classifier::add(): too many filters";
+    return false;
+  }
+  _filter.bpfInstructions = bpfProgram.bf_insns;
+  _filter.compiled = parse(filter, _predicates, _filter.sum);
+  if (_filter.compiled == true) {
+    predicates = _predicates;
+  }
+  else {
+    _filter.sum.clear();
+    fallbacks.push_back(filters.size());
+  }
+  filters.push_back(_filter);
+  return true;
+}
+
+Classifier::operator bool() const {
+  return !_error;
+}
+
+const std::string &Classifier::error() const {
+  return errorMessage;
+}
+
+size_t Classifier::size() const {
+  return filters.size();
+}
+
+/*
+ * Returns whether a filter is evaluated by the classifier itself, rather
+ * than by its BPF program.
+ */
+bool Classifier::compiled(const size_t &filter) const {
+  return filters[filter].compiled;
+}
+
+/*
+ * Returns a mask with a bit set for each filter that matches a packet from a
+ * capture of datalink type "linkType".
+ */
+template <int linkType>
+uint64_t Classifier::classify(const pcap_pkthdr &pcapHeader,
+                              const u_char *pcapPacket) const {
+  uint64_t matches, result = 0;
+  if (evaluate <linkType>(pcapHeader, pcapPacket, matches) == false) {
+    for (size_t i = 0; i < filters.size(); ++i) {
+      if (bpf_filter(filters[i].bpfInstructions, (u_char*)pcapPacket,
+                     pcapHeader.len, pcapHeader.caplen) != 0) {
+        result |= (uint64_t)1 << i;
+      }
+    }
+    return result;
+  }
+  for (size_t i = 0; i < filters.size(); ++i) {
+    for (size_t j = 0; j < filters[i].sum.size(); ++j) {
+      if ((matches & filters[i].sum[j].set) == filters[i].sum[j].set &&
+          (matches & filters[i].sum[j].clear) == 0) {
+        result |= (uint64_t)1 << i;
+        break;
+      }
+    }
+  }
+  for (size_t i = 0; i < fallbacks.size(); ++i) {
+    if (bpf_filter(filters[fallbacks[i]].bpfInstructions, (u_char*)pcapPacket,
+                   pcapHeader.len, pcapHeader.caplen) != 0) {
+      result |= (uint64_t)1 << fallbacks[i];
+    }
+  }
+  return result;
+}
+
+template uint64_t Classifier::classify <DLT_EN10MB>(const pcap_pkthdr &pcapHeader,
+                                                    const u_char *pcapPacket) const;
+template uint64_t Classifier::classify <DLT_LINUX_SLL>(const pcap_pkthdr &pcapHeader,
+                                                       const u_char *pcapPacket) const;
+template uint64_t Classifier::classify <DLT_RAW>(const pcap_pkthdr &pcapHeader,
+                                                 const u_char *pcapPacket) const;
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <string>
+#include <vector>
+
+#include <pcap.h>
+#include <stdint.h>
+
+/*
+ * Decides which of a set of pcap filters match a packet in one pass over the
+ * packet, instead of running each filter's BPF program in turn.
+ *
+ * Filters built from the primitives "ip", "ip6", "icmp", "tcp", "udp" and
+ * "[tcp|udp] [src|dst] port <number>", combined with "and", "or", "not" and
+ * parentheses, are rewritten as sums of products over a table of predicates
+ * shared by all filters. Each packet is decoded once, every distinct
+ * predicate is evaluated once, and each filter becomes a few mask tests.
+ * Filters using anything else fall back to their BPF programs, as do
+ * packets too short to decode, so the result always matches bpf_filter().
+ * classify() is instantiated for each datalink type in linkLayer.hpp, and
+ * must be used with the one the BPF programs were compiled for.
+ */
+class Classifier {
+  public:
+    Classifier();
+    bool add(const std::string &filter, const bpf_program &bpfProgram);
+    operator bool() const;
+    const std::string &error() const;
+    size_t size() const;
+    bool compiled(const size_t &filter) const;
+    template <int linkType>
+    uint64_t classify(const pcap_pkthdr &pcapHeader,
+                      const u_char *pcapPacket) const;
+  private:
+    enum PredicateType { IPV4, IPV6, PROTOCOL, SOURCE_PORT, DESTINATION_PORT,
+                         PORT };
+    struct Predicate {
+      PredicateType type;
+      /* IP protocol, or 0 for any protocol that has ports. */
+      uint8_t protocol;
+      uint16_t port;
+      bool operator==(const Predicate &predicate) const;
+    };
+    /*
+     * A conjunction of predicates: all predicates in "set" must hold, and
+     * none of those in "clear" may.
+     */
+    struct Term {
+      uint64_t set;
+      uint64_t clear;
+    };
+    typedef std::vector <Term> Sum;
+    struct Filter {
+      bool compiled;
+      Sum sum;
+      bpf_insn *bpfInstructions;
+    };
+    bool _error;
+    std::string errorMessage;
+    std::vector <Predicate> predicates;
+    std::vector <Filter> filters;
+    std::vector <size_t> fallbacks;
+    static bool append(Sum &sum, const Term &term);
+    static bool disjunction(const Sum &left, const Sum &right, Sum &sum);
+    static bool conjunction(const Sum &left, const Sum &right, Sum &sum);
+    static bool negation(const Sum &sum, Sum &_negation);
+    bool parse(const std::string &filter, std::vector <Predicate> &_predicates,
+               Sum &sum) const;
+    bool expression(const std::vector <std::string> &tokens, size_t &token,
+                    std::vector <Predicate> &_predicates, Sum &sum) const;
+    bool term(const std::vector <std::string> &tokens, size_t &token,
+              std::vector <Predicate> &_predicates, Sum &sum) const;
+    bool primitive(const std::vector <std::string> &tokens, size_t &token,
+                   std::vector <Predicate> &_predicates, Sum &sum) const;
+    template <int linkType>
+    bool evaluate(const pcap_pkthdr &pcapHeader, const u_char *pcapPacket,
+                  uint64_t &matches) const;
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <ctime>
+
+#include "clock.h"
+
+Clock::Clock() {
+  _now = 0;
+  _start = 0;
+  lastTick = 0;
+  lastWall = 0;
+}
+
+/*
+ * Called by every capture thread for every packet, so this avoids locking.
+ * Threads may see packets slightly out of order with respect to one another;
+ * only a later time than the current one moves the clock.
+ */
+void Clock::advance(const uint32_t &time) {
+  uint32_t now = _now;
+  while (time > now) {
+    if (__sync_bool_compare_and_swap(&_now, now, time)) {
+      if (now == 0) {
+        __sync_bool_compare_and_swap(&_start, 0, time);
+      }
+      return;
+    }
+    now = _now;
+  }
+}
+
+/*
+ * Called periodically by a single thread. If no packet has moved the clock
+ * since the previous call, it is moved forward by the wall-clock time that has
+ * elapsed in between.
+ */
+void Clock::tick() {
+  uint32_t wall = time(NULL);
+  uint32_t now = _now;
+  if (lastWall != 0 && now == lastTick && wall > lastWall) {
+    advance(now + (wall - lastWall));
+  }
+  lastTick = _now;
+  lastWall = wall;
+}
+
+uint32_t Clock::now() const {
+  return _now;
+}
+
+/* The first time the clock was advanced to, or 0 if it has not been. */
+uint32_t Clock::start() const {
+  return _start;
+}
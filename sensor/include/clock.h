@@ -0,0 +1,71 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * The sensor's notion of the current time, in seconds since the epoch. It is
+ * advanced by the timestamps of captured packets, so that timeouts and rates
+ * computed by modules follow the traffic rather than the wall clock, which
+ * matters most when replaying saved captures faster or slower than they were
+ * recorded. When no packets arrive, tick() lets the clock keep moving at the
+ * pace of the wall clock. The clock never goes backwards.
+ */
+class Clock {
+  public:
+    Clock();
+    void advance(const uint32_t &time);
+    void tick();
+    uint32_t now() const;
+    uint32_t start() const;
+  private:
+    volatile uint32_t _now;
+    volatile uint32_t _start;
+    uint32_t lastTick;
+    uint32_t lastWall;
+};
+
+/*
+ * A count of CPU cycles, or of nanoseconds where there is no cycle counter to
+ * read, for timing short stretches of code. Only differences between counts
+ * taken on the same CPU mean anything.
+ */
+inline uint64_t cycles() {
+#if defined(__i386__) || defined(__x86_64__)
+  uint32_t low, high;
+  __asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high));
+  return (uint64_t)high << 32 | low;
+#else
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+#endif
@@ -26,16 +26,17 @@
 #define CONSUMERS_HPP
 
 #include <vector>
-#include <tr1/memory>
+
+#include <include/memory.hpp>
 
 template <class T>
 class Consumers {
   public:
-    typedef int (*callback)(const std::tr1::shared_ptr <T> record);
+    typedef int (*callback)(const typename Memory <T>::Pointer record);
     Consumers();
     Consumers(std::vector <void*> _callbacks);
     void initialize(std::vector <void*> _callbacks);
-    int consume(const std::tr1::shared_ptr <T> record) const;
+    int consume(const typename Memory <T>::Pointer record) const;
   private:
     std::vector <callback> callbacks;
 };
@@ -56,7 +57,7 @@ void Consumers <T>::initialize(std::vector <void*> _callbacks) {
 }
 
 template <class T>
-int Consumers <T>::consume(const std::tr1::shared_ptr <T> record) const {
+int Consumers <T>::consume(const typename Memory <T>::Pointer record) const {
   for (size_t i = 0; i < callbacks.size(); ++i) {
     if (callbacks[i](record) != 0) {
       return 1;
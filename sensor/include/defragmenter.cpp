@@ -0,0 +1,495 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <new>
+
+#include <sys/socket.h>
+
+#define __FAVOR_BSD
+
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+
+#include "defragmenter.h"
+#include "hash.hpp"
+#include "linkLayer.hpp"
+
+/* Standard Internet checksum of an IP header. */
+static uint16_t checksum(const u_char *header, const size_t &length) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    sum += (header[i] << 8) | header[i + 1];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return htons(~sum & 0xffff);
+}
+
+Defragmenter::Defragmenter() {
+  _error = true;
+  errorMessage = "Defragmenter::Defragmenter(): class not initialized";
+  datagrams = NULL;
+  buckets = NULL;
+  freeDatagrams = NULL;
+  oldest = NULL;
+  newest = NULL;
+  _size = 0;
+  _reassembled = 0;
+  _timeouts = 0;
+  _evictions = 0;
+  _drops = 0;
+}
+
+bool Defragmenter::initialize(const size_t &maxDatagrams,
+                              const uint32_t &timeout, const Policy &policy) {
+  size_t numBuckets = 1;
+  if (maxDatagrams == 0) {
+    _error = true;
+    errorMessage = "Defragmenter::initialize(): table is too small";
+    return false;
+  }
+  this -> timeout = timeout;
+  _policy = policy;
+  datagrams = new(std::nothrow) Datagram[maxDatagrams];
+  if (datagrams == NULL) {
+    _error = true;
+    errorMessage = "Defragmenter::initialize(): malloc(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  while (numBuckets < maxDatagrams) {
+    numBuckets <<= 1;
+  }
+  buckets = (Datagram**)calloc(numBuckets, sizeof(Datagram*));
+  if (buckets == NULL) {
+    _error = true;
+    errorMessage = "Defragmenter::initialize(): calloc(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  mask = numBuckets - 1;
+  /* Buffers are only paged in as they are used. */
+  if (!buffers.initialize(maxDatagrams)) {
+    _error = true;
+    errorMessage = "Defragmenter::initialize(): " + buffers.error();
+    return false;
+  }
+  for (size_t i = 0; i < maxDatagrams; ++i) {
+    datagrams[i].next = freeDatagrams;
+    freeDatagrams = &(datagrams[i]);
+  }
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+/* Parses the name of an overlap policy, as given in the configuration. */
+bool Defragmenter::policy(const std::string &name, Policy &policy) {
+  if (name == "first") {
+    policy = FIRST;
+  }
+  else if (name == "last") {
+    policy = LAST;
+  }
+  else if (name == "bsd") {
+    policy = BSD;
+  }
+  else if (name == "discard") {
+    policy = DISCARD;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+Defragmenter::operator bool() const {
+  return !_error;
+}
+
+const std::string &Defragmenter::error() const {
+  return errorMessage;
+}
+
+/*
+ * Returns the packet itself if it is not an IPv4 fragment, or is one that
+ * can't be reassembled because it was truncated or is malformed. Otherwise,
+ * returns NULL while its datagram is incomplete, or the reassembled datagram,
+ * with "pcapHeader" updated to match, once it is complete. A reassembled
+ * datagram is valid until the next call.
+ */
+template <int linkType>
+const u_char *Defragmenter::defragment(pcap_pkthdr &pcapHeader,
+                                       const u_char *pcapPacket) {
+  const ip *header;
+  ip *_header;
+  size_t link = LinkLayer <linkType>::headerLength, headerLength, length, end;
+  uint16_t etherType, offset, start;
+  uint32_t hash, time = pcapHeader.ts.tv_sec;
+  Datagram *datagram;
+  u_char *frame;
+  completed = Memory <Buffer>::Pointer();
+  if (pcapHeader.caplen <= link) {
+    return pcapPacket;
+  }
+  etherType = LinkLayer <linkType>::etherType(pcapPacket);
+  for (size_t i = 0; LinkLayer <linkType>::tagged == true &&
+                     (etherType == ETHERTYPE_VLAN ||
+                      etherType == ETHERTYPE_QINQ ||
+                      etherType == ETHERTYPE_QINQ_OLD); ++i) {
+    if (i == maxVLANTags || pcapHeader.caplen < link + 4) {
+      return pcapPacket;
+    }
+    etherType = (pcapPacket[link + 2] << 8) | pcapPacket[link + 3];
+    link += 4;
+  }
+  if (etherType != ETHERTYPE_IP || pcapHeader.caplen < link + sizeof(ip)) {
+    return pcapPacket;
+  }
+  header = (const ip*)(pcapPacket + link);
+  offset = ntohs(header -> ip_off);
+  if ((offset & (IP_MF | IP_OFFMASK)) == 0) {
+    return pcapPacket;
+  }
+  headerLength = header -> ip_hl << 2;
+  length = ntohs(header -> ip_len);
+  if (header -> ip_v != 4 || headerLength < sizeof(ip) ||
+      length <= headerLength ||
+      link + length > pcapHeader.caplen) {
+    return pcapPacket;
+  }
+  /* Forget datagrams whose time is up before looking for this one's. */
+  while (oldest != NULL && oldest -> created + timeout <= time) {
+    remove(oldest);
+    ++_timeouts;
+  }
+  start = (offset & IP_OFFMASK) << 3;
+  end = start + (length - headerLength);
+  /*
+   * Every fragment but the last carries a multiple of 8 bytes, and the
+   * datagram must fit in a frame of at most 65535 bytes.
+   */
+  if (((offset & IP_MF) != 0 && (length - headerLength) % 8 != 0) ||
+      link + sizeof(ip) + end > 65535) {
+    ++_drops;
+    return NULL;
+  }
+  hash = mix(header -> ip_src.s_addr ^
+             mix(header -> ip_dst.s_addr ^
+                 mix(((uint32_t)header -> ip_id << 8) | header -> ip_p)));
+  datagram = find(header -> ip_src.s_addr, header -> ip_dst.s_addr,
+                  header -> ip_id, header -> ip_p, hash);
+  if (datagram == NULL) {
+    datagram = create(header -> ip_src.s_addr, header -> ip_dst.s_addr,
+                      header -> ip_id, header -> ip_p, hash, time);
+    if (datagram == NULL) {
+      ++_drops;
+      return NULL;
+    }
+  }
+  /*
+   * The last fragment fixes the size of the datagram, which no fragment may
+   * then go past.
+   */
+  if ((offset & IP_MF) == 0) {
+    if ((datagram -> last == true && datagram -> size != end) ||
+        (datagram -> numRanges > 0 &&
+         datagram -> ranges[datagram -> numRanges - 1].end > end)) {
+      remove(datagram);
+      ++_drops;
+      return NULL;
+    }
+    datagram -> last = true;
+    datagram -> size = end;
+  }
+  else if (datagram -> last == true && end > datagram -> size) {
+    remove(datagram);
+    ++_drops;
+    return NULL;
+  }
+  if (start == 0 && datagram -> headerLength == 0) {
+    datagram -> linkLength = link;
+    datagram -> headerLength = headerLength;
+    memcpy(datagram -> header, pcapPacket, link + headerLength);
+  }
+  if (!insert(*datagram, start, end,
+              pcapPacket + link + headerLength)) {
+    remove(datagram);
+    ++_drops;
+    return NULL;
+  }
+  if (!complete(*datagram)) {
+    return NULL;
+  }
+  length = datagram -> linkLength + datagram -> headerLength +
+           datagram -> size;
+  if (length > 65535) {
+    remove(datagram);
+    ++_drops;
+    return NULL;
+  }
+  /* Put the first fragment's headers in front of the reassembled payload. */
+  frame = datagram -> buffer -> data + headerRoom - datagram -> headerLength -
+          datagram -> linkLength;
+  memcpy(frame, datagram -> header,
+         datagram -> linkLength + datagram -> headerLength);
+  _header = (ip*)(frame + datagram -> linkLength);
+  _header -> ip_len = htons(datagram -> headerLength + datagram -> size);
+  _header -> ip_off = 0;
+  _header -> ip_sum = 0;
+  _header -> ip_sum = checksum((const u_char*)_header,
+                               datagram -> headerLength);
+  pcapHeader.caplen = length;
+  pcapHeader.len = length;
+  completed = datagram -> buffer;
+  remove(datagram);
+  ++_reassembled;
+  return frame;
+}
+
+template const u_char *Defragmenter::defragment <DLT_EN10MB>(pcap_pkthdr &pcapHeader,
+                                                             const u_char *pcapPacket);
+template const u_char *Defragmenter::defragment <DLT_LINUX_SLL>(pcap_pkthdr &pcapHeader,
+                                                                const u_char *pcapPacket);
+template const u_char *Defragmenter::defragment <DLT_RAW>(pcap_pkthdr &pcapHeader,
+                                                          const u_char *pcapPacket);
+
+const size_t &Defragmenter::size() const {
+  return _size;
+}
+
+const uint64_t &Defragmenter::reassembled() const {
+  return _reassembled;
+}
+
+const uint64_t &Defragmenter::timeouts() const {
+  return _timeouts;
+}
+
+const uint64_t &Defragmenter::evictions() const {
+  return _evictions;
+}
+
+/*
+ * Fragments thrown away because they were malformed, overlapped under the
+ * DISCARD policy or belonged to datagrams that did.
+ */
+const uint64_t &Defragmenter::drops() const {
+  return _drops;
+}
+
+Defragmenter::Datagram *Defragmenter::find(const uint32_t &source,
+                                           const uint32_t &destination,
+                                           const uint16_t &id,
+                                           const uint8_t &protocol,
+                                           const uint32_t &hash) const {
+  Datagram *datagram = buckets[hash & mask];
+  while (datagram != NULL) {
+    if (datagram -> hash == hash && datagram -> source == source &&
+        datagram -> destination == destination && datagram -> id == id &&
+        datagram -> protocol == protocol) {
+      return datagram;
+    }
+    datagram = datagram -> next;
+  }
+  return NULL;
+}
+
+/* Starts a datagram, evicting the oldest one if there is no room for it. */
+Defragmenter::Datagram *Defragmenter::create(const uint32_t &source,
+                                             const uint32_t &destination,
+                                             const uint16_t &id,
+                                             const uint8_t &protocol,
+                                             const uint32_t &hash,
+                                             const uint32_t &time) {
+  Datagram *datagram;
+  if (freeDatagrams == NULL) {
+    remove(oldest);
+    ++_evictions;
+  }
+  datagram = freeDatagrams;
+  datagram -> buffer = buffers.allocate();
+  if (datagram -> buffer == Memory <Buffer>::Pointer()) {
+    return NULL;
+  }
+  freeDatagrams = datagram -> next;
+  datagram -> source = source;
+  datagram -> destination = destination;
+  datagram -> id = id;
+  datagram -> protocol = protocol;
+  datagram -> hash = hash;
+  datagram -> created = time;
+  datagram -> last = false;
+  datagram -> size = 0;
+  datagram -> linkLength = 0;
+  datagram -> headerLength = 0;
+  datagram -> numRanges = 0;
+  datagram -> next = buckets[hash & mask];
+  buckets[hash & mask] = datagram;
+  datagram -> older = newest;
+  datagram -> newer = NULL;
+  if (newest != NULL) {
+    newest -> newer = datagram;
+  }
+  else {
+    oldest = datagram;
+  }
+  newest = datagram;
+  ++_size;
+  return datagram;
+}
+
+bool Defragmenter::before(const Range &left, const Range &right) {
+  return (left.start < right.start);
+}
+
+/*
+ * Copies a fragment's payload into its datagram, applying the overlap policy
+ * wherever it covers bytes that are already there, and updates the record of
+ * which fragment each byte came from. Returns false if the datagram should be
+ * discarded.
+ */
+bool Defragmenter::insert(Datagram &datagram, const uint16_t &start,
+                          const uint16_t &end, const u_char *data) {
+  u_char *payload = datagram.buffer -> data + headerRoom;
+  size_t count = 0;
+  uint16_t position = start, overlapStart, overlapEnd;
+  for (size_t i = 0; i < datagram.numRanges; ++i) {
+    const Range &range = datagram.ranges[i];
+    if (range.end <= start || range.start >= end) {
+      scratch[count++] = range;
+      continue;
+    }
+    if (_policy == DISCARD) {
+      return false;
+    }
+    if (range.start < start) {
+      scratch[count].start = range.start;
+      scratch[count].end = start;
+      scratch[count++].owner = range.owner;
+    }
+    overlapStart = std::max(range.start, start);
+    overlapEnd = std::min(range.end, end);
+    /* Fill in any hole before the overlap. */
+    if (position < overlapStart) {
+      memcpy(payload + position, data + (position - start),
+             overlapStart - position);
+      scratch[count].start = position;
+      scratch[count].end = overlapStart;
+      scratch[count++].owner = start;
+    }
+    scratch[count].start = overlapStart;
+    scratch[count].end = overlapEnd;
+    if (_policy == LAST || (_policy == BSD && start < range.owner)) {
+      memcpy(payload + overlapStart, data + (overlapStart - start),
+             overlapEnd - overlapStart);
+      scratch[count++].owner = start;
+    }
+    else {
+      scratch[count++].owner = range.owner;
+    }
+    position = overlapEnd;
+    if (range.end > end) {
+      scratch[count].start = end;
+      scratch[count].end = range.end;
+      scratch[count++].owner = range.owner;
+    }
+  }
+  if (position < end) {
+    memcpy(payload + position, data + (position - start), end - position);
+    scratch[count].start = position;
+    scratch[count].end = end;
+    scratch[count++].owner = start;
+  }
+  std::sort(scratch, scratch + count, before);
+  /* Merge runs from the same fragment that have come together again. */
+  datagram.numRanges = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (datagram.numRanges > 0 &&
+        datagram.ranges[datagram.numRanges - 1].end == scratch[i].start &&
+        datagram.ranges[datagram.numRanges - 1].owner == scratch[i].owner) {
+      datagram.ranges[datagram.numRanges - 1].end = scratch[i].end;
+      continue;
+    }
+    if (datagram.numRanges == maxFragments) {
+      return false;
+    }
+    datagram.ranges[datagram.numRanges++] = scratch[i];
+  }
+  return true;
+}
+
+/* Whether a datagram's fragments are all in, with no holes between them. */
+bool Defragmenter::complete(const Datagram &datagram) const {
+  if (datagram.last == false || datagram.headerLength == 0 ||
+      datagram.numRanges == 0 || datagram.ranges[0].start != 0 ||
+      datagram.ranges[datagram.numRanges - 1].end != datagram.size) {
+    return false;
+  }
+  for (size_t i = 1; i < datagram.numRanges; ++i) {
+    if (datagram.ranges[i].start != datagram.ranges[i - 1].end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Defragmenter::remove(Datagram *datagram) {
+  Datagram **link = &(buckets[datagram -> hash & mask]);
+  while (*link != datagram) {
+    link = &((*link) -> next);
+  }
+  *link = datagram -> next;
+  if (datagram -> older != NULL) {
+    datagram -> older -> newer = datagram -> newer;
+  }
+  else {
+    oldest = datagram -> newer;
+  }
+  if (datagram -> newer != NULL) {
+    datagram -> newer -> older = datagram -> older;
+  }
+  else {
+    newest = datagram -> older;
+  }
+  datagram -> buffer = Memory <Buffer>::Pointer();
+  datagram -> next = freeDatagrams;
+  freeDatagrams = datagram;
+  --_size;
+}
+
+Defragmenter::~Defragmenter() {
+  completed = Memory <Buffer>::Pointer();
+  delete[] datagrams;
+  free(buckets);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DEFRAGMENTER_H
+#define DEFRAGMENTER_H
+
+#include <string>
+
+#include <pcap.h>
+#include <stdint.h>
+
+#include <include/linkLayer.hpp>
+#include <include/memory.hpp>
+
+/*
+ * Reassembles fragmented IPv4 datagrams. Fragments carry no ports, so a
+ * datagram has to be reassembled before it is handed to the worker that
+ * handles its flow. The main thread has a Defragmenter of its own when it
+ * hands packets out to the workers; otherwise each worker has one, since it
+ * is either the only worker or one of a fanout group, which has the kernel
+ * reassemble fragments before hashing them. Fragments are copied into a
+ * per-datagram buffer from a fixed-size pool as they arrive, and once a
+ * datagram is complete, defragment() returns it as a single frame, with the
+ * link-layer and IP headers of its first fragment.
+ *
+ * At most a fixed number of datagrams are held at once; when a fragment of a
+ * new datagram arrives and there is no room for it, the oldest datagram is
+ * evicted. Datagrams that are still incomplete "timeout" seconds after their
+ * first fragment arrived are dropped.
+ *
+ * Hosts disagree about what to do with fragments that overlap ones they
+ * already have, so which data wins is a policy: FIRST keeps the data that
+ * arrived first, LAST the data that arrived last, and BSD the data of the
+ * fragment with the lower offset, the data that arrived first breaking ties.
+ * DISCARD drops datagrams with overlapping fragments altogether, as current
+ * Linux kernels do.
+ */
+class Defragmenter {
+  public:
+    enum Policy { FIRST, LAST, BSD, DISCARD };
+    Defragmenter();
+    bool initialize(const size_t &maxDatagrams, const uint32_t &timeout,
+                    const Policy &policy);
+    static bool policy(const std::string &name, Policy &policy);
+    operator bool() const;
+    const std::string &error() const;
+    template <int linkType>
+    const u_char *defragment(pcap_pkthdr &pcapHeader,
+                             const u_char *pcapPacket);
+    const size_t &size() const;
+    const uint64_t &reassembled() const;
+    const uint64_t &timeouts() const;
+    const uint64_t &evictions() const;
+    const uint64_t &drops() const;
+    ~Defragmenter();
+  private:
+    /* The most fragments a datagram may arrive in. */
+    static const size_t maxFragments = 64;
+    /*
+     * Room for the longest link-layer header (Linux SLL), as many tags as the
+     * decoder looks through and the longest IP header.
+     */
+    static const size_t headerRoom = 16 + maxVLANTags * 4 + 60;
+    struct Buffer {
+      u_char data[headerRoom + 65535];
+    };
+    /* A run of payload bytes, and the offset of the fragment they came from. */
+    struct Range {
+      uint16_t start;
+      uint16_t end;
+      uint16_t owner;
+    };
+    struct Datagram {
+      Datagram *next;
+      Datagram *older;
+      Datagram *newer;
+      uint32_t source;
+      uint32_t destination;
+      uint16_t id;
+      uint8_t protocol;
+      uint32_t hash;
+      uint32_t created;
+      /* Payload size, once the last fragment has arrived. */
+      bool last;
+      uint16_t size;
+      /*
+       * The link-layer and IP headers of the first fragment, once it has
+       * arrived.
+       */
+      size_t linkLength;
+      size_t headerLength;
+      u_char header[headerRoom];
+      size_t numRanges;
+      Range ranges[maxFragments];
+      Memory <Buffer>::Pointer buffer;
+    };
+    bool _error;
+    std::string errorMessage;
+    Datagram *datagrams;
+    Datagram **buckets;
+    size_t mask;
+    Datagram *freeDatagrams;
+    /* Datagrams in the order their first fragments arrived in. */
+    Datagram *oldest;
+    Datagram *newest;
+    size_t _size;
+    uint32_t timeout;
+    Policy _policy;
+    Memory <Buffer> buffers;
+    /* The last datagram returned, which is kept until the next call. */
+    Memory <Buffer>::Pointer completed;
+    Range scratch[maxFragments * 2 + 3];
+    uint64_t _reassembled;
+    uint64_t _timeouts;
+    uint64_t _evictions;
+    uint64_t _drops;
+    Datagram *find(const uint32_t &source, const uint32_t &destination,
+                   const uint16_t &id, const uint8_t &protocol,
+                   const uint32_t &hash) const;
+    Datagram *create(const uint32_t &source, const uint32_t &destination,
+                     const uint16_t &id, const uint8_t &protocol,
+                     const uint32_t &hash, const uint32_t &time);
+    bool insert(Datagram &datagram, const uint16_t &start,
+                const uint16_t &end, const u_char *data);
+    static bool before(const Range &left, const Range &right);
+    bool complete(const Datagram &datagram) const;
+    void remove(Datagram *datagram);
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cstring>
+
+#include <sstream>
+
+#include <arpa/inet.h>
+
+#include <include/address.h>
+
+#include "flowKey.h"
+#include "hash.hpp"
+
+/*
+ * Sets the key to an IPv4 flow. Returns false if the source endpoint sorts
+ * first, and true if the endpoints were swapped.
+ */
+bool FlowKey::set(const uint8_t &protocol, const uint32_t &sourceIP,
+                  const uint32_t &destinationIP, const uint16_t &sourcePort,
+                  const uint16_t &destinationPort) {
+  bool direction = (sourceIP > destinationIP ||
+                    (sourceIP == destinationIP &&
+                     sourcePort > destinationPort));
+  memset(this, 0, sizeof(*this));
+  addresses[direction][0] = sourceIP;
+  addresses[!direction][0] = destinationIP;
+  ports[direction] = sourcePort;
+  ports[!direction] = destinationPort;
+  this -> protocol = protocol;
+  version = 4;
+  return direction;
+}
+
+/* Sets the key to an IPv6 flow, returning its direction as above. */
+bool FlowKey::set(const uint8_t &protocol, const in6_addr &sourceIP,
+                  const in6_addr &destinationIP, const uint16_t &sourcePort,
+                  const uint16_t &destinationPort) {
+  int order = memcmp(&sourceIP, &destinationIP, sizeof(in6_addr));
+  bool direction = (order > 0 ||
+                    (order == 0 && sourcePort > destinationPort));
+  memset(this, 0, sizeof(*this));
+  memcpy(addresses[direction], &sourceIP, sizeof(in6_addr));
+  memcpy(addresses[!direction], &destinationIP, sizeof(in6_addr));
+  ports[direction] = sourcePort;
+  ports[!direction] = destinationPort;
+  this -> protocol = protocol;
+  version = 6;
+  return direction;
+}
+
+/*
+ * Sets the key to a packet's flow. Ports are left out for anything but
+ * unfragmented TCP and UDP, as they aren't there to be had.
+ */
+bool FlowKey::set(const Packet &packet) {
+  static const uint16_t noPort = 0;
+  const uint16_t *sourcePort = &noPort, *destinationPort = &noPort;
+  if (packet.fragmented() == false &&
+      (packet.protocol() == IPPROTO_TCP || packet.protocol() == IPPROTO_UDP)) {
+    sourcePort = &(packet.sourcePort());
+    destinationPort = &(packet.destinationPort());
+  }
+  if (packet.version() == 6) {
+    return set(packet.protocol(), packet.sourceIPv6(),
+               packet.destinationIPv6(), *sourcePort, *destinationPort);
+  }
+  return set(packet.protocol(), packet.sourceIP(), packet.destinationIP(),
+             *sourcePort, *destinationPort);
+}
+
+uint32_t FlowKey::hash() const {
+  uint32_t hash = mix((((uint32_t)ports[0] << 16) | ports[1]) ^
+                      ((uint32_t)protocol << 8) ^ version);
+  hash = mix(hash ^ addresses[0][0]);
+  hash = mix(hash ^ addresses[1][0]);
+  if (version == 6) {
+    for (size_t i = 1; i < 4; ++i) {
+      hash = mix(hash ^ addresses[0][i]);
+      hash = mix(hash ^ addresses[1][i]);
+    }
+  }
+  return hash;
+}
+
+bool FlowKey::operator==(const FlowKey &key) const {
+  return (memcmp(this, &key, sizeof(*this)) == 0);
+}
+
+bool FlowKey::operator!=(const FlowKey &key) const {
+  return !(*this == key);
+}
+
+std::string FlowKey::string() const {
+  std::ostringstream string;
+  char address[INET6_ADDRSTRLEN];
+  for (size_t i = 0; i < 2; ++i) {
+    if (version == 4) {
+      string << textIP(addresses[i][0]);
+    }
+    else {
+      string << '['
+             << inet_ntop(AF_INET6, addresses[i], address, sizeof(address))
+             << ']';
+    }
+    string << ':' << ntohs(ports[i]);
+    if (i == 0) {
+      string << " <-> ";
+    }
+  }
+  return string.str();
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef FLOW_KEY_H
+#define FLOW_KEY_H
+
+#include <string>
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <include/packet.h>
+
+/*
+ * Identifies a flow by its protocol, addresses and ports. The endpoint that
+ * sorts lower always comes first, so both directions of a flow have the same
+ * key, and set() reports which direction the packet it was given went in.
+ * IPv4 addresses occupy the first word of their address and leave the rest
+ * zeroed. The structure is plain old data, so it can be copied, hashed and
+ * compared as raw memory.
+ */
+struct FlowKey {
+  uint32_t addresses[2][4];
+  uint16_t ports[2];
+  uint8_t protocol;
+  uint8_t version;
+  uint16_t padding;
+  bool set(const uint8_t &protocol, const uint32_t &sourceIP,
+           const uint32_t &destinationIP, const uint16_t &sourcePort,
+           const uint16_t &destinationPort);
+  bool set(const uint8_t &protocol, const in6_addr &sourceIP,
+           const in6_addr &destinationIP, const uint16_t &sourcePort,
+           const uint16_t &destinationPort);
+  bool set(const Packet &packet);
+  uint32_t hash() const;
+  bool operator==(const FlowKey &key) const;
+  bool operator!=(const FlowKey &key) const;
+  std::string string() const;
+};
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef FLOW_MAP_HPP
+#define FLOW_MAP_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include <include/flowKey.h>
+#include <include/hash.hpp>
+
+/* Hashes of the kinds of keys a FlowMap can have. */
+inline uint32_t flowMapHash(const FlowKey &key) {
+  return key.hash();
+}
+
+inline uint32_t flowMapHash(const uint32_t &key) {
+  return mix(key);
+}
+
+/*
+ * A hash table of values keyed by FlowKey, for modules' session tables, or
+ * by IPv4 address, for tables of hosts.
+ *
+ * Entries live in one array, with collisions resolved by linear probing, so a
+ * lookup usually touches a single cache line and never allocates. The array
+ * is split into buckets of a fixed number of slots, and probing wraps around
+ * within a bucket rather than spilling into the next one, which lets callers
+ * lock one bucket at a time, as they would an unordered_map's. The table is
+ * sized once, for twice as many entries as it is meant to hold, and never
+ * grows; insert() fails if a bucket fills up.
+ */
+template <class T, class Key = FlowKey>
+class FlowMap {
+  public:
+    typedef std::pair <Key, T> value_type;
+    class iterator {
+      public:
+        iterator();
+        value_type &operator*() const;
+        value_type *operator->() const;
+        iterator &operator++();
+        bool operator==(const iterator &right) const;
+        bool operator!=(const iterator &right) const;
+      private:
+        friend class FlowMap;
+        iterator(FlowMap *map, const size_t &slot, const size_t &limit);
+        FlowMap *map;
+        size_t slot;
+        size_t limit;
+    };
+    typedef iterator local_iterator;
+    FlowMap();
+    bool initialize(const size_t &capacity);
+    operator bool() const;
+    const std::string &error() const;
+    size_t bucket(const Key &key) const;
+    size_t bucket_count() const;
+    iterator begin(const size_t &bucket);
+    iterator end(const size_t &bucket);
+    iterator end();
+    iterator find(const Key &key);
+    std::pair <iterator, bool> insert(const value_type &value);
+    void erase(iterator position);
+    size_t size() const;
+  private:
+    /* Slots per bucket. Slots are picked by the low bits of a key's hash. */
+    static const size_t bucketSize = 256;
+    bool _error;
+    std::string errorMessage;
+    std::vector <value_type> slots;
+    std::vector <uint8_t> used;
+    size_t bucketMask;
+    /* Changed by threads holding different bucket locks. */
+    volatile size_t _size;
+};
+
+template <class T, class Key>
+FlowMap <T, Key>::iterator::iterator() {
+  map = NULL;
+  slot = 0;
+  limit = 0;
+}
+
+template <class T, class Key>
+FlowMap <T, Key>::iterator::iterator(FlowMap *map, const size_t &slot,
+                                const size_t &limit) {
+  this -> map = map;
+  this -> slot = slot;
+  this -> limit = limit;
+}
+
+template <class T, class Key>
+typename FlowMap <T, Key>::value_type &FlowMap <T, Key>::iterator::operator*() const {
+  return map -> slots[slot];
+}
+
+template <class T, class Key>
+typename FlowMap <T, Key>::value_type *FlowMap <T, Key>::iterator::operator->() const {
+  return &(map -> slots[slot]);
+}
+
+/* Moves to the next entry in the bucket, or to the bucket's end. */
+template <class T, class Key>
+typename FlowMap <T, Key>::iterator &FlowMap <T, Key>::iterator::operator++() {
+  do {
+    ++slot;
+  } while (slot < limit && map -> used[slot] == 0);
+  return *this;
+}
+
+template <class T, class Key>
+bool FlowMap <T, Key>::iterator::operator==(const iterator &right) const {
+  return (slot == right.slot);
+}
+
+template <class T, class Key>
+bool FlowMap <T, Key>::iterator::operator!=(const iterator &right) const {
+  return (slot != right.slot);
+}
+
+template <class T, class Key>
+FlowMap <T, Key>::FlowMap() {
+  _error = true;
+  errorMessage = "FlowMap::FlowMap(): class not initialized";
+  bucketMask = 0;
+  _size = 0;
+}
+
+template <class T, class Key>
+bool FlowMap <T, Key>::initialize(const size_t &capacity) {
+  size_t numBuckets = 1;
+  while (numBuckets * bucketSize < capacity * 2) {
+    numBuckets <<= 1;
+  }
+  slots.resize(numBuckets * bucketSize);
+  used.assign(numBuckets * bucketSize, 0);
+  bucketMask = numBuckets - 1;
+  _size = 0;
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+template <class T, class Key>
+FlowMap <T, Key>::operator bool() const {
+  return !_error;
+}
+
+template <class T, class Key>
+const std::string &FlowMap <T, Key>::error() const {
+  return errorMessage;
+}
+
+template <class T, class Key>
+size_t FlowMap <T, Key>::bucket(const Key &key) const {
+  return (flowMapHash(key) / bucketSize) & bucketMask;
+}
+
+template <class T, class Key>
+size_t FlowMap <T, Key>::bucket_count() const {
+  return bucketMask + 1;
+}
+
+template <class T, class Key>
+typename FlowMap <T, Key>::iterator FlowMap <T, Key>::begin(const size_t &bucket) {
+  iterator position(this, bucket * bucketSize, (bucket + 1) * bucketSize);
+  if (used[position.slot] == 0) {
+    ++position;
+  }
+  return position;
+}
+
+template <class T, class Key>
+typename FlowMap <T, Key>::iterator FlowMap <T, Key>::end(const size_t &bucket) {
+  return iterator(this, (bucket + 1) * bucketSize, (bucket + 1) * bucketSize);
+}
+
+template <class T, class Key>
+typename FlowMap <T, Key>::iterator FlowMap <T, Key>::end() {
+  return iterator(this, slots.size(), slots.size());
+}
+
+template <class T, class Key>
+typename FlowMap <T, Key>::iterator FlowMap <T, Key>::find(const Key &key) {
+  uint32_t hash = flowMapHash(key);
+  size_t base = ((hash / bucketSize) & bucketMask) * bucketSize;
+  size_t slot;
+  for (size_t i = 0; i < bucketSize; ++i) {
+    slot = base + ((hash + i) & (bucketSize - 1));
+    if (used[slot] == 0) {
+      break;
+    }
+    if (slots[slot].first == key) {
+      return iterator(this, slot, base + bucketSize);
+    }
+  }
+  return end();
+}
+
+/*
+ * Inserts an entry unless one with the same key exists. Returns an iterator
+ * to the entry with the key and whether it was inserted, or end() and false
+ * if the key's bucket is full.
+ */
+template <class T, class Key>
+std::pair <typename FlowMap <T, Key>::iterator, bool> FlowMap <T, Key>::insert(const value_type &value) {
+  uint32_t hash = flowMapHash(value.first);
+  size_t base = ((hash / bucketSize) & bucketMask) * bucketSize;
+  size_t slot;
+  for (size_t i = 0; i < bucketSize; ++i) {
+    slot = base + ((hash + i) & (bucketSize - 1));
+    if (used[slot] == 0) {
+      slots[slot] = value;
+      used[slot] = 1;
+      __sync_add_and_fetch(&_size, 1);
+      return std::make_pair(iterator(this, slot, base + bucketSize), true);
+    }
+    if (slots[slot].first == value.first) {
+      return std::make_pair(iterator(this, slot, base + bucketSize), false);
+    }
+  }
+  return std::make_pair(end(), false);
+}
+
+/*
+ * Removes an entry, moving back any entries after it in its probe sequence
+ * that would otherwise no longer be found. Iterators into the bucket are
+ * invalidated. A full bucket has no free slot to stop at, so the scan stops
+ * once it has looked at every other slot.
+ */
+template <class T, class Key>
+void FlowMap <T, Key>::erase(iterator position) {
+  size_t base = position.slot - (position.slot & (bucketSize - 1));
+  size_t hole = position.slot - base, next = hole, home;
+  for (size_t i = 1; i < bucketSize; ++i) {
+    next = (next + 1) & (bucketSize - 1);
+    if (used[base + next] == 0) {
+      break;
+    }
+    home = flowMapHash(slots[base + next].first) & (bucketSize - 1);
+    /* Move the entry into the hole unless its home lies after the hole. */
+    if (((next - home) & (bucketSize - 1)) >=
+        ((next - hole) & (bucketSize - 1))) {
+      slots[base + hole] = slots[base + next];
+      hole = next;
+    }
+  }
+  slots[base + hole].second = T();
+  used[base + hole] = 0;
+  __sync_sub_and_fetch(&_size, 1);
+}
+
+template <class T, class Key>
+size_t FlowMap <T, Key>::size() const {
+  return _size;
+}
+
+#endif
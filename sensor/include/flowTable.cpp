@@ -0,0 +1,231 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "flowTable.h"
+
+/* Module state starts at the first suitably-aligned address past the flow. */
+static const size_t headerSize = (sizeof(Flow) + 7) & ~(size_t)7;
+
+u_char *Flow::state() {
+  return (u_char*)this + headerSize;
+}
+
+FlowTable::FlowTable() {
+  _error = true;
+  errorMessage = "FlowTable::FlowTable(): class not initialized";
+  flows = NULL;
+  buckets = NULL;
+  freeFlows = NULL;
+  oldest = NULL;
+  newest = NULL;
+  _size = 0;
+  release = NULL;
+  releaseArgument = NULL;
+}
+
+bool FlowTable::initialize(const size_t &maxFlows, const size_t &stateSize,
+                           const uint32_t &timeout) {
+  size_t numBuckets = 1;
+  Flow *flow;
+  if (maxFlows == 0) {
+    _error = true;
+    errorMessage = "FlowTable::initialize(): table is too small";
+    return false;
+  }
+  this -> stateSize = stateSize;
+  this -> timeout = timeout;
+  flowSize = (headerSize + stateSize + 7) & ~(size_t)7;
+  flows = (u_char*)malloc(maxFlows * flowSize);
+  if (flows == NULL) {
+    _error = true;
+    errorMessage = "FlowTable::initialize(): malloc(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  /* Keep chains short by having at least as many buckets as flows. */
+  while (numBuckets < maxFlows) {
+    numBuckets <<= 1;
+  }
+  buckets = (Flow**)calloc(numBuckets, sizeof(Flow*));
+  if (buckets == NULL) {
+    _error = true;
+    errorMessage = "FlowTable::initialize(): calloc(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  mask = numBuckets - 1;
+  for (size_t i = maxFlows; i > 0; --i) {
+    flow = (Flow*)(flows + (i - 1) * flowSize);
+    flow -> next = freeFlows;
+    freeFlows = flow;
+  }
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+void FlowTable::setRelease(Release release, void *argument) {
+  this -> release = release;
+  releaseArgument = argument;
+}
+
+FlowTable::operator bool() const {
+  return !_error;
+}
+
+const std::string &FlowTable::error() const {
+  return errorMessage;
+}
+
+/*
+ * Returns the flow a packet belongs to, creating it if it is new, or NULL if
+ * the packet isn't part of a TCP or UDP flow.
+ */
+Flow *FlowTable::find(const Packet &packet) {
+  FlowKey key;
+  uint32_t hash;
+  Flow *flow;
+  if (packet.fragmented() == true ||
+      (packet.protocol() != IPPROTO_TCP && packet.protocol() != IPPROTO_UDP)) {
+    return NULL;
+  }
+  key.set(packet);
+  hash = key.hash();
+  for (flow = buckets[hash & mask]; flow != NULL; flow = flow -> next) {
+    if (flow -> hash == hash && flow -> key == key) {
+      break;
+    }
+  }
+  if (flow != NULL) {
+    /* A flow that has been idle too long starts over. */
+    if (packet.time().seconds() >= flow -> lastUpdate + timeout) {
+      if (release != NULL) {
+        release(*flow, releaseArgument);
+      }
+      memset(flow -> state(), 0, stateSize);
+    }
+    if (flow != newest) {
+      remove(flow);
+    }
+    else {
+      flow -> lastUpdate = packet.time().seconds();
+      return flow;
+    }
+  }
+  else {
+    expire(packet.time().seconds());
+    if (freeFlows != NULL) {
+      flow = freeFlows;
+      freeFlows = flow -> next;
+    }
+    else {
+      flow = oldest;
+      remove(flow);
+      if (release != NULL) {
+        release(*flow, releaseArgument);
+      }
+    }
+    flow -> key = key;
+    flow -> hash = hash;
+    memset(flow -> state(), 0, stateSize);
+  }
+  flow -> lastUpdate = packet.time().seconds();
+  flow -> next = buckets[hash & mask];
+  buckets[hash & mask] = flow;
+  flow -> older = newest;
+  flow -> newer = NULL;
+  if (newest != NULL) {
+    newest -> newer = flow;
+  }
+  else {
+    oldest = flow;
+  }
+  newest = flow;
+  ++_size;
+  return flow;
+}
+
+/*
+ * Forgets the flows that have been idle for at least the timeout as of
+ * "time". Packets arrive in time order, so the oldest flows are the only ones
+ * that can have timed out.
+ */
+void FlowTable::expire(const uint32_t &time) {
+  while (oldest != NULL && time >= oldest -> lastUpdate + timeout) {
+    forget(oldest);
+  }
+}
+
+/* Forgets every flow, as when the sensor stops. */
+void FlowTable::clear() {
+  while (oldest != NULL) {
+    forget(oldest);
+  }
+}
+
+const size_t &FlowTable::size() const {
+  return _size;
+}
+
+/* Unlinks a flow from its bucket and from the age list. */
+void FlowTable::remove(Flow *flow) {
+  Flow **link = &(buckets[flow -> hash & mask]);
+  while (*link != flow) {
+    link = &((*link) -> next);
+  }
+  *link = flow -> next;
+  if (flow -> older != NULL) {
+    flow -> older -> newer = flow -> newer;
+  }
+  else {
+    oldest = flow -> newer;
+  }
+  if (flow -> newer != NULL) {
+    flow -> newer -> older = flow -> older;
+  }
+  else {
+    newest = flow -> older;
+  }
+  --_size;
+}
+
+/* Releases a flow's state and puts the flow back on the free list. */
+void FlowTable::forget(Flow *flow) {
+  remove(flow);
+  if (release != NULL) {
+    release(*flow, releaseArgument);
+  }
+  flow -> next = freeFlows;
+  freeFlows = flow;
+}
+
+FlowTable::~FlowTable() {
+  free(flows);
+  free(buckets);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef FLOW_TABLE_H
+#define FLOW_TABLE_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include <include/flowKey.h>
+#include <include/packet.h>
+
+/*
+ * A module's share of the state kept for every flow. A module that wants one
+ * exports a "FlowSlot flowSlot" variable with "size" set to the number of
+ * bytes it needs; the sensor fills in "offset" before initializing it.
+ */
+struct FlowSlot {
+  size_t size;
+  size_t offset;
+};
+
+/*
+ * A TCP or UDP flow, shared by both of its directions. Module state follows
+ * the structure in memory. It is zeroed when the flow is created or starts
+ * over, so anything that it owns must be let go of by the table's release
+ * function first.
+ */
+struct Flow {
+  Flow *next;
+  Flow *older;
+  Flow *newer;
+  FlowKey key;
+  uint32_t hash;
+  uint32_t lastUpdate;
+  u_char *state();
+};
+
+/*
+ * The sensor's connection-tracking table. Each capture worker has its own,
+ * since every packet of a flow goes to the same worker, so lookups take no
+ * locks. The table holds at most a fixed number of flows, allocated up front;
+ * flows idle for longer than the timeout are reused first, and when none
+ * are, the least recently seen flow is.
+ */
+class FlowTable {
+  public:
+    /*
+     * Called when a flow is forgotten or starts over, before its state is
+     * cleared, for sensor components whose per-flow state holds on to
+     * anything.
+     */
+    typedef void (*Release)(Flow &flow, void *argument);
+    FlowTable();
+    bool initialize(const size_t &maxFlows, const size_t &stateSize,
+                    const uint32_t &timeout);
+    void setRelease(Release release, void *argument);
+    operator bool() const;
+    const std::string &error() const;
+    Flow *find(const Packet &packet);
+    void expire(const uint32_t &time);
+    void clear();
+    const size_t &size() const;
+    ~FlowTable();
+  private:
+    bool _error;
+    std::string errorMessage;
+    u_char *flows;
+    size_t flowSize;
+    size_t stateSize;
+    Flow **buckets;
+    size_t mask;
+    Flow *freeFlows;
+    /* Flows in the order they were last seen in. */
+    Flow *oldest;
+    Flow *newest;
+    size_t _size;
+    uint32_t timeout;
+    Release release;
+    void *releaseArgument;
+    void remove(Flow *flow);
+    void forget(Flow *flow);
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+
+#include "histogram.h"
+
+Histogram::Histogram() {
+  memset((void*)buckets, 0, sizeof(buckets));
+  _count = 0;
+  _maximum = 0;
+  _sum = 0;
+}
+
+void Histogram::record(const uint64_t value) {
+  uint64_t maximum = _maximum;
+  __sync_add_and_fetch(&(buckets[bucket(value)]), 1);
+  __sync_add_and_fetch(&_count, 1);
+  __sync_add_and_fetch(&_sum, value);
+  while (value > maximum &&
+         !__sync_bool_compare_and_swap(&_maximum, maximum, value)) {
+    maximum = _maximum;
+  }
+}
+
+uint64_t Histogram::count() const {
+  return _count;
+}
+
+uint64_t Histogram::maximum() const {
+  return _maximum;
+}
+
+uint64_t Histogram::sum() const {
+  return _sum;
+}
+
+/*
+ * Returns a value that at least "percentile" percent of the recorded values
+ * are no greater than, or 0 if nothing has been recorded.
+ */
+uint64_t Histogram::percentile(const double percentile) const {
+  uint64_t count = _count, target, sum = 0;
+  if (count == 0) {
+    return 0;
+  }
+  target = (uint64_t)(percentile / 100 * count + 0.5);
+  if (target == 0) {
+    target = 1;
+  }
+  for (size_t i = 0; i < numBuckets; ++i) {
+    sum += buckets[i];
+    if (sum >= target) {
+      return (highest(i) < _maximum) ? highest(i) : _maximum;
+    }
+  }
+  return _maximum;
+}
+
+/*
+ * Values below 32 each have a bucket of their own. Above that, a value whose
+ * highest set bit is bit "n" goes in group n - 4, and its next five bits pick
+ * the bucket within the group.
+ */
+size_t Histogram::bucket(const uint64_t value) {
+  unsigned int shift;
+  if (value < subBuckets) {
+    return value;
+  }
+  shift = 63 - __builtin_clzll(value) - subBucketBits;
+  return ((shift + 1) << subBucketBits) +
+         ((value >> shift) & (subBuckets - 1));
+}
+
+/* Returns the highest value that falls in a bucket. */
+uint64_t Histogram::highest(const size_t bucket) {
+  size_t group = bucket >> subBucketBits;
+  uint64_t subBucket = bucket & (subBuckets - 1);
+  if (group == 0) {
+    return subBucket;
+  }
+  return ((subBuckets + subBucket + 1) << (group - 1)) - 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * A histogram of 64-bit values, laid out like an HdrHistogram: values are
+ * grouped by their highest set bit, and each group is split into 32 equal
+ * buckets, so any value is known to within about 3% across the whole 64-bit
+ * range, in 15 KiB. record() only does atomic adds, so any number of threads
+ * may record into the same histogram without locking, while another reads
+ * it.
+ */
+class Histogram {
+  public:
+    Histogram();
+    void record(const uint64_t value);
+    uint64_t count() const;
+    uint64_t maximum() const;
+    uint64_t sum() const;
+    uint64_t percentile(const double percentile) const;
+  private:
+    static const unsigned int subBucketBits = 5;
+    static const size_t subBuckets = (size_t)1 << subBucketBits;
+    static const size_t numBuckets = (64 - subBucketBits + 1) * subBuckets;
+    volatile uint64_t buckets[numBuckets];
+    volatile uint64_t _count;
+    volatile uint64_t _maximum;
+    volatile uint64_t _sum;
+    static size_t bucket(const uint64_t value);
+    static uint64_t highest(const size_t bucket);
+};
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <strings.h>
+
+#include "httpHeaderTable.h"
+
+HTTPHeaderTable::HTTPHeaderTable() {
+  _error = true;
+  errorMessage = "HTTPHeaderTable::HTTPHeaderTable(): class not initialized";
+  limit = 0;
+  mask = 0;
+  slots = NULL;
+  names = NULL;
+  lengths = NULL;
+  _size = 0;
+  _overflows = 0;
+}
+
+/*
+ * Sets aside room for "limit" interned names. With a limit of 0, only the
+ * well-known names are numbered.
+ */
+bool HTTPHeaderTable::initialize(const size_t limit) {
+  size_t capacity = 1;
+  int error;
+  this -> limit = limit;
+  if (this -> limit > (size_t)(65535 - numKnownHeaders)) {
+    this -> limit = 65535 - numKnownHeaders;
+  }
+  /* Keep the hash table at most half full. */
+  while (capacity < this -> limit * 2) {
+    capacity *= 2;
+  }
+  mask = capacity - 1;
+  slots = new(std::nothrow) uint16_t[capacity];
+  names = new(std::nothrow) char*[this -> limit + 1];
+  lengths = new(std::nothrow) size_t[this -> limit + 1];
+  if (slots == NULL || names == NULL || lengths == NULL) {
+    _error = true;
+    errorMessage = "HTTPHeaderTable::initialize(): could not allocate memory";
+    return false;
+  }
+  memset((void*)slots, 0, capacity * sizeof(uint16_t));
+  error = pthread_mutex_init(&lock, NULL);
+  if (error != 0) {
+    _error = true;
+    errorMessage = "HTTPHeaderTable::initialize(): pthread_mutex_init(): ";
+    errorMessage += strerror(error);
+    return false;
+  }
+  _error = false;
+  return true;
+}
+
+HTTPHeaderTable::operator bool() const {
+  return !_error;
+}
+
+const std::string &HTTPHeaderTable::error() const {
+  return errorMessage;
+}
+
+/*
+ * Returns the ID of a header name, ignoring case, interning it if it is
+ * neither well-known nor already interned. Returns 0 if the table is full.
+ */
+uint16_t HTTPHeaderTable::intern(const char *name, const size_t length) {
+  uint16_t id = knownHeader(name, length);
+  size_t slot;
+  char *copy;
+  if (id != 0 || _error == true || limit == 0 || length == 0) {
+    return id;
+  }
+  id = find(name, length);
+  if (id != 0) {
+    return id;
+  }
+  pthread_mutex_lock(&lock);
+  /* Another thread may have added it in the meantime. */
+  id = find(name, length);
+  if (id == 0 && _size < limit && (copy = (char*)malloc(length + 1)) != NULL) {
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    names[_size] = copy;
+    lengths[_size] = length;
+    id = numKnownHeaders + 1 + _size;
+    slot = hash(name, length) & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    /* Readers must see the name before the ID that leads to it. */
+    __sync_synchronize();
+    slots[slot] = id;
+    ++_size;
+  }
+  else if (id == 0) {
+    __sync_add_and_fetch(&_overflows, 1);
+  }
+  pthread_mutex_unlock(&lock);
+  return id;
+}
+
+/* Returns the name that an ID stands for, or NULL if it stands for none. */
+const char *HTTPHeaderTable::name(const uint16_t id) const {
+  if (id <= numKnownHeaders) {
+    return knownHeaderName(id);
+  }
+  if ((size_t)(id - numKnownHeaders - 1) < _size) {
+    return names[id - numKnownHeaders - 1];
+  }
+  return NULL;
+}
+
+/* Returns the number of names interned. */
+size_t HTTPHeaderTable::size() const {
+  return _size;
+}
+
+/* Returns the number of times a name could not be interned. */
+uint64_t HTTPHeaderTable::overflows() const {
+  return _overflows;
+}
+
+HTTPHeaderTable::~HTTPHeaderTable() {
+  if (names != NULL) {
+    for (size_t i = 0; i < _size; ++i) {
+      free(names[i]);
+    }
+  }
+  delete[] slots;
+  delete[] names;
+  delete[] lengths;
+  if (_error == false) {
+    pthread_mutex_destroy(&lock);
+  }
+}
+
+/* FNV-1a, over the name in lowercase. */
+size_t HTTPHeaderTable::hash(const char *name, const size_t length) {
+  uint32_t _hash = 2166136261U;
+  for (size_t i = 0; i < length; ++i) {
+    _hash ^= tolower((unsigned char)name[i]);
+    _hash *= 16777619;
+  }
+  return _hash;
+}
+
+uint16_t HTTPHeaderTable::find(const char *name, const size_t length) const {
+  size_t slot = hash(name, length) & mask;
+  uint16_t id;
+  while ((id = slots[slot]) != 0) {
+    if (lengths[id - numKnownHeaders - 1] == length &&
+        strncasecmp(names[id - numKnownHeaders - 1], name, length) == 0) {
+      return id;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HTTP_HEADER_TABLE_H
+#define HTTP_HEADER_TABLE_H
+
+#include <string>
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <include/httpHeaders.h>
+
+/*
+ * Numbers HTTP header names, so that messages can refer to a name with a
+ * 16-bit ID instead of a copy of it. Well-known names keep their numbers
+ * from httpHeaders.h. Other names are interned as they are first seen, up to
+ * "limit" of them, and numbered after the well-known ones; intern() returns
+ * 0 for names that don't fit. Lookups take no locks, and only adding a name
+ * does, so any number of threads may intern names at once.
+ */
+class HTTPHeaderTable {
+  public:
+    HTTPHeaderTable();
+    bool initialize(const size_t limit);
+    operator bool() const;
+    const std::string &error() const;
+    uint16_t intern(const char *name, const size_t length);
+    const char *name(const uint16_t id) const;
+    size_t size() const;
+    uint64_t overflows() const;
+    ~HTTPHeaderTable();
+  private:
+    bool _error;
+    std::string errorMessage;
+    size_t limit;
+    size_t mask;
+    /* IDs of interned names, in an open-addressed hash table. */
+    volatile uint16_t *slots;
+    /* Interned names and their lengths, indexed by ID less the known ones. */
+    char **names;
+    size_t *lengths;
+    volatile size_t _size;
+    volatile uint64_t _overflows;
+    pthread_mutex_t lock;
+    static size_t hash(const char *name, const size_t length);
+    uint16_t find(const char *name, const size_t length) const;
+};
+
+#endif
@@ -22,6 +22,12 @@
 #include <assert.h>
 #include <stddef.h>
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #include "httpParser.h"
 
 #ifndef MIN
@@ -301,6 +307,113 @@ enum flags
 #define TOKEN(c) tokens[(unsigned char)c]
 
 
+/* Fast paths for the states that spend most of their time on runs of
+ * ordinary bytes: URL characters in a path, query string or fragment, and
+ * any byte but CR and LF in a header value. Each returns how many bytes from
+ * "p" on, short of "pe", belong to the run, looking at 32 (AVX2) or 16
+ * (SSE2) of them at a time where the compiler allows, and one at a time
+ * otherwise.
+ */
+static size_t
+url_run (const char *p, const char *pe)
+{
+  const char *start = p;
+  unsigned int mask;
+#if defined(__AVX2__)
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i del = _mm256_set1_epi8(127);
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i question = _mm256_set1_epi8('?');
+  __m256i x;
+  for (; pe - p >= 32; p += 32) {
+    x = _mm256_loadu_si256((const __m256i *)p);
+    /* Bytes from 0x80 up are negative, so this leaves 0x21 through 0x7f. */
+    mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(x, space))
+         & ~_mm256_movemask_epi8(_mm256_or_si256(
+               _mm256_cmpeq_epi8(x, del),
+               _mm256_or_si256(_mm256_cmpeq_epi8(x, hash),
+                               _mm256_cmpeq_epi8(x, question))));
+    if (mask != 0xffffffff) return p - start + __builtin_ctz(~mask);
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(127);
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i question = _mm_set1_epi8('?');
+    __m128i x;
+    for (; pe - p >= 16; p += 16) {
+      x = _mm_loadu_si128((const __m128i *)p);
+      mask = _mm_movemask_epi8(_mm_cmpgt_epi8(x, space))
+           & ~_mm_movemask_epi8(_mm_or_si128(
+                 _mm_cmpeq_epi8(x, del),
+                 _mm_or_si128(_mm_cmpeq_epi8(x, hash),
+                              _mm_cmpeq_epi8(x, question))));
+      if (mask != 0xffff) return p - start + __builtin_ctz(~mask);
+    }
+  }
+#endif
+  (void)mask;
+  while (p != pe && normal_url_char[(unsigned char)*p]) p++;
+  return p - start;
+}
+
+
+static size_t
+header_value_run (const char *p, const char *pe)
+{
+  const char *start = p;
+  unsigned int mask;
+#if defined(__AVX2__)
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+  __m256i x;
+  for (; pe - p >= 32; p += 32) {
+    x = _mm256_loadu_si256((const __m256i *)p);
+    mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, cr),
+                                                _mm256_cmpeq_epi8(x, lf)));
+    if (mask != 0) return p - start + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i cr = _mm_set1_epi8(CR);
+    const __m128i lf = _mm_set1_epi8(LF);
+    __m128i x;
+    for (; pe - p >= 16; p += 16) {
+      x = _mm_loadu_si128((const __m128i *)p);
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, cr),
+                                            _mm_cmpeq_epi8(x, lf)));
+      if (mask != 0) return p - start + __builtin_ctz(mask);
+    }
+  }
+#endif
+  (void)mask;
+  while (p != pe && *p != CR && *p != LF) p++;
+  return p - start;
+}
+
+
+/* Moves "p" to the last byte of the run after it, counting the bytes toward
+ * the header size limit as the loop would. The run is cut short of the limit,
+ * so that the loop still fails on the same byte it would have otherwise.
+ */
+#define SKIP_RUN(RUN)                                                \
+do {                                                                 \
+  const char *end = pe;                                              \
+  if (PARSING_HEADER(state)) {                                       \
+    if ((uint64_t)(pe - p - 1) > HTTP_MAX_HEADER_SIZE - nread)       \
+      end = p + 1 + (HTTP_MAX_HEADER_SIZE - nread);                  \
+    run = RUN(p + 1, end);                                           \
+    nread += run;                                                    \
+  } else {                                                           \
+    run = RUN(p + 1, end);                                           \
+  }                                                                  \
+  p += run;                                                          \
+} while (0)
+
+
 #define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
 
 
@@ -321,6 +434,7 @@ size_t http_parser_execute (http_parser *parser,
   char c, ch;
   const char *p = data, *pe;
   int64_t to_read;
+  size_t run;
 
   enum state state = (enum state) parser->state;
   enum header_states header_state = (enum header_states) parser->header_state;
@@ -728,7 +842,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_path:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_RUN(url_run);
+          break;
+        }
 
         switch (ch) {
           case ' ':
@@ -802,7 +919,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_query_string:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_RUN(url_run);
+          break;
+        }
 
         switch (ch) {
           case '?':
@@ -876,7 +996,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_fragment:
       {
-        if (normal_url_char[(unsigned char)ch]) break;
+        if (normal_url_char[(unsigned char)ch]) {
+          SKIP_RUN(url_run);
+          break;
+        }
 
         switch (ch) {
           case ' ':
@@ -1258,6 +1381,7 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (header_state) {
           case h_general:
+            SKIP_RUN(header_value_run);
             break;
 
           case h_connection:
@@ -22,9 +22,23 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstring>
+
 #include "httpSession.h"
 
-HTTPMessage::HTTPMessage(const http_parser_type &_type, const TimeStamp &_time) {
+HTTPSpan::HTTPSpan() {
+  begin = "";
+  length = 0;
+}
+
+HTTPHeader::HTTPHeader() {
+  name = 0;
+}
+
+HTTPMessage::HTTPMessage(const http_parser_type &_type, const TimeStamp &_time,
+                         Arena &arena)
+  : message(ArenaAllocator <HTTPSpan>(arena)),
+    headers(ArenaAllocator <HTTPHeader>(arena)) {
   type = _type;
   time = _time;
   if (_type == HTTP_REQUEST) {
@@ -32,9 +46,63 @@ HTTPMessage::HTTPMessage(const http_parser_type &_type, const TimeStamp &_time)
   }
 }
 
-HTTPSession::HTTPSession() {
+HTTPSession::HTTPSession()
+  : requests(ArenaAllocator <HTTPMessage>(arena)),
+    responses(ArenaAllocator <HTTPMessage>(arena)) {
+  direction = false;
   http_parser_init(&(parsers[0]), HTTP_BOTH);
   http_parser_init(&(parsers[1]), HTTP_BOTH);
   requestState = NO_STATE;
   responseState = NO_STATE;
+  headerTable = NULL;
+}
+
+/* Points "span" at a copy of "data" in the session's arena. */
+void HTTPSession::assign(HTTPSpan &span, const char *data,
+                         const size_t length) {
+  char *begin = (char*)arena.allocate(length, 1);
+  memcpy(begin, data, length);
+  span.begin = begin;
+  span.length = length;
+}
+
+/*
+ * Adds "data" to the end of "span". A span is usually the last thing
+ * allocated from the arena, and grows in place, but if something else has
+ * been allocated since, such as a span for the other direction, the span is
+ * copied to make room.
+ */
+void HTTPSession::append(HTTPSpan &span, const char *data,
+                         const size_t length) {
+  char *begin;
+  if (arena.extend(span.begin, span.length, length)) {
+    memcpy((char*)span.begin + span.length, data, length);
+  }
+  else {
+    begin = (char*)arena.allocate(span.length + length, 1);
+    memcpy(begin, span.begin, span.length);
+    memcpy(begin + span.length, data, length);
+    span.begin = begin;
+  }
+  span.length += length;
+}
+
+const char *HTTPSession::data(const HTTPSpan &span) const {
+  return span.begin;
+}
+
+/* Copies the bytes of "span" into a string, for consumers that need one. */
+std::string HTTPSession::text(const HTTPSpan &span) const {
+  return std::string(span.begin, span.length);
+}
+
+/* Returns a span of a header's name, wherever it is kept. */
+HTTPSpan HTTPSession::name(const HTTPHeader &header) const {
+  HTTPSpan span;
+  if (header.name != 0 && headerTable != NULL &&
+      (span.begin = headerTable -> name(header.name)) != NULL) {
+    span.length = strlen(span.begin);
+    return span;
+  }
+  return header.field;
 }
@@ -39,22 +39,69 @@
 #include <netinet/ether.h>
 #endif
 
+#include <include/arena.h>
+#include <include/httpHeaderTable.h>
 #include <include/httpParser.h>
 #include <include/timeStamp.h>
 
+/*
+ * HEADER_SKIPPED_STATE is HEADER_VALUE_STATE for a header whose owner chose
+ * not to keep it.
+ */
 enum HTTPMessageState { NO_STATE, PATH_STATE, URL_STATE, HEADER_FIELD_STATE,
-                        HEADER_VALUE_STATE, COMPLETE_STATE };
+                        HEADER_VALUE_STATE, HEADER_SKIPPED_STATE,
+                        COMPLETE_STATE };
+
+/*
+ * A run of bytes in an HTTPSession's arena, which never moves them, so the
+ * span stays valid for as long as the session.
+ */
+struct HTTPSpan {
+  HTTPSpan();
+  const char *begin;
+  uint32_t length;
+};
+
+/*
+ * A header's name is given by its ID in the session's header table, or, if
+ * it has none, by "field".
+ */
+struct HTTPHeader {
+  HTTPHeader();
+  uint16_t name;
+  HTTPSpan field;
+  HTTPSpan value;
+};
 
+/*
+ * A request's "message" holds its method, path, query string, fragment and
+ * HTTP version, and a response's its HTTP version and status code. They, and
+ * each header's value, are spans of the session's arena; use
+ * HTTPSession::data() or HTTPSession::text() to get at them, and
+ * HTTPSession::name() to get at a header's name. The vectors themselves are
+ * allocated from the arena too.
+ */
 struct HTTPMessage {
-  HTTPMessage(const http_parser_type &_type, const TimeStamp &_time);
+  typedef std::vector <HTTPSpan, ArenaAllocator <HTTPSpan> > Message;
+  typedef std::vector <HTTPHeader, ArenaAllocator <HTTPHeader> > Headers;
+  HTTPMessage(const http_parser_type &_type, const TimeStamp &_time,
+              Arena &arena);
   http_parser_type type;
   TimeStamp time;
-  std::vector <std::string> message;
-  std::vector <std::pair <std::string, std::string> > headers;
+  Message message;
+  Headers headers;
 };
 
+/*
+ * Everything that a session holds besides its fixed-size fields comes from
+ * "arena", so it is all freed at once when the session is. The owner of the
+ * session should give the arena its first chunk, before parsing anything
+ * into the session; see Arena::initialize().
+ */
 struct HTTPSession {
+  typedef std::vector <HTTPMessage, ArenaAllocator <HTTPMessage> > Messages;
   HTTPSession();
+  Arena arena;
   TimeStamp time;
   char clientMAC[ETHER_ADDR_LEN];
   char serverMAC[ETHER_ADDR_LEN];
@@ -62,11 +109,23 @@ struct HTTPSession {
   uint32_t serverIP;
   uint16_t clientPort;
   uint16_t serverPort;
+  /*
+   * The direction, as given by Packet::direction(), of the packet that
+   * started the session, whose data "parsers[0]" handles.
+   */
+  bool direction;
   http_parser parsers[2];
   HTTPMessageState requestState;
   HTTPMessageState responseState;
-  std::vector <HTTPMessage> requests;
-  std::vector <HTTPMessage> responses;
+  Messages requests;
+  Messages responses;
+  /* The table that header name IDs refer to, set by the session's owner. */
+  const HTTPHeaderTable *headerTable;
+  void assign(HTTPSpan &span, const char *data, const size_t length);
+  void append(HTTPSpan &span, const char *data, const size_t length);
+  const char *data(const HTTPSpan &span) const;
+  std::string text(const HTTPSpan &span) const;
+  HTTPSpan name(const HTTPHeader &header) const;
 };
 
 #endif
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef LINK_LAYER_HPP
+#define LINK_LAYER_HPP
+
+#include <pcap.h>
+#include <stdint.h>
+
+#include <net/ethernet.h>
+
+#ifndef ETHERTYPE_IPV6
+#define ETHERTYPE_IPV6 0x86dd
+#endif
+
+/* 802.1ad service tags, and the pre-standard tag some QinQ gear still uses. */
+#define ETHERTYPE_QINQ 0x88a8
+#define ETHERTYPE_QINQ_OLD 0x9100
+
+/*
+ * The most VLAN tags looked through after the link-layer header. Frames with
+ * more are not decoded.
+ */
+static const size_t maxVLANTags = 4;
+
+/*
+ * The framing of each pcap datalink type the sensor decodes. The decoders
+ * are templates over the datalink type, instantiated once for each of these
+ * and picked when the capture is opened, so finding the network layer of a
+ * packet takes no per-packet test of what kind of capture it came from.
+ *
+ * Each specialization has:
+ *
+ *   headerLength: the size of the link-layer header.
+ *   tagged: whether VLAN tags may follow the header.
+ *   etherType(): the EtherType of a packet at least "headerLength" bytes
+ *     long, or 0 if it isn't IP. Raw IP captures have no EtherType, so it is
+ *     made up from the IP version.
+ *   sourceMAC() and destinationMAC(): the packet's hardware addresses, or
+ *     all zeros where the link layer doesn't carry them.
+ */
+template <int linkType>
+struct LinkLayer;
+
+/* Addresses handed out for packets whose link layer doesn't carry them. */
+static const u_char noMAC[ETHER_ADDR_LEN] = { 0, 0, 0, 0, 0, 0 };
+
+template <>
+struct LinkLayer <DLT_EN10MB> {
+  static const size_t headerLength = 14;
+  static const bool tagged = true;
+  static inline uint16_t etherType(const u_char *packet) {
+    return (packet[12] << 8) | packet[13];
+  }
+  static inline const u_char *sourceMAC(const u_char *packet) {
+    return packet + ETHER_ADDR_LEN;
+  }
+  static inline const u_char *destinationMAC(const u_char *packet) {
+    return packet;
+  }
+};
+
+/*
+ * Linux "cooked" captures, which are what capturing on the "any" device
+ * produces. The header carries the sender's hardware address but not the
+ * receiver's. libpcap puts VLAN tags that the kernel stripped back in after
+ * the header.
+ */
+template <>
+struct LinkLayer <DLT_LINUX_SLL> {
+  static const size_t headerLength = 16;
+  static const bool tagged = true;
+  static inline uint16_t etherType(const u_char *packet) {
+    return (packet[14] << 8) | packet[15];
+  }
+  static inline const u_char *sourceMAC(const u_char *packet) {
+    return (packet[5] == ETHER_ADDR_LEN) ? packet + 6 : noMAC;
+  }
+  static inline const u_char *destinationMAC(const u_char*) {
+    return noMAC;
+  }
+};
+
+/*
+ * Raw IP, as captured on tunnels and other point-to-point links. DLT_IPV4
+ * and DLT_IPV6 captures are decoded as this too.
+ */
+template <>
+struct LinkLayer <DLT_RAW> {
+  static const size_t headerLength = 0;
+  static const bool tagged = false;
+  static inline uint16_t etherType(const u_char *packet) {
+    switch (packet[0] >> 4) {
+      case 4:
+        return ETHERTYPE_IP;
+      case 6:
+        return ETHERTYPE_IPV6;
+    }
+    return 0;
+  }
+  static inline const u_char *sourceMAC(const u_char*) {
+    return noMAC;
+  }
+  static inline const u_char *destinationMAC(const u_char*) {
+    return noMAC;
+  }
+};
+
+#endif
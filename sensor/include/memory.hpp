@@ -22,50 +22,197 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #ifndef MEMORY_HPP
 #define MEMORY_HPP
 
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <string>
 
-#include <stack>
-#include <tr1/memory>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
+/*
+ * A pool of T-sized blocks, carved out of slabs of about 2 MiB each. Free
+ * blocks are kept on a lock-free stack of block numbers whose head carries a
+ * generation tag alongside the top block number, so that a single 64-bit
+ * compare-and-swap is enough to pop or push a block without ABA problems.
+ * Allocated blocks are handed out as Pointers, which keep their reference
+ * counts in arrays alongside the slabs rather than in separately-allocated
+ * control blocks, so allocate() never touches the heap.
+ *
+ * By default, all blocks are allocated by initialize(), and allocate() fails
+ * once they run out. Given a memory limit, the pool instead starts with the
+ * requested number of blocks and adds slabs as they are needed, until the
+ * limit is reached. Slabs can be backed by huge pages, and, with the TRIM
+ * flag, trim() hands the pages of slabs with no blocks in use back to the
+ * kernel.
+ */
 template <class T>
 class Memory {
   public:
+    enum Flags { HUGE_PAGES = 1, TRIM = 2 };
+    class Pointer {
+      public:
+        Pointer();
+        Pointer(const Pointer &pointer);
+        Pointer &operator=(const Pointer &pointer);
+        T *get() const;
+        T &operator*() const;
+        T *operator->() const;
+        bool operator==(const Pointer &pointer) const;
+        bool operator!=(const Pointer &pointer) const;
+        ~Pointer();
+      private:
+        friend class Memory <T>;
+        Pointer(Memory <T> *memory, T *address, const uint32_t blockNumber);
+        void release();
+        Memory <T> *memory;
+        T *address;
+        uint32_t blockNumber;
+    };
     Memory();
     Memory(const size_t numBlocks);
     Memory(const size_t numBlocks, const size_t size);
     bool initialize(const size_t numBlocks);
     bool initialize(const size_t numBlocks, const size_t size);
+    bool initialize(const size_t numBlocks, const size_t size,
+                    const size_t limit, const int flags);
     operator bool() const;
     const std::string &error() const;
-    std::tr1::shared_ptr <T> allocate();
-    const size_t &size() const;
-    const size_t &capacity() const;
+    Pointer allocate();
+    void trim();
+    size_t size() const;
+    size_t capacity() const;
+    size_t maximum() const;
+    size_t highWaterMark() const;
+    uint64_t failures() const;
     ~Memory();
   private:
-    pthread_mutex_t mutex;
+    static const uint32_t empty = 0xffffffff;
+    static const uint32_t trimming = 0x80000000;
+    static const size_t slabSize = 2097152;
+    struct Slab {
+      T *blocks;
+      size_t length;
+      volatile uint32_t *references;
+      volatile uint32_t *next;
+      /* Blocks in use, or'd with "trimming" while trim() is at work. */
+      volatile uint32_t inUse;
+      volatile bool trimmed;
+    };
     bool _error;
     std::string errorMessage;
-    size_t _size;
-    size_t _capacity;
-    T *beginning;
-    T *end;
-    std::stack <T*> blocks;
+    volatile size_t _size;
+    volatile size_t _capacity;
+    size_t _maximum;
+    volatile size_t _highWaterMark;
+    volatile uint64_t _failures;
+    size_t blockSize;
+    int flags;
+    /* Blocks per slab, which is a power of two. */
+    size_t slabBlocks;
+    size_t slabShift;
+    Slab *slabs;
+    size_t maxSlabs;
+    volatile size_t numSlabs;
+    pthread_mutex_t growLock;
+    /* Generation tag in the upper 32 bits, top block number in the lower. */
+    volatile uint64_t head;
     bool initialized;
-    bool free(T*);
-    class Deallocator {
-      public:
-        Deallocator(Memory &memory);
-        void operator ()(T *address);
-      private:
-        Memory <T> &memory;
-   };
+    Slab &slab(const uint32_t blockNumber) const;
+    uint32_t offset(const uint32_t blockNumber) const;
+    bool grow();
+    void push(const uint32_t first, const uint32_t last);
+    void free(T *address, const uint32_t blockNumber);
 };
 
+template <class T>
+Memory <T>::Pointer::Pointer() {
+  memory = NULL;
+  address = NULL;
+  blockNumber = 0;
+}
+
+template <class T>
+Memory <T>::Pointer::Pointer(Memory <T> *_memory, T *_address,
+                             const uint32_t _blockNumber) {
+  memory = _memory;
+  address = _address;
+  blockNumber = _blockNumber;
+}
+
+template <class T>
+Memory <T>::Pointer::Pointer(const Pointer &pointer) {
+  memory = pointer.memory;
+  address = pointer.address;
+  blockNumber = pointer.blockNumber;
+  if (address != NULL) {
+    __sync_add_and_fetch(&(memory -> slab(blockNumber).references
+                             [memory -> offset(blockNumber)]), 1);
+  }
+}
+
+template <class T>
+typename Memory <T>::Pointer &Memory <T>::Pointer::operator=
+  (const Pointer &pointer) {
+  if (pointer.address != NULL) {
+    Memory <T> &_memory = *(pointer.memory);
+    __sync_add_and_fetch(&(_memory.slab(pointer.blockNumber).references
+                             [_memory.offset(pointer.blockNumber)]), 1);
+  }
+  release();
+  memory = pointer.memory;
+  address = pointer.address;
+  blockNumber = pointer.blockNumber;
+  return *this;
+}
+
+template <class T>
+T *Memory <T>::Pointer::get() const {
+  return address;
+}
+
+template <class T>
+T &Memory <T>::Pointer::operator*() const {
+  return *address;
+}
+
+template <class T>
+T *Memory <T>::Pointer::operator->() const {
+  return address;
+}
+
+template <class T>
+bool Memory <T>::Pointer::operator==(const Pointer &pointer) const {
+  return (address == pointer.address);
+}
+
+template <class T>
+bool Memory <T>::Pointer::operator!=(const Pointer &pointer) const {
+  return (address != pointer.address);
+}
+
+template <class T>
+void Memory <T>::Pointer::release() {
+  if (address != NULL &&
+      __sync_sub_and_fetch(&(memory -> slab(blockNumber).references
+                               [memory -> offset(blockNumber)]), 1) == 0) {
+    memory -> free(address, blockNumber);
+  }
+}
+
+template <class T>
+Memory <T>::Pointer::~Pointer() {
+  release();
+}
+
 template <class T>
 Memory <T>::Memory() {
   _error = true;
@@ -87,34 +234,77 @@ Memory <T>::Memory(const size_t numBlocks, const size_t size) {
 
 template <class T>
 bool Memory <T>::initialize(const size_t numBlocks) {
-  return initialize(numBlocks, 1);
+  return initialize(numBlocks, 1, 0, 0);
 }
 
 template <class T>
 bool Memory <T>::initialize(const size_t numBlocks, const size_t size) {
+  return initialize(numBlocks, size, 0, 0);
+}
+
+/*
+ * A limit of 0 allocates exactly "numBlocks" blocks up front. Otherwise,
+ * "numBlocks" blocks are allocated up front, and more are added as needed
+ * until the pool takes up "limit" bytes.
+ */
+template <class T>
+bool Memory <T>::initialize(const size_t numBlocks, const size_t size,
+                            const size_t limit, const int _flags) {
   int error;
+  size_t numBlocksNeeded;
   if (initialized == false) {
-    error = pthread_mutex_init(&mutex, NULL);
+    _size = 0;
+    _capacity = 0;
+    _highWaterMark = 0;
+    _failures = 0;
+    blockSize = size;
+    flags = _flags;
+    slabBlocks = 1;
+    slabShift = 0;
+    while ((slabBlocks * 2) * sizeof(T) * blockSize <= slabSize) {
+      slabBlocks *= 2;
+      ++slabShift;
+    }
+    if (limit == 0) {
+      _maximum = numBlocks;
+    }
+    else {
+      _maximum = limit / (sizeof(T) * blockSize) / slabBlocks * slabBlocks;
+      if (_maximum < numBlocks) {
+        _error = true;
+        errorMessage = "Memory::initialize(): memory limit is too small";
+        return false;
+      }
+    }
+    if (_maximum >= empty) {
+      _maximum = (empty - 1) / slabBlocks * slabBlocks;
+    }
+    maxSlabs = (_maximum + slabBlocks - 1) / slabBlocks;
+    error = pthread_mutex_init(&growLock, NULL);
     if (error != 0) {
       _error = true;
       errorMessage = "Memory::initialize(): pthread_mutex_init(): ";
-      errorMessage +=  strerror(error);
+      errorMessage += strerror(error);
       return false;
     }
-    _size = 0;
-    _capacity = numBlocks;
-    beginning = (T*)malloc(sizeof(T) * numBlocks * size);
-    if (beginning == NULL) {
+    slabs = new(std::nothrow) Slab[maxSlabs];
+    if (slabs == NULL) {
       _error = true;
       errorMessage = "Memory::initialize(): malloc(): ";
       errorMessage += strerror(errno);
+      pthread_mutex_destroy(&growLock);
       return false;
     }
-    end = beginning + (numBlocks * size);
-    for (size_t blockNumber = 0; blockNumber < numBlocks; ++blockNumber) {
-      blocks.push(&(beginning[blockNumber * size]));
-    }
+    numSlabs = 0;
+    head = empty;
     initialized = true;
+    numBlocksNeeded = (numBlocks + slabBlocks - 1) / slabBlocks;
+    while (numSlabs < numBlocksNeeded) {
+      if (!grow()) {
+        _error = true;
+        return false;
+      }
+    }
     _error = false;
     return true;
   }
@@ -132,58 +322,225 @@ const std::string &Memory <T>::error() const {
 }
 
 template <class T>
-std::tr1::shared_ptr <T> Memory <T>::allocate() {
-  T *temp;
-  if (initialized == true && blocks.size() > 0) {
-    pthread_mutex_lock(&mutex);
-    temp = blocks.top();
-    blocks.pop();
-    ++_size;
-    pthread_mutex_unlock(&mutex);
-    return std::tr1::shared_ptr <T>(new(temp) T, Deallocator(*this));
+typename Memory <T>::Slab &Memory <T>::slab(const uint32_t blockNumber) const {
+  return slabs[blockNumber >> slabShift];
+}
+
+template <class T>
+uint32_t Memory <T>::offset(const uint32_t blockNumber) const {
+  return blockNumber & (slabBlocks - 1);
+}
+
+/*
+ * Maps and initializes the next slab, and pushes its blocks. Failing to grow
+ * the pool after initialize() is not an error in the class, so this only sets
+ * errorMessage.
+ */
+template <class T>
+bool Memory <T>::grow() {
+  Slab &_slab = slabs[numSlabs];
+  size_t numBlocks = _maximum - numSlabs * slabBlocks;
+  size_t pageSize;
+  void *address = MAP_FAILED;
+  if (numBlocks > slabBlocks) {
+    numBlocks = slabBlocks;
+  }
+  pageSize = getpagesize();
+  _slab.length = (numBlocks * sizeof(T) * blockSize + pageSize - 1) /
+                 pageSize * pageSize;
+  #ifdef MAP_HUGETLB
+  if (flags & HUGE_PAGES) {
+    address = mmap(NULL, (_slab.length + slabSize - 1) / slabSize * slabSize,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+    if (address != MAP_FAILED) {
+      _slab.length = (_slab.length + slabSize - 1) / slabSize * slabSize;
+    }
+  }
+  #endif
+  /*
+   * Without reserved huge pages, fall back to normal pages, and ask for
+   * transparent huge pages instead.
+   */
+  if (address == MAP_FAILED) {
+    address = mmap(NULL, _slab.length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (address == MAP_FAILED) {
+      errorMessage = "Memory::grow(): mmap(): ";
+      errorMessage += strerror(errno);
+      return false;
+    }
+    #ifdef MADV_HUGEPAGE
+    if (flags & HUGE_PAGES) {
+      madvise(address, _slab.length, MADV_HUGEPAGE);
+    }
+    #endif
+  }
+  _slab.blocks = (T*)address;
+  _slab.references = (uint32_t*)malloc(sizeof(uint32_t) * numBlocks);
+  _slab.next = (uint32_t*)malloc(sizeof(uint32_t) * numBlocks);
+  if (_slab.references == NULL || _slab.next == NULL) {
+    errorMessage = "Memory::grow(): malloc(): ";
+    errorMessage += strerror(errno);
+    munmap(address, _slab.length);
+    ::free((void*)_slab.references);
+    ::free((void*)_slab.next);
+    return false;
   }
-  return std::tr1::shared_ptr <T>();
+  for (size_t blockNumber = 0; blockNumber < numBlocks; ++blockNumber) {
+    _slab.references[blockNumber] = 0;
+    _slab.next[blockNumber] = numSlabs * slabBlocks + blockNumber + 1;
+  }
+  _slab.inUse = 0;
+  _slab.trimmed = false;
+  /* Make the slab visible to free() before any of its blocks are handed out. */
+  __sync_synchronize();
+  ++numSlabs;
+  __sync_add_and_fetch(&_capacity, numBlocks);
+  push((numSlabs - 1) * slabBlocks,
+       (numSlabs - 1) * slabBlocks + numBlocks - 1);
+  return true;
+}
+
+/* Pushes a chain of blocks, linked through their "next" entries. */
+template <class T>
+void Memory <T>::push(const uint32_t first, const uint32_t last) {
+  uint64_t top;
+  do {
+    top = head;
+    slab(last).next[offset(last)] = top & 0xffffffff;
+  } while (!__sync_bool_compare_and_swap(&head, top,
+                                         ((top >> 32) + 1) << 32 | first));
 }
 
 template <class T>
-bool Memory <T>::free(T *address) {
+typename Memory <T>::Pointer Memory <T>::allocate() {
+  uint64_t top, newTop;
+  uint32_t blockNumber;
+  size_t size, highWaterMark, _numSlabs;
+  bool grown;
   if (initialized == true) {
-    address -> ~T();
-    pthread_mutex_lock(&mutex);
-    blocks.push(address);
-    --_size;
-    pthread_mutex_unlock(&mutex);
-    return true;
+    /*
+     * Reading the next link of a block another thread has just popped is
+     * harmless: the tag will have changed, so the swap below will fail.
+     */
+    while (true) {
+      top = head;
+      blockNumber = top & 0xffffffff;
+      if (blockNumber == empty) {
+        /*
+         * Add a slab, unless another thread has done so since we saw the free
+         * list empty, in which case just try again.
+         */
+        _numSlabs = numSlabs;
+        if (_numSlabs == maxSlabs) {
+          __sync_add_and_fetch(&_failures, 1);
+          return Pointer();
+        }
+        pthread_mutex_lock(&growLock);
+        grown = (numSlabs != _numSlabs || grow());
+        pthread_mutex_unlock(&growLock);
+        if (!grown) {
+          __sync_add_and_fetch(&_failures, 1);
+          return Pointer();
+        }
+        continue;
+      }
+      newTop = ((top >> 32) + 1) << 32 |
+               slab(blockNumber).next[offset(blockNumber)];
+      if (__sync_bool_compare_and_swap(&head, top, newTop)) {
+        break;
+      }
+    }
+    Slab &_slab = slab(blockNumber);
+    /* Don't touch a block while trim() may be discarding its pages. */
+    __sync_add_and_fetch(&(_slab.inUse), 1);
+    while (_slab.inUse & trimming) {
+      sched_yield();
+    }
+    if (_slab.trimmed) {
+      _slab.trimmed = false;
+    }
+    size = __sync_add_and_fetch(&_size, 1);
+    highWaterMark = _highWaterMark;
+    while (size > highWaterMark &&
+           !__sync_bool_compare_and_swap(&_highWaterMark, highWaterMark,
+                                         size)) {
+      highWaterMark = _highWaterMark;
+    }
+    _slab.references[offset(blockNumber)] = 1;
+    return Pointer(this,
+                   new(&(_slab.blocks[offset(blockNumber) * blockSize])) T,
+                   blockNumber);
   }
-  return false;
+  __sync_add_and_fetch(&_failures, 1);
+  return Pointer();
+}
+
+/*
+ * Discards the pages of slabs that have no blocks in use. Their blocks stay
+ * on the free list, and the kernel hands back zeroed pages when they are next
+ * allocated.
+ */
+template <class T>
+void Memory <T>::trim() {
+  if (initialized == false || !(flags & TRIM)) {
+    return;
+  }
+  for (size_t i = 0; i < numSlabs; ++i) {
+    if (!slabs[i].trimmed &&
+        __sync_bool_compare_and_swap(&(slabs[i].inUse), 0, trimming)) {
+      madvise(slabs[i].blocks, slabs[i].length, MADV_DONTNEED);
+      slabs[i].trimmed = true;
+      __sync_fetch_and_and(&(slabs[i].inUse), ~trimming);
+    }
+  }
+}
+
+template <class T>
+void Memory <T>::free(T *address, const uint32_t blockNumber) {
+  address -> ~T();
+  __sync_sub_and_fetch(&(slab(blockNumber).inUse), 1);
+  __sync_sub_and_fetch(&_size, 1);
+  push(blockNumber, blockNumber);
 }
 
 template <class T>
-const size_t &Memory <T>::size() const {
+size_t Memory <T>::size() const {
   return _size;
 }
 
 template <class T>
-const size_t &Memory <T>::capacity() const {
+size_t Memory <T>::capacity() const {
   return _capacity;
 }
 
 template <class T>
-Memory <T>::~Memory() {
-  if (initialized == true) {
-    pthread_mutex_destroy(&mutex);
-    free(beginning);
-  }
+size_t Memory <T>::maximum() const {
+  return _maximum;
 }
 
 template <class T>
-Memory <T>::Deallocator::Deallocator(Memory &_memory)
-  : memory(_memory)
-{}
+size_t Memory <T>::highWaterMark() const {
+  return _highWaterMark;
+}
 
 template <class T>
-void Memory <T>::Deallocator::operator ()(T *address) {
-  memory.free(address);
+uint64_t Memory <T>::failures() const {
+  return _failures;
+}
+
+template <class T>
+Memory <T>::~Memory() {
+  if (initialized == true) {
+    for (size_t i = 0; i < numSlabs; ++i) {
+      munmap(slabs[i].blocks, slabs[i].length);
+      ::free((void*)slabs[i].references);
+      ::free((void*)slabs[i].next);
+    }
+    delete[] slabs;
+    pthread_mutex_destroy(&growLock);
+  }
 }
 
 #endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+
+#include "metrics.h"
+
+/* Quotes a label's value as the exposition format requires. */
+std::string label(const std::string &name, const std::string &value) {
+  std::string _label = name + "=\"";
+  for (size_t i = 0; i < value.length(); ++i) {
+    switch (value[i]) {
+      case '\\':
+        _label += "\\\\";
+        break;
+      case '"':
+        _label += "\\\"";
+        break;
+      case '\n':
+        _label += "\\n";
+        break;
+      default:
+        _label += value[i];
+    }
+  }
+  return _label + '"';
+}
+
+static void appendName(std::string &text, const std::string &name,
+                       const std::string &labels) {
+  text += name;
+  if (!labels.empty()) {
+    text += '{';
+    text += labels;
+    text += '}';
+  }
+  text += ' ';
+}
+
+void appendMetric(std::string &text, const std::string &name,
+                  const std::string &labels, const uint64_t value) {
+  char number[24];
+  appendName(text, name, labels);
+  snprintf(number, sizeof(number), "%llu", (unsigned long long)value);
+  text += number;
+  text += '\n';
+}
+
+void appendMetric(std::string &text, const std::string &name,
+                  const std::string &labels, const double value) {
+  char number[32];
+  appendName(text, name, labels);
+  snprintf(number, sizeof(number), "%.9g", value);
+  text += number;
+  text += '\n';
+}
+
+void appendSummary(std::string &text, const std::string &name,
+                   const std::string &labels, const Histogram &histogram,
+                   const double scale) {
+  static const char *quantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+  static const double percentiles[] = { 50, 90, 99, 99.9 };
+  std::string _labels = labels.empty() ? labels : labels + ',';
+  for (size_t i = 0; i < sizeof(percentiles) / sizeof(double); ++i) {
+    appendMetric(text, name, _labels + label("quantile", quantiles[i]),
+                 histogram.percentile(percentiles[i]) * scale);
+  }
+  appendMetric(text, name + "_sum", labels, histogram.sum() * scale);
+  appendMetric(text, name + "_count", labels, histogram.count());
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include <include/histogram.h>
+#include <include/memory.hpp>
+
+/*
+ * Helpers for writing samples in Prometheus' text exposition format, one
+ * "name{labels} value" line each. "labels" is a comma-separated list of
+ * label="value" pairs, as made by label(), and may be empty.
+ */
+std::string label(const std::string &name, const std::string &value);
+void appendMetric(std::string &text, const std::string &name,
+                  const std::string &labels, const uint64_t value);
+void appendMetric(std::string &text, const std::string &name,
+                  const std::string &labels, const double value);
+/*
+ * Writes a histogram as a summary, with its values multiplied by "scale" to
+ * convert them to the metric's unit.
+ */
+void appendSummary(std::string &text, const std::string &name,
+                   const std::string &labels, const Histogram &histogram,
+                   const double scale);
+
+/*
+ * Writes how much of a Memory pool is in use. Every count that the pool
+ * keeps is updated atomically, so this may be called from any thread.
+ */
+template <class T>
+void appendMemory(std::string &text, const std::string &labels,
+                  const Memory <T> &memory) {
+  appendMetric(text, "sensor_memory_blocks_used", labels,
+               (uint64_t)memory.size());
+  appendMetric(text, "sensor_memory_blocks_allocated", labels,
+               (uint64_t)memory.capacity());
+  appendMetric(text, "sensor_memory_blocks_maximum", labels,
+               (uint64_t)memory.maximum());
+  appendMetric(text, "sensor_memory_blocks_high_water_mark", labels,
+               (uint64_t)memory.highWaterMark());
+  appendMetric(text, "sensor_memory_allocation_failures", labels,
+               memory.failures());
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "metricsServer.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+MetricsServer::MetricsServer() {
+  _error = true;
+  errorMessage = "MetricsServer::MetricsServer(): class not initialized";
+  listener = -1;
+  exporter = NULL;
+  running = false;
+  stopping = false;
+}
+
+/*
+ * Opens the listening socket, so that problems with the address show up
+ * before the sensor daemonizes. start() starts serving it.
+ */
+bool MetricsServer::initialize(const std::string &address,
+                               Exporter exporter) {
+  this -> exporter = exporter;
+  if (!listen(address)) {
+    _error = true;
+    return false;
+  }
+  if (fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK) == -1) {
+    _error = true;
+    errorMessage = "MetricsServer::initialize(): fcntl(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  _error = false;
+  return true;
+}
+
+MetricsServer::operator bool() const {
+  return !_error;
+}
+
+const std::string &MetricsServer::error() const {
+  return errorMessage;
+}
+
+bool MetricsServer::start() {
+  int error;
+  if (_error == true || running == true) {
+    return false;
+  }
+  stopping = false;
+  error = pthread_create(&thread, NULL, &serve, this);
+  if (error != 0) {
+    _error = true;
+    errorMessage = "MetricsServer::start(): pthread_create(): ";
+    errorMessage += strerror(error);
+    return false;
+  }
+  running = true;
+  return true;
+}
+
+/* Waits for the server thread to notice, within a second, and exit. */
+void MetricsServer::stop() {
+  if (running == true) {
+    stopping = true;
+    pthread_join(thread, NULL);
+    running = false;
+  }
+}
+
+MetricsServer::~MetricsServer() {
+  stop();
+  if (listener != -1) {
+    close(listener);
+    if (!path.empty()) {
+      unlink(path.c_str());
+    }
+  }
+}
+
+bool MetricsServer::listen(const std::string &address) {
+  std::string host, port;
+  sockaddr_un unixAddress;
+  addrinfo hints, *addresses, *_address;
+  char cwd[MAXPATHLEN];
+  struct stat _stat;
+  size_t colon;
+  int error, on = 1;
+  if (address.compare(0, 5, "unix:") == 0) {
+    path = address.substr(5);
+    /* The sensor changes to "/" after this, so remember where it was. */
+    if (!path.empty() && path[0] != '/') {
+      if (getcwd(cwd, MAXPATHLEN) == NULL) {
+        errorMessage = "MetricsServer::initialize(): getcwd(): ";
+        errorMessage += strerror(errno);
+        return false;
+      }
+      path = std::string(cwd) + '/' + path;
+    }
+    if (path.empty() || path.length() >= sizeof(unixAddress.sun_path)) {
+      errorMessage = "MetricsServer::initialize(): " + address +
+                     ": invalid path";
+      path.clear();
+      return false;
+    }
+    memset(&unixAddress, 0, sizeof(unixAddress));
+    unixAddress.sun_family = AF_UNIX;
+    strcpy(unixAddress.sun_path, path.c_str());
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1) {
+      errorMessage = "MetricsServer::initialize(): socket(): ";
+      errorMessage += strerror(errno);
+      path.clear();
+      return false;
+    }
+    /* Remove a socket left behind by an earlier run, but nothing else. */
+    if (lstat(path.c_str(), &_stat) == 0 && S_ISSOCK(_stat.st_mode)) {
+      unlink(path.c_str());
+    }
+    if (bind(listener, (sockaddr*)&unixAddress, sizeof(unixAddress)) == -1 ||
+        ::listen(listener, maxClients) == -1) {
+      errorMessage = "MetricsServer::initialize(): bind(): " + path + ": " +
+                     strerror(errno);
+      close(listener);
+      listener = -1;
+      path.clear();
+      return false;
+    }
+    return true;
+  }
+  colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    port = address;
+  }
+  else {
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    /* IPv6 addresses are written in brackets, as in URLs. */
+    if (host.length() >= 2 && host[0] == '[' &&
+        host[host.length() - 1] == ']') {
+      host = host.substr(1, host.length() - 2);
+    }
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  error = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(),
+                      &hints, &addresses);
+  if (error != 0) {
+    errorMessage = "MetricsServer::initialize(): getaddrinfo(): " + address +
+                   ": " + gai_strerror(error);
+    return false;
+  }
+  errorMessage = "MetricsServer::initialize(): " + address +
+                 ": no usable address";
+  for (_address = addresses; _address != NULL;
+       _address = _address -> ai_next) {
+    listener = socket(_address -> ai_family, _address -> ai_socktype,
+                      _address -> ai_protocol);
+    if (listener == -1) {
+      errorMessage = "MetricsServer::initialize(): socket(): ";
+      errorMessage += strerror(errno);
+      continue;
+    }
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(listener, _address -> ai_addr, _address -> ai_addrlen) == 0 &&
+        ::listen(listener, maxClients) == 0) {
+      break;
+    }
+    errorMessage = "MetricsServer::initialize(): bind(): " + address + ": " +
+                   strerror(errno);
+    close(listener);
+    listener = -1;
+  }
+  freeaddrinfo(addresses);
+  return (listener != -1);
+}
+
+void *MetricsServer::serve(void *server) {
+  ((MetricsServer*)server) -> _serve();
+  return NULL;
+}
+
+void MetricsServer::_serve() {
+  std::vector <pollfd> descriptors;
+  bool keep;
+  time_t now;
+  while (stopping == false) {
+    descriptors.resize(clients.size() + 1);
+    descriptors[0].fd = listener;
+    descriptors[0].events = (clients.size() < maxClients) ? POLLIN : 0;
+    descriptors[0].revents = 0;
+    for (size_t i = 0; i < clients.size(); ++i) {
+      descriptors[i + 1].fd = clients[i].descriptor;
+      descriptors[i + 1].events = (clients[i].responding) ? POLLOUT : POLLIN;
+      descriptors[i + 1].revents = 0;
+    }
+    /* Wake up every second to check whether to stop. */
+    if (poll(&descriptors[0], descriptors.size(), 1000) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    now = time(NULL);
+    for (size_t i = clients.size(); i > 0; --i) {
+      Client &client = clients[i - 1];
+      keep = true;
+      if (descriptors[i].revents != 0) {
+        keep = (client.responding) ? write(client) : read(client);
+      }
+      if (keep == false || now - client.since >= timeout) {
+        close(client.descriptor);
+        clients.erase(clients.begin() + (i - 1));
+      }
+    }
+    if (descriptors[0].revents & POLLIN) {
+      accept();
+    }
+  }
+  for (size_t i = 0; i < clients.size(); ++i) {
+    close(clients[i].descriptor);
+  }
+  clients.clear();
+}
+
+void MetricsServer::accept() {
+  Client client;
+  int descriptor;
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+#endif
+  while (clients.size() < maxClients &&
+         (descriptor = ::accept(listener, NULL, NULL)) != -1) {
+    if (fcntl(descriptor, F_SETFL,
+              fcntl(descriptor, F_GETFL) | O_NONBLOCK) == -1) {
+      close(descriptor);
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    setsockopt(descriptor, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    client.descriptor = descriptor;
+    client.sent = 0;
+    client.responding = false;
+    client.since = time(NULL);
+    clients.push_back(client);
+  }
+}
+
+/*
+ * Reads as much of a request as has arrived. Once it has all arrived, the
+ * exporter is called and the response is sent. Returns false if the client
+ * should be disconnected.
+ */
+bool MetricsServer::read(Client &client) {
+  char buffer[1024];
+  std::string body;
+  ssize_t length;
+  while (true) {
+    length = recv(client.descriptor, buffer, sizeof(buffer), 0);
+    if (length > 0) {
+      client.buffer.append(buffer, length);
+      if (client.buffer.length() > maxRequest) {
+        return false;
+      }
+      continue;
+    }
+    if (length == -1 && errno == EINTR) {
+      continue;
+    }
+    if (length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    return false;
+  }
+  if (client.buffer.find("\r\n\r\n") == std::string::npos &&
+      client.buffer.find("\n\n") == std::string::npos) {
+    return true;
+  }
+  if (client.buffer.compare(0, 4, "GET ") == 0) {
+    exporter(body);
+    client.buffer = "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n";
+  }
+  else {
+    body = "Method not allowed\n";
+    client.buffer = "HTTP/1.0 405 Method Not Allowed\r\n"
+                    "Allow: GET\r\n"
+                    "Content-Type: text/plain\r\n";
+  }
+  snprintf(buffer, sizeof(buffer), "Content-Length: %lu\r\n\r\n",
+           (unsigned long)body.length());
+  client.buffer += buffer;
+  client.buffer += body;
+  client.sent = 0;
+  client.responding = true;
+  return write(client);
+}
+
+/*
+ * Sends as much of the response as the socket will take. Returns false once
+ * it has all been sent, or if sending fails.
+ */
+bool MetricsServer::write(Client &client) {
+  ssize_t length;
+  while (client.sent < client.buffer.length()) {
+    length = send(client.descriptor, client.buffer.data() + client.sent,
+                  client.buffer.length() - client.sent, MSG_NOSIGNAL);
+    if (length > 0) {
+      client.sent += length;
+      continue;
+    }
+    if (length == -1 && errno == EINTR) {
+      continue;
+    }
+    return (length == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  return false;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Serves the text that an exporter function writes, in Prometheus' text
+ * exposition format, to anything that connects to a UNIX socket, given as
+ * "unix:<path>", or a TCP socket, given as "[<host>:]<port>", and sends an
+ * HTTP request. The server runs in a thread of its own, with non-blocking
+ * sockets, so a slow or stuck client never holds anything up; the exporter
+ * is called from that thread and must only read counters that other threads
+ * update atomically.
+ */
+class MetricsServer {
+  public:
+    typedef void (*Exporter)(std::string &text);
+    MetricsServer();
+    bool initialize(const std::string &address, Exporter exporter);
+    operator bool() const;
+    const std::string &error() const;
+    bool start();
+    void stop();
+    ~MetricsServer();
+  private:
+    struct Client {
+      int descriptor;
+      std::string buffer;
+      size_t sent;
+      bool responding;
+      time_t since;
+    };
+    static const size_t maxClients = 16;
+    static const size_t maxRequest = 8192;
+    static const time_t timeout = 10;
+    bool _error;
+    std::string errorMessage;
+    int listener;
+    std::string path;
+    Exporter exporter;
+    pthread_t thread;
+    bool running;
+    volatile bool stopping;
+    std::vector <Client> clients;
+    bool listen(const std::string &address);
+    static void *serve(void *server);
+    void _serve();
+    void accept();
+    bool read(Client &client);
+    bool write(Client &client);
+};
+
+#endif
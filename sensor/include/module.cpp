@@ -35,7 +35,6 @@ Module::Module(const std::string &moduleDirectory,
                const std::string &name) {
   char *__callback;
   std::string moduleErrorMessage;
-  pcap_t *pcapDescriptor;
   _name = name;
   _fileName = moduleDirectory + '/' + name + ".so";
   if (!_conf.initialize(configurationDirectory + '/' + name + ".conf")) {
@@ -53,7 +52,11 @@ Module::Module(const std::string &moduleDirectory,
   _initialize = dlsym(_handle, "initialize");
   flush = (flushFunction)dlsym(_handle, "flush");
   finish = (finishFunction)dlsym(_handle, "finish");
+  metrics = (metricsFunction)dlsym(_handle, "metrics");
+  releaseFlow = (releaseFlowFunction)dlsym(_handle, "releaseFlow");
   processPacket = NULL;
+  processPackets = NULL;
+  processStream = NULL;
   _callback = NULL;
   if (_initialize == NULL || flush == NULL || finish == NULL) {
     _error = true;
@@ -64,12 +67,23 @@ Module::Module(const std::string &moduleDirectory,
   if (__callback != NULL) {
     _callback = *(char**)__callback;
   }
-  pcapDescriptor = pcap_open_dead(DLT_EN10MB,
+  _flowSlot = (FlowSlot*)dlsym(_handle, "flowSlot");
+  memset(&_bpfProgram, 0, sizeof(_bpfProgram));
+  _error = false;
+}
+
+/*
+ * Compiles the module's filter for captures of datalink type "linkType",
+ * which the sensor only knows once it has opened its capture source.
+ */
+int Module::compile(const int &linkType) {
+  pcap_t *pcapDescriptor;
+  pcapDescriptor = pcap_open_dead(linkType,
                                   std::numeric_limits <uint16_t>::max());
   if (pcapDescriptor == NULL) {
     _error = true;
-    errorMessage = pcap_geterr(pcapDescriptor);
-    return;
+    errorMessage = _fileName + ": pcap_open_dead() failed";
+    return 1;
   }
   /*
    * Older versions of libpcap expect the third argument of pcap_compile()
@@ -80,17 +94,28 @@ Module::Module(const std::string &moduleDirectory,
     _error = true;
     errorMessage = _fileName + ": pcap_compile(): " +
                    pcap_geterr(pcapDescriptor);
-    return;
+    pcap_close(pcapDescriptor);
+    return 1;
   }
   pcap_close(pcapDescriptor);
-  _error = false;
+  return 0;
 }
 
-int Module::initialize(Logger &logger) {
+int Module::initialize(Logger &logger, const Clock &clock,
+                       PacketPool &pool) {
   initializeFunction _initializeFunction = (initializeFunction)_initialize;
   dependencyInitializeFunction _dependencyInitializeFunction = (dependencyInitializeFunction)_initialize;
   std::string moduleErrorMessage;
+  void *sensorClock, *packetPool;
   int ret;
+  sensorClock = dlsym(_handle, "sensorClock");
+  if (sensorClock != NULL) {
+    *(const Clock**)sensorClock = &clock;
+  }
+  packetPool = dlsym(_handle, "packetPool");
+  if (packetPool != NULL) {
+    *(PacketPool**)packetPool = &pool;
+  }
   if (_callbacks.size() == 0) {
     ret = _initializeFunction(_conf, logger, moduleErrorMessage);
   }
@@ -141,3 +166,7 @@ const char *Module::callback() const {
 std::vector <void*> &Module::callbacks() {
   return _callbacks;
 }
+
+FlowSlot *Module::flowSlot() const {
+  return _flowSlot;
+}
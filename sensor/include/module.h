@@ -28,11 +28,51 @@
 #include <string>
 #include <vector>
 
+#include <include/clock.h>
 #include <include/configuration.h>
+#include <include/flowTable.h>
 #include <include/logger.h>
 #include <include/packet.h>
+#include <include/packetPool.h>
 
 typedef int (*processPacketFunction)(const Packet &packet);
+/*
+ * Modules may also export "processPackets", which the sensor will prefer to
+ * "processPacket" and call with several packets at a time.
+ */
+typedef int (*processPacketsFunction)(const Packet *packets, size_t count);
+/*
+ * Modules that parse TCP payloads may export "processStream" instead of, or
+ * as well as, "processPacket". The sensor reassembles the connections whose
+ * packets match the module's filter and calls it with each direction's data
+ * in order, or with "data" set to NULL and "length" set to the size of a hole
+ * in the data that it gave up on; see tcpReassembler.h.
+ */
+typedef int (*processStreamFunction)(const Packet &packet, const u_char *data,
+                                     const size_t &length);
+/*
+ * Modules that keep time should export a "const Clock *sensorClock" variable,
+ * which the sensor will point to its packet-time clock before initializing
+ * them, and use it instead of time().
+ *
+ * Modules that keep per-flow state in the sensor's flow table export a
+ * "FlowSlot flowSlot" variable; see flowTable.h. If that state holds on to
+ * anything, they should also export "releaseFlow", which the worker that owns
+ * a flow calls with the module's part of its state when the flow times out,
+ * is evicted or starts over, before the state is cleared.
+ *
+ * Modules that hold on to packets after processing them should export a
+ * "PacketPool *packetPool" variable, which the sensor will point to its
+ * packet pool before initializing them, and retain packets through it
+ * instead of copying them; see packetPool.h.
+ *
+ * Modules may export "metrics", which the sensor's metrics server calls to
+ * have them append their own samples, such as how full their session tables
+ * are, to the text that it serves; see metrics.h. It is called from the
+ * server's thread while packets are being processed, so it must only read
+ * counts that are updated atomically, and must not lock anything that the
+ * module's other functions hold.
+ */
 
 class Module {
   public:
@@ -45,12 +85,19 @@ class Module {
                                                 std::string &error);
     typedef int (*flushFunction)();
     typedef int (*finishFunction)();
+    typedef int (*metricsFunction)(std::string &text);
+    typedef void (*releaseFlowFunction)(u_char *state);
     Module(const std::string &moduleDirectory,
            const std::string &configurationDirectory, const std::string &name);
-    int initialize(Logger &logger);
+    int compile(const int &linkType);
+    int initialize(Logger &logger, const Clock &clock, PacketPool &pool);
     processPacketFunction processPacket;
+    processPacketsFunction processPackets;
+    processStreamFunction processStream;
     flushFunction flush;
     finishFunction finish;
+    metricsFunction metrics;
+    releaseFlowFunction releaseFlow;
     operator bool() const;
     const std::string &error() const;
     const bpf_program &bpfProgram() const;
@@ -60,6 +107,7 @@ class Module {
     void *handle() const;
     const char *callback() const;
     std::vector <void*> &callbacks();
+    FlowSlot *flowSlot() const;
   private:
     bool _error;
     std::string errorMessage;
@@ -69,6 +117,7 @@ class Module {
     void *_handle;
     char *_callback;
     std::vector <void*> _callbacks;
+    FlowSlot *_flowSlot;
     bpf_program _bpfProgram;
     void *_initialize;
 };
@@ -22,54 +22,202 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstring>
+
+#include <algorithm>
+
+#include "flowTable.h"
+#include "hash.hpp"
+#include "linkLayer.hpp"
 #include "packet.h"
 
-bool Packet::initialize(const pcap_pkthdr &pcapHeader, const u_char *pcapPacket) {
-  /* Copy timestamp to our more-portable format. */
-  _time = pcapHeader.ts;
-  _capturedSize = pcapHeader.caplen;
-  _packet = pcapPacket;
-  /* Determine if the packet is fragmented. */
-  if ((ntohs(((ip*)(_packet + sizeof(ether_header))) -> ip_off) & IP_MF) != 0 ||
-      (ntohs(((ip*)(_packet + sizeof(ether_header))) -> ip_off) & IP_OFFMASK) != 0) {
-    _fragmented = true;
+/* More IPv6 extension headers than this and the packet is rejected. */
+static const size_t maxExtensionHeaders = 8;
+
+static inline uint16_t load16(const u_char *data) {
+  return (data[0] << 8) | data[1];
+}
+
+/*
+ * Decodes everything after the link-layer header, which is "offset" bytes
+ * long and gave the packet's EtherType. It is inlined into each
+ * instantiation of initialize() below, which passes it constants for the
+ * link layer.
+ */
+inline bool Packet::decode(const pcap_pkthdr &pcapHeader, size_t offset,
+                           uint16_t etherType, bool tagged) {
+  const u_char *header;
+  size_t end, headerLength;
+  uint16_t fragmentOffset;
+  uint8_t nextHeader;
+  _vlan = 0;
+  _sourcePort = 0;
+  _destinationPort = 0;
+  _sequenceNumber = 0;
+  _tcpFlags = 0;
+  _icmpType = 0;
+  _icmpCode = 0;
+  /* Look through VLAN tags, remembering the innermost VLAN ID. */
+  for (size_t i = 0; tagged == true && (etherType == ETHERTYPE_VLAN ||
+                                        etherType == ETHERTYPE_QINQ ||
+                                        etherType == ETHERTYPE_QINQ_OLD); ++i) {
+    if (i == maxVLANTags || pcapHeader.caplen < offset + 4) {
+      return false;
+    }
+    _vlan = load16(_packet + offset) & 0x0fff;
+    etherType = load16(_packet + offset + 2);
+    offset += 4;
   }
-  else {
-    _fragmented = false;
+  _networkOffset = offset;
+  header = _packet + offset;
+  switch (etherType) {
+    case ETHERTYPE_IP:
+      if (pcapHeader.caplen < offset + sizeof(ip)) {
+        return false;
+      }
+      headerLength = (header[0] & 0x0f) << 2;
+      if ((header[0] >> 4) != 4 || headerLength < sizeof(ip) ||
+          pcapHeader.caplen < offset + headerLength) {
+        return false;
+      }
+      _version = 4;
+      _tos = header[1];
+      end = offset + load16(header + 2);
+      fragmentOffset = load16(header + 6);
+      _fragmented = ((fragmentOffset & (IP_MF | IP_OFFMASK)) != 0);
+      _ttl = header[8];
+      _protocol = header[9];
+      memcpy(&_sourceIP, header + 12, sizeof(_sourceIP));
+      memcpy(&_destinationIP, header + 16, sizeof(_destinationIP));
+      offset += headerLength;
+      break;
+    case ETHERTYPE_IPV6:
+      if (pcapHeader.caplen < offset + 40 || (header[0] >> 4) != 6) {
+        return false;
+      }
+      _version = 6;
+      _tos = (header[0] << 4) | (header[1] >> 4);
+      end = offset + 40 + load16(header + 4);
+      _fragmented = false;
+      _ttl = header[7];
+      _sourceIP = 0;
+      _destinationIP = 0;
+      nextHeader = header[6];
+      offset += 40;
+      /*
+       * Walk the extension headers to the upper-layer header. ESP, and
+       * anything else unknown, ends the walk and is left as the protocol.
+       */
+      for (size_t i = 0; ; ++i) {
+        if (nextHeader != IPPROTO_HOPOPTS && nextHeader != IPPROTO_ROUTING &&
+            nextHeader != IPPROTO_DSTOPTS && nextHeader != IPPROTO_FRAGMENT &&
+            nextHeader != IPPROTO_AH) {
+          break;
+        }
+        if (i == maxExtensionHeaders || pcapHeader.caplen < offset + 8) {
+          return false;
+        }
+        header = _packet + offset;
+        switch (nextHeader) {
+          case IPPROTO_FRAGMENT:
+            fragmentOffset = load16(header + 2);
+            _fragmented = ((fragmentOffset & 0xfff9) != 0);
+            headerLength = 8;
+            break;
+          case IPPROTO_AH:
+            headerLength = (header[1] + 2) << 2;
+            break;
+          default:
+            headerLength = (header[1] + 1) << 3;
+            break;
+        }
+        nextHeader = header[0];
+        offset += headerLength;
+      }
+      if (pcapHeader.caplen < offset) {
+        return false;
+      }
+      _protocol = nextHeader;
+      break;
+    default:
+      return false;
   }
-  /* Determine payload size and offset into the packet. */
+  _transportOffset = offset;
+  header = _packet + offset;
+  /* Only the first fragment has the transport header, so look at none. */
   if (_fragmented == false) {
-    switch (protocol()) {
+    switch (_protocol) {
       case IPPROTO_ICMP:
-        /* Discard malformed ICMP packets. */
-        if (sizeof(ether_header) + sizeof(ip) + sizeof(icmphdr) > pcapHeader.caplen) {
+      case IPPROTO_ICMPV6:
+        if (pcapHeader.caplen < offset + sizeof(icmphdr)) {
           return false;
         }
-        _payloadSize = pcapHeader.caplen - (sizeof(ether_header) + sizeof(ip) + sizeof(icmphdr));
+        _icmpType = header[0];
+        _icmpCode = header[1];
+        offset += sizeof(icmphdr);
         break;
       case IPPROTO_TCP:
-        /* Discard malformed TCP packets. */
-        if (sizeof(ether_header) + sizeof(ip) + (((tcphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> th_off << 2) > pcapHeader.caplen) {
+        if (pcapHeader.caplen < offset + sizeof(tcphdr)) {
+          return false;
+        }
+        headerLength = (header[12] >> 4) << 2;
+        if (headerLength < sizeof(tcphdr) ||
+            pcapHeader.caplen < offset + headerLength) {
           return false;
         }
-        _payloadSize = pcapHeader.caplen - (sizeof(ether_header) + sizeof(ip) + (((tcphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> th_off << 2));
+        memcpy(&_sourcePort, header, sizeof(_sourcePort));
+        memcpy(&_destinationPort, header + 2, sizeof(_destinationPort));
+        memcpy(&_sequenceNumber, header + 4, sizeof(_sequenceNumber));
+        _tcpFlags = header[13];
+        offset += headerLength;
         break;
       case IPPROTO_UDP:
-        /* Discard malformed UDP packets. */
-        if (sizeof(ether_header) + sizeof(ip) + sizeof(udphdr) > pcapHeader.caplen) {
+        if (pcapHeader.caplen < offset + sizeof(udphdr)) {
           return false;
         }
-        _payloadSize = pcapHeader.caplen - (sizeof(ether_header) + sizeof(ip) + sizeof(udphdr));
+        memcpy(&_sourcePort, header, sizeof(_sourcePort));
+        memcpy(&_destinationPort, header + 2, sizeof(_destinationPort));
+        offset += sizeof(udphdr);
         break;
     }
   }
-  else {
-    _payloadSize = pcapHeader.caplen - (sizeof(ether_header) + sizeof(ip));
+  _payloadOffset = offset;
+  /*
+   * Short frames are padded out to the minimum Ethernet frame size, so leave
+   * out anything past the end of the IP datagram.
+   */
+  if (end > pcapHeader.caplen || end < offset) {
+    end = pcapHeader.caplen;
   }
-  _payload = _packet + (pcapHeader.caplen - _payloadSize);
+  _payloadSize = end - offset;
   return true;
 }
 
+template <int linkType>
+bool Packet::initialize(const pcap_pkthdr &pcapHeader, const u_char *pcapPacket) {
+  /* Copy timestamp to our more-portable format. */
+  _time = pcapHeader.ts;
+  _capturedSize = pcapHeader.caplen;
+  _size = (pcapHeader.len > 65535) ? 65535 : pcapHeader.len;
+  _packet = pcapPacket;
+  _flow = NULL;
+  if (pcapHeader.caplen <= LinkLayer <linkType>::headerLength) {
+    return false;
+  }
+  _sourceMAC = LinkLayer <linkType>::sourceMAC(pcapPacket);
+  _destinationMAC = LinkLayer <linkType>::destinationMAC(pcapPacket);
+  return decode(pcapHeader, LinkLayer <linkType>::headerLength,
+                LinkLayer <linkType>::etherType(pcapPacket),
+                LinkLayer <linkType>::tagged);
+}
+
+template bool Packet::initialize <DLT_EN10MB>(const pcap_pkthdr &pcapHeader,
+                                              const u_char *pcapPacket);
+template bool Packet::initialize <DLT_LINUX_SLL>(const pcap_pkthdr &pcapHeader,
+                                                 const u_char *pcapPacket);
+template bool Packet::initialize <DLT_RAW>(const pcap_pkthdr &pcapHeader,
+                                           const u_char *pcapPacket);
+
 const TimeStamp &Packet::time() const {
   return _time;
 }
@@ -78,12 +226,28 @@ const u_char *Packet::packet() const {
   return _packet;
 }
 
+/* The hardware addresses, or all zeros if the link layer didn't carry them. */
 const u_char *Packet::sourceMAC() const {
-  return _packet + ETHER_ADDR_LEN;
+  return _sourceMAC;
 }
 
 const u_char *Packet::destinationMAC() const {
-  return _packet;
+  return _destinationMAC;
+}
+
+/* The innermost VLAN ID the packet was tagged with, or 0 if it wasn't. */
+const uint16_t &Packet::vlan() const {
+  return _vlan;
+}
+
+/* The IP version: 4 or 6. */
+const uint8_t &Packet::version() const {
+  return _version;
+}
+
+/* The IPv4 type of service byte, or the IPv6 traffic class. */
+const uint8_t &Packet::tos() const {
+  return _tos;
 }
 
 const bool &Packet::fragmented() const {
@@ -91,68 +255,170 @@ const bool &Packet::fragmented() const {
 }
 
 const uint8_t &Packet::ttl() const {
-  return ((ip*)(_packet + sizeof(ether_header))) -> ip_ttl;
+  return _ttl;
 }
 
+/* The transport protocol, after any IPv6 extension headers. */
 const uint8_t &Packet::protocol() const {
-  return ((ip*)(_packet + sizeof(ether_header))) -> ip_p;
+  return _protocol;
 }
 
-/*
- * Ideally, for cosmetic reasons, we would like to do something like this:
- *
- *   return ((ip*)(_packet + sizeof(ether_header))) -> ip_src.s_addr;
- *
- * However, because the "ip" structure is padded in the Berkeley socket API,
- * GCC complains about "returning reference to temporary" and generates
- * undesirable code, so we'll just count the bytes ourselves.
- */
 const uint32_t &Packet::sourceIP() const {
-  return *(uint32_t*)(_packet + sizeof(ether_header) + 12);
+  return _sourceIP;
 }
 
 const uint32_t &Packet::destinationIP() const {
-  return *(uint32_t*)(_packet + sizeof(ether_header) + 16);
+  return _destinationIP;
+}
+
+const in6_addr &Packet::sourceIPv6() const {
+  return *(const in6_addr*)(_packet + _networkOffset + 8);
+}
+
+const in6_addr &Packet::destinationIPv6() const {
+  return *(const in6_addr*)(_packet + _networkOffset + 24);
 }
 
 const uint8_t &Packet::icmpType() const {
-#ifdef __FreeBSD__
-  return ((icmphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> icmp_type;
-#endif
-#ifdef __linux__
-  return ((icmphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> type;
-#endif
+  return _icmpType;
 }
 
 const uint8_t &Packet::icmpCode() const {
-#ifdef __FreeBSD__
-  return ((icmphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> icmp_code;
-#endif
-#ifdef __linux__
-  return ((icmphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> code;
-#endif
+  return _icmpCode;
 }
 
 const uint16_t &Packet::sourcePort() const {
-  return ((tcphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> th_sport;
+  return _sourcePort;
 }
 
 const uint16_t &Packet::destinationPort() const {
-  return ((tcphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> th_dport;
+  return _destinationPort;
+}
+
+const uint32_t &Packet::sequenceNumber() const {
+  return _sequenceNumber;
 }
 
 const uint8_t &Packet::tcpFlags() const {
-  return ((tcphdr*)(_packet + sizeof(ether_header) + sizeof(ip))) -> th_flags;
+  return _tcpFlags;
 }
 
 const uint16_t &Packet::capturedSize() const {
   return _capturedSize;
 }
 
+/* The size of the packet on the wire, which may be more than was captured. */
+const uint16_t &Packet::size() const {
+  return _size;
+}
+
 const uint16_t &Packet::payloadSize() const {
   return _payloadSize;
 }
 
 const u_char *Packet::payload() const {
-  return _payload;
+  return _packet + _payloadOffset;
+}
+
+const u_char *Packet::networkHeader() const {
+  return _packet + _networkOffset;
+}
+
+const u_char *Packet::transportHeader() const {
+  return _packet + _transportOffset;
+}
+
+/*
+ * Returns a hash of the packet's flow that is the same for both directions of
+ * the flow. Ports are left out for fragments, which don't all carry them, so
+ * that every fragment of a datagram hashes alike.
+ */
+uint32_t Packet::flowHash() const {
+  uint32_t lowIP = _sourceIP, highIP = _destinationIP, ports = 0;
+  uint32_t source[4], destination[4];
+  uint16_t lowPort, highPort;
+  /*
+   * IPv6 addresses are folded into a word each first. XOR commutes, so the
+   * two directions still hash alike.
+   */
+  if (_version == 6) {
+    memcpy(source, &sourceIPv6(), sizeof(source));
+    memcpy(destination, &destinationIPv6(), sizeof(destination));
+    lowIP = mix(source[0] ^ mix(source[1] ^ mix(source[2] ^ source[3])));
+    highIP = mix(destination[0] ^
+                 mix(destination[1] ^ mix(destination[2] ^ destination[3])));
+  }
+  if (lowIP > highIP) {
+    std::swap(lowIP, highIP);
+  }
+  if (_fragmented == false &&
+      (_protocol == IPPROTO_TCP || _protocol == IPPROTO_UDP)) {
+    lowPort = _sourcePort;
+    highPort = _destinationPort;
+    if (lowPort > highPort) {
+      lowPort = _destinationPort;
+      highPort = _sourcePort;
+    }
+    ports = ((uint32_t)lowPort << 16) | highPort;
+  }
+  return mix(lowIP ^ mix(highIP ^ mix(ports ^ _protocol)));
+}
+
+/*
+ * Returns false if the packet's source endpoint sorts before its destination
+ * endpoint, and true otherwise, so that the two directions of a flow can be
+ * told apart without regard to which side spoke first.
+ */
+bool Packet::direction() const {
+  int order;
+  if (_version == 6) {
+    order = memcmp(&sourceIPv6(), &destinationIPv6(), sizeof(in6_addr));
+    if (order != 0) {
+      return (order > 0);
+    }
+  }
+  else if (_sourceIP != _destinationIP) {
+    return (_sourceIP > _destinationIP);
+  }
+  if (_fragmented == false &&
+      (_protocol == IPPROTO_TCP || _protocol == IPPROTO_UDP)) {
+    return (_sourcePort > _destinationPort);
+  }
+  return false;
+}
+
+/*
+ * The flow the packet belongs to in the sensor's flow table, or NULL if it
+ * isn't tracked.
+ */
+Flow *Packet::flow() const {
+  return _flow;
+}
+
+void Packet::setFlow(Flow *flow) {
+  _flow = flow;
+}
+
+/*
+ * Points the packet at a copy of the bytes it was decoded from, for
+ * PacketPool. Fields are kept as offsets, so only the pointers need moving.
+ */
+void Packet::relocate(const u_char *packet) {
+  if (_sourceMAC >= _packet && _sourceMAC < _packet + _capturedSize) {
+    _sourceMAC = packet + (_sourceMAC - _packet);
+  }
+  if (_destinationMAC >= _packet &&
+      _destinationMAC < _packet + _capturedSize) {
+    _destinationMAC = packet + (_destinationMAC - _packet);
+  }
+  _packet = packet;
+  _flow = NULL;
+}
+
+/* Returns a module's state for the packet's flow, or NULL if it has none. */
+void *Packet::state(const FlowSlot &slot) const {
+  if (_flow == NULL || slot.size == 0) {
+    return NULL;
+  }
+  return _flow -> state() + slot.offset;
 }
@@ -41,9 +41,25 @@
 
 #include <include/timeStamp.h>
 
+struct Flow;
+struct FlowSlot;
+
+/*
+ * A decoded packet. initialize() walks the packet's layers once: the
+ * link-layer header of the capture's datalink type (see linkLayer.hpp) and
+ * any 802.1Q or 802.1ad tags, an IPv4 header with any options or
+ * an IPv6 header with any extension headers, and a TCP, UDP or ICMP header.
+ * It keeps where each layer starts and copies out the fields that the
+ * accessors return, so those cost a load each. Packets that are not IPv4 or
+ * IPv6, or that are cut off before their headers end, are rejected.
+ *
+ * sourceIP() and destinationIP() are 0 for IPv6 packets, whose addresses are
+ * available from sourceIPv6() and destinationIPv6() instead.
+ */
 class Packet {
   public:
-    bool initialize(const pcap_pkthdr &pcapheader,
+    template <int linkType>
+    bool initialize(const pcap_pkthdr &pcapHeader,
                     const u_char *pcapPacket);
     const TimeStamp &time() const;
     const uint16_t &capturedSize() const;
@@ -51,26 +67,62 @@ class Packet {
     const u_char *packet() const;
     const u_char *sourceMAC() const;
     const u_char *destinationMAC() const;
+    const uint16_t &vlan() const;
+    const uint8_t &version() const;
     const uint8_t &tos() const;
     const bool &fragmented() const;
     const uint8_t &ttl() const;
     const uint8_t &protocol() const;
     const uint32_t &sourceIP() const;
     const uint32_t &destinationIP() const;
+    const in6_addr &sourceIPv6() const;
+    const in6_addr &destinationIPv6() const;
     const uint8_t &icmpType() const;
     const uint8_t &icmpCode() const;
     const uint16_t &sourcePort() const;
     const uint16_t &destinationPort() const;
+    const uint32_t &sequenceNumber() const;
     const uint8_t &tcpFlags() const;
     const uint16_t &payloadSize() const;
     const u_char *payload() const;
+    const u_char *networkHeader() const;
+    const u_char *transportHeader() const;
+    uint32_t flowHash() const;
+    bool direction() const;
+    Flow *flow() const;
+    void setFlow(Flow *flow);
+    void *state(const FlowSlot &slot) const;
   private:
     TimeStamp _time;
-    uint16_t _capturedSize;
     const u_char *_packet;
-    bool _fragmented;
+    const u_char *_sourceMAC;
+    const u_char *_destinationMAC;
+    Flow *_flow;
+    uint32_t _sourceIP;
+    uint32_t _destinationIP;
+    uint32_t _sequenceNumber;
+    uint16_t _capturedSize;
+    uint16_t _size;
+    /* Offsets of the IP header, the header after it, and the payload. */
+    uint16_t _networkOffset;
+    uint16_t _transportOffset;
+    uint16_t _payloadOffset;
     uint16_t _payloadSize;
-    const u_char *_payload;
+    uint16_t _vlan;
+    uint16_t _sourcePort;
+    uint16_t _destinationPort;
+    uint8_t _version;
+    uint8_t _tos;
+    uint8_t _ttl;
+    uint8_t _protocol;
+    uint8_t _icmpType;
+    uint8_t _icmpCode;
+    uint8_t _tcpFlags;
+    bool _fragmented;
+    friend class PacketPool;
+    void relocate(const u_char *packet);
+    bool decode(const pcap_pkthdr &pcapHeader, size_t offset,
+                uint16_t etherType, bool tagged);
 };
 
 #endif
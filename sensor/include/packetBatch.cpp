@@ -0,0 +1,154 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+
+#include "packetBatch.h"
+
+/* Each packet copied into the batch gets a slot big enough for any packet. */
+static const size_t slotSize = std::numeric_limits <uint16_t>::max();
+
+PacketBatch::PacketBatch() {
+  _error = true;
+  errorMessage = "PacketBatch::PacketBatch(): class not initialized";
+  buffer = NULL;
+  capacity = 0;
+  _size = 0;
+}
+
+bool PacketBatch::initialize(const size_t &capacity) {
+  if (capacity == 0) {
+    _error = true;
+    errorMessage = "PacketBatch::initialize(): batch is too small";
+    return false;
+  }
+  /* Slots are only touched as they are used, so most are never paged in. */
+  buffer = (u_char*)malloc(capacity * slotSize);
+  if (buffer == NULL) {
+    _error = true;
+    errorMessage = "PacketBatch::initialize(): malloc(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  this -> capacity = capacity;
+  packets.resize(capacity);
+  _matches.resize(capacity);
+  selection.resize(capacity);
+  _size = 0;
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+PacketBatch::operator bool() const {
+  return !_error;
+}
+
+const std::string &PacketBatch::error() const {
+  return errorMessage;
+}
+
+/*
+ * Decodes a packet into the batch, copying it first if "copy" is true.
+ * Returns false if the packet could not be decoded or the batch is full.
+ */
+template <int linkType>
+bool PacketBatch::add(const pcap_pkthdr &pcapHeader, const u_char *pcapPacket,
+                      const uint64_t &matches, const bool &copy) {
+  if (_size == capacity) {
+    return false;
+  }
+  if (copy == true) {
+    memcpy(buffer + _size * slotSize, pcapPacket,
+           std::min((size_t)pcapHeader.caplen, slotSize));
+    pcapPacket = buffer + _size * slotSize;
+  }
+  if (packets[_size].initialize <linkType>(pcapHeader, pcapPacket) == false) {
+    return false;
+  }
+  _matches[_size] = matches;
+  ++_size;
+  return true;
+}
+
+template bool PacketBatch::add <DLT_EN10MB>(const pcap_pkthdr &pcapHeader,
+                                            const u_char *pcapPacket,
+                                            const uint64_t &matches,
+                                            const bool &copy);
+template bool PacketBatch::add <DLT_LINUX_SLL>(const pcap_pkthdr &pcapHeader,
+                                               const u_char *pcapPacket,
+                                               const uint64_t &matches,
+                                               const bool &copy);
+template bool PacketBatch::add <DLT_RAW>(const pcap_pkthdr &pcapHeader,
+                                         const u_char *pcapPacket,
+                                         const uint64_t &matches,
+                                         const bool &copy);
+
+const size_t &PacketBatch::size() const {
+  return _size;
+}
+
+bool PacketBatch::full() const {
+  return (_size == capacity);
+}
+
+Packet &PacketBatch::operator[](const size_t &packet) {
+  return packets[packet];
+}
+
+const Packet &PacketBatch::operator[](const size_t &packet) const {
+  return packets[packet];
+}
+
+const uint64_t &PacketBatch::matches(const size_t &packet) const {
+  return _matches[packet];
+}
+
+/*
+ * Returns the packets in the batch that match any of the modules in "mask",
+ * in the order they were added, as one array of "count" packets.
+ */
+const Packet *PacketBatch::select(const uint64_t &mask, size_t &count) {
+  count = 0;
+  for (size_t i = 0; i < _size; ++i) {
+    if ((_matches[i] & mask) != 0) {
+      selection[count++] = packets[i];
+    }
+  }
+  return &selection[0];
+}
+
+void PacketBatch::clear() {
+  _size = 0;
+}
+
+PacketBatch::~PacketBatch() {
+  free(buffer);
+}
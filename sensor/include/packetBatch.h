@@ -0,0 +1,71 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef PACKET_BATCH_H
+#define PACKET_BATCH_H
+
+#include <string>
+#include <vector>
+
+#include <pcap.h>
+#include <stdint.h>
+
+#include <include/packet.h>
+
+/*
+ * A batch of decoded packets, each tagged with the mask of modules that want
+ * it, for handing to modules' processPackets() functions several at a time.
+ * Packets are either copied into the batch or, when the capture buffer they
+ * came from will stay put until the batch is processed, referred to in place.
+ */
+class PacketBatch {
+  public:
+    PacketBatch();
+    bool initialize(const size_t &capacity);
+    operator bool() const;
+    const std::string &error() const;
+    template <int linkType>
+    bool add(const pcap_pkthdr &pcapHeader, const u_char *pcapPacket,
+             const uint64_t &matches, const bool &copy);
+    const size_t &size() const;
+    bool full() const;
+    Packet &operator[](const size_t &packet);
+    const Packet &operator[](const size_t &packet) const;
+    const uint64_t &matches(const size_t &packet) const;
+    const Packet *select(const uint64_t &mask, size_t &count);
+    void clear();
+    ~PacketBatch();
+  private:
+    bool _error;
+    std::string errorMessage;
+    u_char *buffer;
+    size_t capacity;
+    size_t _size;
+    std::vector <Packet> packets;
+    std::vector <uint64_t> _matches;
+    std::vector <Packet> selection;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <new>
+
+#include "packetPool.h"
+
+const Packet *PacketBuffer::get() const {
+  return (const Packet*)pointer.get();
+}
+
+const Packet &PacketBuffer::operator*() const {
+  return *get();
+}
+
+const Packet *PacketBuffer::operator->() const {
+  return get();
+}
+
+PacketPool::PacketPool() {
+  _error = true;
+  errorMessage = "PacketPool::PacketPool(): class not initialized";
+  _limit = 0;
+  headerSize = (sizeof(Packet) + 15) & ~(size_t)15;
+  largeSize = (headerSize + 65535 + 63) & ~(size_t)63;
+  _pressure = 0;
+  _failures = 0;
+}
+
+/* Sets up the pool to hold at most "limit" bytes of buffers. */
+bool PacketPool::initialize(const size_t limit) {
+  _limit = limit;
+  if (!smallBuffers.initialize(1, smallSize, limit, 0)) {
+    _error = true;
+    errorMessage = "PacketPool::initialize(): " + smallBuffers.error();
+    return false;
+  }
+  if (!largeBuffers.initialize(1, largeSize, limit, 0)) {
+    _error = true;
+    errorMessage = "PacketPool::initialize(): " + largeBuffers.error();
+    return false;
+  }
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+PacketPool::operator bool() const {
+  return !_error;
+}
+
+const std::string &PacketPool::error() const {
+  return errorMessage;
+}
+
+void PacketPool::addPressureCallback(PressureCallback callback,
+                                     void *argument) {
+  callbacks.push_back(std::make_pair(callback, argument));
+}
+
+/*
+ * Copies a packet into a buffer, with its decoded fields, and returns the
+ * buffer, or an empty buffer if the pool is full or was never initialized.
+ * The retained packet doesn't belong to a flow, since the flow may be gone
+ * by the time it is used.
+ */
+PacketBuffer PacketPool::retain(const Packet &packet) {
+  PacketBuffer buffer;
+  bool small = (headerSize + packet.capturedSize() <= smallSize);
+  Memory <u_char> &buffers = (small == true) ? smallBuffers : largeBuffers;
+  size_t bufferSize = (small == true) ? smallSize : largeSize;
+  Packet *_packet;
+  if (_error == true) {
+    return buffer;
+  }
+  if (size() + bufferSize > _limit) {
+    __sync_add_and_fetch(&_pressure, 1);
+    for (size_t i = 0; i < callbacks.size(); ++i) {
+      callbacks[i].first(callbacks[i].second);
+    }
+    if (size() + bufferSize > _limit) {
+      __sync_add_and_fetch(&_failures, 1);
+      return buffer;
+    }
+  }
+  buffer.pointer = buffers.allocate();
+  if (buffer.pointer.get() == NULL) {
+    __sync_add_and_fetch(&_failures, 1);
+    return buffer;
+  }
+  memcpy(buffer.pointer.get() + headerSize, packet.packet(),
+         packet.capturedSize());
+  _packet = new(buffer.pointer.get()) Packet(packet);
+  _packet -> relocate(buffer.pointer.get() + headerSize);
+  return buffer;
+}
+
+/* Bytes taken up by buffers in use. */
+size_t PacketPool::size() const {
+  return smallBuffers.size() * smallSize + largeBuffers.size() * largeSize;
+}
+
+size_t PacketPool::limit() const {
+  return _limit;
+}
+
+/* Times retain() found the pool full and called the pressure callbacks. */
+uint64_t PacketPool::pressure() const {
+  return _pressure;
+}
+
+/* Packets that couldn't be retained. */
+uint64_t PacketPool::failures() const {
+  return _failures;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include <include/memory.hpp>
+#include <include/packet.h>
+
+/*
+ * A packet that a module has retained beyond the call it was handed to it
+ * in. It behaves like a pointer to the Packet, which stays valid, along with
+ * the bytes it points to, for as long as any copy of the PacketBuffer exists.
+ * Copies share the same bytes. An empty PacketBuffer points to NULL.
+ */
+class PacketBuffer {
+  public:
+    const Packet *get() const;
+    const Packet &operator*() const;
+    const Packet *operator->() const;
+  private:
+    friend class PacketPool;
+    Memory <u_char>::Pointer pointer;
+};
+
+/*
+ * A pool of reference-counted buffers for retaining packets. retain() copies
+ * a packet into a buffer once, and the module can then hold on to it, or
+ * hand it to other threads, without copying it again. The buffers come from
+ * two Memory pools, one of buffers big enough for an Ethernet frame and one
+ * of buffers big enough for any packet, which grow until, together, they
+ * take up "limit" bytes.
+ *
+ * When retaining a packet would take the pool over its limit, every pressure
+ * callback is called first, so that modules can let go of packets they can
+ * do without. Callbacks are called from whichever thread is retaining a
+ * packet and must be registered before capture starts.
+ */
+class PacketPool {
+  public:
+    typedef void (*PressureCallback)(void *argument);
+    PacketPool();
+    bool initialize(const size_t limit);
+    operator bool() const;
+    const std::string &error() const;
+    void addPressureCallback(PressureCallback callback, void *argument);
+    PacketBuffer retain(const Packet &packet);
+    size_t size() const;
+    size_t limit() const;
+    uint64_t pressure() const;
+    uint64_t failures() const;
+  private:
+    static const size_t smallSize = 2048;
+    bool _error;
+    std::string errorMessage;
+    size_t _limit;
+    /* Where the packet's bytes start in a buffer, after the Packet itself. */
+    size_t headerSize;
+    size_t largeSize;
+    Memory <u_char> smallBuffers;
+    Memory <u_char> largeBuffers;
+    std::vector <std::pair <PressureCallback, void*> > callbacks;
+    volatile uint64_t _pressure;
+    volatile uint64_t _failures;
+};
+
+#endif
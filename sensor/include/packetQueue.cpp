@@ -0,0 +1,190 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "packetQueue.h"
+
+/* Marks the unused end of the buffer when a record had to wrap around. */
+static const uint32_t wrap = 0xffffffff;
+
+/* Rounds a record size up so that every record header stays aligned. */
+static inline size_t align(const size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+PacketQueue::PacketQueue() {
+  _error = true;
+  errorMessage = "PacketQueue::PacketQueue(): class not initialized";
+  buffer = NULL;
+  _size = 0;
+  head = 0;
+  tail = 0;
+  frontSize = 0;
+}
+
+bool PacketQueue::initialize(const size_t size) {
+  _size = align(size);
+  if (_size < 2 * align(sizeof(Record) + 2 * 65535)) {
+    _error = true;
+    errorMessage = "PacketQueue::initialize(): queue is too small";
+    return false;
+  }
+  buffer = (u_char*)malloc(_size);
+  if (buffer == NULL) {
+    _error = true;
+    errorMessage = "PacketQueue::initialize(): malloc(): ";
+    errorMessage += strerror(errno);
+    return false;
+  }
+  head = 0;
+  tail = 0;
+  frontSize = 0;
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+PacketQueue::operator bool() const {
+  return !_error;
+}
+
+const std::string &PacketQueue::error() const {
+  return errorMessage;
+}
+
+/*
+ * Copies a packet into the queue. Returns false if the consumer has fallen
+ * too far behind for it to fit.
+ */
+bool PacketQueue::push(const pcap_pkthdr &pcapHeader, const u_char *packet) {
+  return push(pcapHeader, packet, 0, NULL, 0);
+}
+
+/*
+ * Copies a packet into the queue with a tag and "length" bytes of "data",
+ * which may be NULL to pass only the length along. The data may be at most
+ * 65535 bytes long.
+ */
+bool PacketQueue::push(const pcap_pkthdr &pcapHeader, const u_char *packet,
+                       const uint64_t &tag, const u_char *data,
+                       const size_t &length) {
+  size_t _tail = tail, offset = _tail % _size, skip = 0,
+         copied = (data != NULL) ? length : 0,
+         _length = align(sizeof(Record) + pcapHeader.caplen + copied), used;
+  Record *record;
+  used = _tail - head;
+  /* Don't overwrite anything before the consumer is done reading it. */
+  __sync_synchronize();
+  /* Records are never split, so wrap around if this one won't fit. */
+  if (_size - offset < _length) {
+    skip = _size - offset;
+  }
+  if (_size - used < skip + _length) {
+    return false;
+  }
+  if (skip > 0) {
+    if (skip >= sizeof(Record)) {
+      ((Record*)(buffer + offset)) -> capturedSize = wrap;
+    }
+    offset = 0;
+  }
+  record = (Record*)(buffer + offset);
+  record -> seconds = pcapHeader.ts.tv_sec;
+  record -> microseconds = pcapHeader.ts.tv_usec;
+  record -> capturedSize = pcapHeader.caplen;
+  record -> size = pcapHeader.len;
+  record -> tag = tag;
+  record -> length = length;
+  record -> copied = (data != NULL);
+  memcpy(buffer + offset + sizeof(Record), packet, pcapHeader.caplen);
+  if (copied > 0) {
+    memcpy(buffer + offset + sizeof(Record) + pcapHeader.caplen, data, copied);
+  }
+  /* Publish the record only after all of it has been written. */
+  __sync_synchronize();
+  tail = _tail + skip + _length;
+  return true;
+}
+
+/*
+ * Returns the oldest packet in the queue and fills in its pcap header, or
+ * returns NULL if the queue is empty. The packet remains valid until pop() is
+ * called.
+ */
+const u_char *PacketQueue::front(pcap_pkthdr &pcapHeader) {
+  uint64_t tag;
+  const u_char *data;
+  size_t length;
+  return front(pcapHeader, tag, data, length);
+}
+
+/*
+ * Like front(), but also returns the packet's tag and extra data, which is
+ * NULL if only its length was pushed.
+ */
+const u_char *PacketQueue::front(pcap_pkthdr &pcapHeader, uint64_t &tag,
+                                 const u_char *&data, size_t &length) {
+  size_t _head = head, offset = _head % _size, skip = 0, copied;
+  Record *record;
+  if (_head == tail) {
+    return NULL;
+  }
+  __sync_synchronize();
+  if (_size - offset < sizeof(Record) ||
+      ((Record*)(buffer + offset)) -> capturedSize == wrap) {
+    skip = _size - offset;
+    offset = 0;
+  }
+  record = (Record*)(buffer + offset);
+  pcapHeader.ts.tv_sec = record -> seconds;
+  pcapHeader.ts.tv_usec = record -> microseconds;
+  pcapHeader.caplen = record -> capturedSize;
+  pcapHeader.len = record -> size;
+  tag = record -> tag;
+  length = record -> length;
+  data = NULL;
+  copied = 0;
+  if (record -> copied != 0) {
+    data = buffer + offset + sizeof(Record) + record -> capturedSize;
+    copied = length;
+  }
+  frontSize = skip + align(sizeof(Record) + record -> capturedSize + copied);
+  return buffer + offset + sizeof(Record);
+}
+
+/* Removes the packet last returned by front() from the queue. */
+void PacketQueue::pop() {
+  /* Finish reading the record before handing its space back. */
+  __sync_synchronize();
+  head = head + frontSize;
+  frontSize = 0;
+}
+
+PacketQueue::~PacketQueue() {
+  free(buffer);
+}
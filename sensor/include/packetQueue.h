@@ -0,0 +1,83 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+
+#include <string>
+
+#include <pcap.h>
+#include <stdint.h>
+
+/*
+ * A lock-free queue of captured packets with exactly one producer and one
+ * consumer. Packets are copied into a circular buffer along with their pcap
+ * headers, so they remain valid after the capture buffer they came from has
+ * been reused. Each packet may carry a tag and a run of extra data, which are
+ * returned with it.
+ */
+class PacketQueue {
+  public:
+    PacketQueue();
+    bool initialize(const size_t size);
+    operator bool() const;
+    const std::string &error() const;
+    bool push(const pcap_pkthdr &pcapHeader, const u_char *packet);
+    bool push(const pcap_pkthdr &pcapHeader, const u_char *packet,
+              const uint64_t &tag, const u_char *data, const size_t &length);
+    const u_char *front(pcap_pkthdr &pcapHeader);
+    const u_char *front(pcap_pkthdr &pcapHeader, uint64_t &tag,
+                        const u_char *&data, size_t &length);
+    void pop();
+    ~PacketQueue();
+  private:
+    struct Record {
+      uint32_t seconds;
+      uint32_t microseconds;
+      uint32_t capturedSize;
+      uint32_t size;
+      uint64_t tag;
+      /*
+       * The length of the extra data, and whether it follows the packet or
+       * the packet only carries its length.
+       */
+      uint32_t length;
+      uint32_t copied;
+    };
+    bool _error;
+    std::string errorMessage;
+    u_char *buffer;
+    size_t _size;
+    /*
+     * "head" is only written by the consumer and "tail" only by the producer.
+     * Both count bytes since the queue was created and are reduced modulo the
+     * buffer size when used.
+     */
+    volatile size_t head;
+    volatile size_t tail;
+    size_t frontSize;
+};
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "tcpReassembler.h"
+
+/* Whether sequence number "left" comes after "right", allowing for wrap. */
+static inline bool after(const uint32_t &left, const uint32_t &right) {
+  return ((int32_t)(left - right) > 0);
+}
+
+TCPReassembler::TCPReassembler() {
+  _error = true;
+  errorMessage = "TCPReassembler::TCPReassembler(): class not initialized";
+  chunks = NULL;
+  freeChunks = NULL;
+  numFreeChunks = 0;
+  _outOfOrder = 0;
+  _retransmissions = 0;
+  _gaps = 0;
+}
+
+/* The size of the flow table slot the reassembler needs. */
+size_t TCPReassembler::stateSize() {
+  return sizeof(Stream) * 2;
+}
+
+/*
+ * Buffers up to "maxBytes" bytes of out-of-order data in all, and up to
+ * "maxStreamBytes" for any one direction of a connection.
+ */
+bool TCPReassembler::initialize(const FlowSlot &slot, const size_t &maxBytes,
+                                const size_t &maxStreamBytes) {
+  size_t numChunks = maxBytes / chunkSize;
+  this -> slot = slot;
+  this -> maxStreamBytes = maxStreamBytes;
+  /* Chunks are only paged in as they are used. */
+  if (numChunks > 0) {
+    chunks = (Chunk*)malloc(numChunks * sizeof(Chunk));
+    if (chunks == NULL) {
+      _error = true;
+      errorMessage = "TCPReassembler::initialize(): malloc(): ";
+      errorMessage += strerror(errno);
+      return false;
+    }
+  }
+  for (size_t i = numChunks; i > 0; --i) {
+    chunks[i - 1].next = freeChunks;
+    freeChunks = &(chunks[i - 1]);
+  }
+  numFreeChunks = numChunks;
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+TCPReassembler::operator bool() const {
+  return !_error;
+}
+
+const std::string &TCPReassembler::error() const {
+  return errorMessage;
+}
+
+/* Feeds a TCP packet's payload through its connection's streams. */
+void TCPReassembler::process(const Packet &packet, Callback callback,
+                             void *argument) {
+  Stream *streams;
+  uint32_t sequence, end;
+  size_t length = packet.payloadSize(), offset;
+  const u_char *data = packet.payload();
+  /*
+   * Fragments that the sensor couldn't reassemble don't carry a usable TCP
+   * header past the first one, so they are left out.
+   */
+  if (packet.protocol() != IPPROTO_TCP || packet.flow() == NULL ||
+      packet.fragmented() == true) {
+    return;
+  }
+  streams = (Stream*)packet.state(slot);
+  Stream &stream = streams[packet.direction()];
+  /* Nothing more is coming on a connection that has been reset. */
+  if ((packet.tcpFlags() & TH_RST) != 0) {
+    clear(streams[0]);
+    clear(streams[1]);
+    streams[0].started = false;
+    streams[1].started = false;
+    return;
+  }
+  sequence = ntohl(packet.sequenceNumber());
+  /*
+   * A SYN takes up a sequence number of its own. One that isn't a
+   * retransmission starts a new connection on the same ports.
+   */
+  if ((packet.tcpFlags() & TH_SYN) != 0) {
+    ++sequence;
+    if (stream.started == false || stream.initial != sequence) {
+      clear(stream);
+      stream.started = true;
+      stream.initial = sequence;
+      stream.next = sequence;
+    }
+  }
+  if (length == 0) {
+    return;
+  }
+  /* Pick up connections that were already open where they are. */
+  if (stream.started == false) {
+    stream.started = true;
+    stream.initial = sequence;
+    stream.next = sequence;
+  }
+  while (true) {
+    if (!after(sequence, stream.next)) {
+      end = sequence + length;
+      if (!after(end, stream.next)) {
+        ++_retransmissions;
+        return;
+      }
+      /* Skip whatever part of the segment was already handed over. */
+      offset = stream.next - sequence;
+      stream.next = end;
+      callback(packet, data + offset, length - offset, argument);
+      drain(stream, packet, callback, argument);
+      return;
+    }
+    if (buffer(stream, sequence, data, length)) {
+      ++_outOfOrder;
+      return;
+    }
+    /*
+     * Out of room: give up on the hole before the earliest data we have,
+     * which either lets the segment through or makes room for it.
+     */
+    if (stream.chunks != NULL && after(sequence, stream.chunks -> sequence)) {
+      skip(stream, stream.chunks -> sequence, packet, callback, argument);
+    }
+    else {
+      skip(stream, sequence, packet, callback, argument);
+    }
+  }
+}
+
+/* Returns a flow's buffered chunks to the pool. */
+void TCPReassembler::release(Flow &flow, void *reassembler) {
+  TCPReassembler &_reassembler = *(TCPReassembler*)reassembler;
+  Stream *streams = (Stream*)(flow.state() + _reassembler.slot.offset);
+  _reassembler.clear(streams[0]);
+  _reassembler.clear(streams[1]);
+}
+
+/* Segments buffered because they arrived ahead of a hole. */
+const uint64_t &TCPReassembler::outOfOrder() const {
+  return _outOfOrder;
+}
+
+/* Segments carrying nothing that hadn't already been handed over. */
+const uint64_t &TCPReassembler::retransmissions() const {
+  return _retransmissions;
+}
+
+/* Holes given up on for lack of room. */
+const uint64_t &TCPReassembler::gaps() const {
+  return _gaps;
+}
+
+/*
+ * Copies an out-of-order segment into chunks, in sequence order after any
+ * chunks that start at the same place, so that the data that arrived first
+ * wins where segments overlap. Returns false if there isn't room for it.
+ */
+bool TCPReassembler::buffer(Stream &stream, const uint32_t &sequence,
+                            const u_char *data, const size_t &length) {
+  size_t numChunks = (length + chunkSize - 1) / chunkSize, _length;
+  Chunk **link = &(stream.chunks), *chunk;
+  if (stream.buffered + length > maxStreamBytes || numChunks > numFreeChunks) {
+    return false;
+  }
+  for (size_t offset = 0; offset < length; offset += _length) {
+    _length = length - offset;
+    if (_length > chunkSize) {
+      _length = chunkSize;
+    }
+    while (*link != NULL && !after((*link) -> sequence, sequence + offset)) {
+      link = &((*link) -> next);
+    }
+    chunk = freeChunks;
+    freeChunks = chunk -> next;
+    --numFreeChunks;
+    chunk -> sequence = sequence + offset;
+    chunk -> length = _length;
+    memcpy(chunk -> data, data + offset, _length);
+    chunk -> next = *link;
+    *link = chunk;
+    link = &(chunk -> next);
+  }
+  stream.buffered += length;
+  return true;
+}
+
+/* Hands over buffered data that a segment has made contiguous. */
+void TCPReassembler::drain(Stream &stream, const Packet &packet,
+                           Callback callback, void *argument) {
+  Chunk *chunk;
+  uint32_t end;
+  while (stream.chunks != NULL &&
+         !after(stream.chunks -> sequence, stream.next)) {
+    chunk = stream.chunks;
+    end = chunk -> sequence + chunk -> length;
+    if (after(end, stream.next)) {
+      callback(packet, chunk -> data + (stream.next - chunk -> sequence),
+               end - stream.next, argument);
+      stream.next = end;
+    }
+    stream.chunks = chunk -> next;
+    stream.buffered -= chunk -> length;
+    chunk -> next = freeChunks;
+    freeChunks = chunk;
+    ++numFreeChunks;
+  }
+}
+
+/* Gives up on the bytes before "sequence". */
+void TCPReassembler::skip(Stream &stream, const uint32_t &sequence,
+                          const Packet &packet, Callback callback,
+                          void *argument) {
+  ++_gaps;
+  callback(packet, NULL, sequence - stream.next, argument);
+  stream.next = sequence;
+  drain(stream, packet, callback, argument);
+}
+
+void TCPReassembler::clear(Stream &stream) {
+  Chunk *chunk;
+  while (stream.chunks != NULL) {
+    chunk = stream.chunks;
+    stream.chunks = chunk -> next;
+    chunk -> next = freeChunks;
+    freeChunks = chunk;
+    ++numFreeChunks;
+  }
+  stream.buffered = 0;
+}
+
+TCPReassembler::~TCPReassembler() {
+  free(chunks);
+}
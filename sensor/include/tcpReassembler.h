@@ -0,0 +1,107 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TCP_REASSEMBLER_H
+#define TCP_REASSEMBLER_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include <include/flowTable.h>
+#include <include/packet.h>
+
+/*
+ * Puts the two byte streams of each TCP connection back in order for modules
+ * that export a processStream() function. Each capture worker has its own,
+ * and keeps its state for each connection in a slot of its flow table.
+ *
+ * Data that arrives in order is handed to modules straight out of the packet
+ * it came in. Segments that arrive ahead of a hole are copied into chunks
+ * from a fixed pool until the hole is filled, and retransmitted data that has
+ * already been handed over is skipped. When a direction has buffered as much
+ * as it may, or the pool runs out, the hole is given up on: modules are told
+ * how many bytes are missing, and the buffered data after it follows.
+ */
+class TCPReassembler {
+  public:
+    /*
+     * Called with each in-order run of bytes, and with "data" set to NULL
+     * and "length" set to the number of bytes lost when a hole is given up
+     * on. "packet" is the packet that made the bytes available, and its
+     * direction is that of the bytes.
+     */
+    typedef void (*Callback)(const Packet &packet, const u_char *data,
+                             const size_t &length, void *argument);
+    TCPReassembler();
+    static size_t stateSize();
+    bool initialize(const FlowSlot &slot, const size_t &maxBytes,
+                    const size_t &maxStreamBytes);
+    operator bool() const;
+    const std::string &error() const;
+    void process(const Packet &packet, Callback callback, void *argument);
+    static void release(Flow &flow, void *reassembler);
+    const uint64_t &outOfOrder() const;
+    const uint64_t &retransmissions() const;
+    const uint64_t &gaps() const;
+    ~TCPReassembler();
+  private:
+    static const size_t chunkSize = 2032;
+    struct Chunk {
+      Chunk *next;
+      uint32_t sequence;
+      uint32_t length;
+      u_char data[chunkSize];
+    };
+    /* One direction of a connection. */
+    struct Stream {
+      bool started;
+      /* The sequence number after the SYN, if one was seen. */
+      uint32_t initial;
+      uint32_t next;
+      uint32_t buffered;
+      /* Buffered chunks, in sequence order. */
+      Chunk *chunks;
+    };
+    bool _error;
+    std::string errorMessage;
+    FlowSlot slot;
+    Chunk *chunks;
+    Chunk *freeChunks;
+    size_t numFreeChunks;
+    size_t maxStreamBytes;
+    uint64_t _outOfOrder;
+    uint64_t _retransmissions;
+    uint64_t _gaps;
+    bool buffer(Stream &stream, const uint32_t &sequence, const u_char *data,
+                const size_t &length);
+    void drain(Stream &stream, const Packet &packet, Callback callback,
+               void *argument);
+    void skip(Stream &stream, const uint32_t &sequence, const Packet &packet,
+              Callback callback, void *argument);
+    void clear(Stream &stream);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * A hierarchical timer wheel with a resolution of one second, for expiring
+ * idle sessions without scanning every session in a table.
+ *
+ * Timers are kept in four levels of 256 slots each. A timer goes into the
+ * lowest level whose span covers how far in the future it is due, so
+ * scheduling one is a constant-time append. As time advances, the slots of
+ * higher levels are spread over the levels below them, and timers reaching
+ * the bottom level are handed back by expire() when they are due. Timers
+ * can't be cancelled; a caller that finds a session still active when its
+ * timer goes off should schedule it again for when it will be idle.
+ */
+template <class K>
+class TimerWheel {
+  public:
+    TimerWheel();
+    bool initialize();
+    operator bool() const;
+    const std::string &error() const;
+    void schedule(const K &key, const uint32_t &time);
+    void expire(const uint32_t &now, std::vector <K> &due);
+    size_t size() const;
+    ~TimerWheel();
+  private:
+    static const size_t numLevels = 4;
+    static const size_t numSlots = 256;
+    struct Timer {
+      K key;
+      uint32_t time;
+    };
+    bool _error;
+    std::string errorMessage;
+    bool initialized;
+    pthread_mutex_t mutex;
+    std::vector <Timer> slots[numLevels][numSlots];
+    std::vector <Timer> cascading;
+    /* Every timer due at or before "current" has been expired. */
+    uint32_t current;
+    bool started;
+    size_t _size;
+    void place(const Timer &timer);
+};
+
+template <class K>
+TimerWheel <K>::TimerWheel() {
+  _error = true;
+  errorMessage = "TimerWheel::TimerWheel(): class not initialized";
+  initialized = false;
+  current = 0;
+  started = false;
+  _size = 0;
+}
+
+template <class K>
+bool TimerWheel <K>::initialize() {
+  int error;
+  if (initialized == true) {
+    return true;
+  }
+  error = pthread_mutex_init(&mutex, NULL);
+  if (error != 0) {
+    _error = true;
+    errorMessage = "TimerWheel::initialize(): pthread_mutex_init(): ";
+    errorMessage += strerror(error);
+    return false;
+  }
+  initialized = true;
+  _error = false;
+  errorMessage.clear();
+  return true;
+}
+
+template <class K>
+TimerWheel <K>::operator bool() const {
+  return !_error;
+}
+
+template <class K>
+const std::string &TimerWheel <K>::error() const {
+  return errorMessage;
+}
+
+/*
+ * Puts a timer in the slot for its due time, which must not be before
+ * "current". The mutex must be held.
+ */
+template <class K>
+void TimerWheel <K>::place(const Timer &timer) {
+  uint32_t delta = timer.time - current;
+  size_t level = 0;
+  while (level < numLevels - 1 && delta >= (uint32_t)1 << (8 * (level + 1))) {
+    ++level;
+  }
+  slots[level][(timer.time >> (8 * level)) & (numSlots - 1)].push_back(timer);
+}
+
+/*
+ * Schedules "key" to be returned by expire() once the time reaches "time".
+ * A time that has already passed is treated as the next second.
+ */
+template <class K>
+void TimerWheel <K>::schedule(const K &key, const uint32_t &time) {
+  Timer timer;
+  timer.key = key;
+  timer.time = time;
+  pthread_mutex_lock(&mutex);
+  if (started == false) {
+    current = time - 1;
+    started = true;
+  }
+  if (timer.time <= current) {
+    timer.time = current + 1;
+  }
+  place(timer);
+  ++_size;
+  pthread_mutex_unlock(&mutex);
+}
+
+/* Appends the keys of all timers due at or before "now" to "due". */
+template <class K>
+void TimerWheel <K>::expire(const uint32_t &now, std::vector <K> &due) {
+  size_t level;
+  pthread_mutex_lock(&mutex);
+  if (started == false || now <= current) {
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+  /*
+   * Stepping through a long gap, such as one between capture files, a second
+   * at a time would be slow, so sort every timer out afresh instead.
+   */
+  if (now - current > numSlots * numSlots) {
+    cascading.clear();
+    for (level = 0; level < numLevels; ++level) {
+      for (size_t slot = 0; slot < numSlots; ++slot) {
+        cascading.insert(cascading.end(), slots[level][slot].begin(),
+                         slots[level][slot].end());
+        slots[level][slot].clear();
+      }
+    }
+    current = now;
+    for (size_t i = 0; i < cascading.size(); ++i) {
+      if (cascading[i].time <= now) {
+        due.push_back(cascading[i].key);
+        --_size;
+      }
+      else {
+        place(cascading[i]);
+      }
+    }
+    cascading.clear();
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+  while (current != now) {
+    ++current;
+    /*
+     * When a level's position wraps around, the next slot of the level above
+     * it is spread over the levels below, highest level first, so that
+     * nothing is left behind in a slot that has already been passed.
+     */
+    level = 1;
+    while (level < numLevels &&
+           (current & (((uint32_t)1 << (8 * level)) - 1)) == 0) {
+      ++level;
+    }
+    while (--level > 0) {
+      cascading.swap(slots[level][(current >> (8 * level)) & (numSlots - 1)]);
+      for (size_t i = 0; i < cascading.size(); ++i) {
+        place(cascading[i]);
+      }
+      cascading.clear();
+    }
+    std::vector <Timer> &slot = slots[0][current & (numSlots - 1)];
+    for (size_t i = 0; i < slot.size(); ++i) {
+      due.push_back(slot[i].key);
+    }
+    _size -= slot.size();
+    slot.clear();
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+template <class K>
+size_t TimerWheel <K>::size() const {
+  return _size;
+}
+
+template <class K>
+TimerWheel <K>::~TimerWheel() {
+  if (initialized == true) {
+    pthread_mutex_destroy(&mutex);
+  }
+}
+
+#endif
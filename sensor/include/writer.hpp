@@ -29,9 +29,9 @@
 
 #include <queue>
 #include <string>
-#include <tr1/memory>
 
 #include <include/berkeleyDB.h>
+#include <include/memory.hpp>
 
 template <class Flow>
 class Writer {
@@ -46,9 +46,11 @@ class Writer {
     const std::string &error() const;
     template <class _Flow>
     friend void *writeFlows(void*);
-    void write(std::tr1::shared_ptr <Flow>, const uint32_t&);
+    void write(typename Memory <Flow>::Pointer, const uint32_t&);
     void flush();
     void finish();
+    size_t queued() const;
+    const Histogram &writeLatency() const;
     ~Writer();
     /* Record class. */
     class Record {
@@ -72,7 +74,9 @@ class Writer {
     std::string errorMessage;
     bool initialized;
     BerkeleyDB db;
-    std::queue <std::pair <std::tr1::shared_ptr <Flow>, uint32_t> > writeQueue;
+    std::queue <std::pair <typename Memory <Flow>::Pointer, uint32_t> > writeQueue;
+    /* The length of "writeQueue", which can be read without "queueLock". */
+    volatile size_t _queued;
     pthread_t writerThread;
     bool status;
     bool _flush;
@@ -156,8 +160,16 @@ template <class Flow>
 void Writer <Flow>::_writeFlows() {
   typedef void (*recordFunction)(Record &record, const Flow &flow);
   Record record;
-  while (_write && pthread_mutex_trylock(&writeLock) == 0) {
-    pthread_cond_wait(&writeCondition, &writeLock);
+  /*
+   * "writeLock" is only let go of while waiting, so finish() can't clear
+   * "_write" between the check and the wait and go unnoticed, and the queue
+   * is emptied once more after it has been.
+   */
+  pthread_mutex_lock(&writeLock);
+  while (true) {
+    if (_write) {
+      pthread_cond_wait(&writeCondition, &writeLock);
+    }
     pthread_mutex_lock(&statusLock);
     status = true;
     pthread_mutex_unlock(&statusLock);
@@ -168,6 +180,7 @@ void Writer <Flow>::_writeFlows() {
       pthread_mutex_lock(&queueLock);
       writeQueue.pop();
       pthread_mutex_unlock(&queueLock);
+      __sync_sub_and_fetch(&_queued, 1);
     }
     pthread_mutex_lock(&statusLock);
     status = false;
@@ -181,13 +194,17 @@ void Writer <Flow>::_writeFlows() {
     else {
       pthread_mutex_unlock(&flushLock);
     }
-    pthread_mutex_unlock(&writeLock);
+    if (!_write) {
+      break;
+    }
   }
+  pthread_mutex_unlock(&writeLock);
 }
 
 template <class Flow>
 Writer <Flow>::Writer() {
   initialized = false;
+  _queued = 0;
   _error = true;
   errorMessage = "Writer::Writer(): class not initialized";
 }
@@ -197,6 +214,7 @@ template <class Function>
 Writer <Flow>::Writer(const std::string directory, const std::string fileName,
                       const uint32_t timeout, Function function) {
   initialized = false;
+  _queued = 0;
   initialize(directory, fileName, timeout, function);
 }
 
@@ -256,8 +274,9 @@ const std::string &Writer <Flow>::error() const {
 }
 
 template <class Flow>
-void Writer <Flow>::write(std::tr1::shared_ptr <Flow> flow,
+void Writer <Flow>::write(typename Memory <Flow>::Pointer flow,
                           const uint32_t &startTime) {
+  __sync_add_and_fetch(&_queued, 1);
   pthread_mutex_lock(&queueLock);
   writeQueue.push(std::make_pair(flow, startTime));
   pthread_mutex_unlock(&queueLock);
@@ -275,17 +294,30 @@ void Writer <Flow>::flush() {
   pthread_mutex_unlock(&flushLock);
 }
 
+/*
+ * Writes out the flows still queued and stops the writer thread. No more
+ * flows may be written after it is called.
+ */
 template <class Flow>
 void Writer <Flow>::finish() {
+  pthread_mutex_lock(&writeLock);
   _write = false;
-  pthread_mutex_lock(&statusLock);
-  if (!status) {
-    pthread_cond_broadcast(&writeCondition);
-  }
-  pthread_mutex_unlock(&statusLock);
+  pthread_cond_broadcast(&writeCondition);
+  pthread_mutex_unlock(&writeLock);
   pthread_join(writerThread, NULL);
 }
 
+/* Returns the number of flows waiting to be written, from any thread. */
+template <class Flow>
+size_t Writer <Flow>::queued() const {
+  return _queued;
+}
+
+template <class Flow>
+const Histogram &Writer <Flow>::writeLatency() const {
+  return db.writeLatency();
+}
+
 template <class Flow>
 Writer <Flow>::~Writer() {
   if (initialized) {
@@ -29,42 +29,51 @@
 #include <cstring>
 #include <ctime>
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <tr1/memory>
-#include <tr1/unordered_map>
+
+#include <strings.h>
 
 #include <include/address.h>
+#include <include/clock.h>
 #include <include/configuration.h>
 #include <include/endian.h>
-#include <include/flowID.h>
+#include <include/flowKey.h>
+#include <include/flowMap.hpp>
 #include <include/httpSession.h>
 #include <include/logger.h>
 #include <include/memory.hpp>
+#include <include/metrics.h>
 #include <include/packet.h>
 #include <include/smtp.h>
+#include <include/timerWheel.hpp>
 
 #include "udpTrackerSession.h"
 
 using namespace std;
-using namespace tr1;
 
 /*
  * The session table is a hash table of shared pointers to UDPTrackerSession
- * classes with flow IDs as keys.
+ * classes, keyed by flow.
  */
-static unordered_map <string, shared_ptr <UDPTrackerSession> > sessions;
-static unordered_map <string, shared_ptr <UDPTrackerSession> >::iterator sessionItr;
-static shared_ptr <UDPTrackerSession> session;
+static FlowMap <Memory <UDPTrackerSession>::Pointer > sessions;
 /* Session memory allocator. */
 static Memory <UDPTrackerSession> memory;
 /* Locks for the session table. */
 static pthread_mutex_t *locks;
+/* When each session is next due to be checked for having timed out. */
+static TimerWheel <FlowKey> timers;
 static bool warning = true;
+/* Sessions dropped because their bucket of the session table was full. */
+static uint64_t insertFailures = 0;
+static bool insertWarning = true;
 static uint32_t timeout;
 static Logger *logger;
+/* Set by the sensor to its packet-time clock. */
+const Clock *sensorClock = NULL;
 
 static SMTP smtp;
 
@@ -90,19 +99,19 @@ static void printHTTP(const HTTPSession &session, ostringstream &message) {
     message << "Server Ethernet address:\t" << textMAC(session.serverMAC) << endl;
     message << "Server IPv4 address:\t\t" << textIP(session.serverIP) << endl;
     message << "Server port:\t\t\t" << ntohs(session.serverPort) << endl;
-    message << "Request method:\t\t\t" << session.requests[i].message[0] << endl;
-    message << "Path:\t\t\t\t" << session.requests[i].message[1] << endl;
-    if (session.requests[i].message[2].length() > 0) {
-      message << "Query string:\t\t\t" << session.requests[i].message[2] << endl;
+    message << "Request method:\t\t\t" << session.text(session.requests[i].message[0]) << endl;
+    message << "Path:\t\t\t\t" << session.text(session.requests[i].message[1]) << endl;
+    if (session.requests[i].message[2].length > 0) {
+      message << "Query string:\t\t\t" << session.text(session.requests[i].message[2]) << endl;
     }
-    if (session.requests[i].message[3].length() > 0) {
-      message << "Fragment:\t\t\t" << session.requests[i].message[3] << endl;
+    if (session.requests[i].message[3].length > 0) {
+      message << "Fragment:\t\t\t" << session.text(session.requests[i].message[3]) << endl;
     }
-    message << "Protocol version:\t\tHTTP/" << session.requests[i].message[4] << endl;
+    message << "Protocol version:\t\tHTTP/" << session.text(session.requests[i].message[4]) << endl;
     if (session.requests[i].headers.size() > 0) {
       for (size_t j = 0; j < session.requests[i].headers.size(); ++j) {
-        message << pad("Header/" + session.requests[i].headers[j].first + ':', 4)
-                << session.requests[i].headers[j].second << endl;
+        message << pad("Header/" + session.text(session.name(session.requests[i].headers[j])) + ':', 4)
+                << session.text(session.requests[i].headers[j].value) << endl;
       }
     }
   }
@@ -115,12 +124,12 @@ static void printHTTP(const HTTPSession &session, ostringstream &message) {
     message << "Server Ethernet address:\t" << textMAC(session.serverMAC) << endl;
     message << "Server IPv4 address:\t\t" << textIP(session.serverIP) << endl;
     message << "Server port:\t\t\t" << ntohs(session.serverPort) << endl;
-    message << "Protocol version:\t\tHTTP/" << session.responses[i].message[0] << endl;
-    message << "Response code:\t\t\t" << session.responses[i].message[1] << endl;
+    message << "Protocol version:\t\tHTTP/" << session.text(session.responses[i].message[0]) << endl;
+    message << "Response code:\t\t\t" << session.text(session.responses[i].message[1]) << endl;
     if (session.responses[i].headers.size() > 0) {
       for (size_t j = 0; j < session.responses[i].headers.size(); ++j) {
-        message << pad("Header/" + session.responses[i].headers[j].first + ':', 4)
-                << session.responses[i].headers[j].second << endl;
+        message << pad("Header/" + session.text(session.name(session.responses[i].headers[j])) + ':', 4)
+                << session.text(session.responses[i].headers[j].value) << endl;
       }
     }
   }
@@ -274,22 +283,40 @@ static void printUDP(const UDPTrackerSession &session, ostringstream &message) {
 extern "C" {
   int initialize(const Configuration &conf, Logger &logger, string &error) {
     int _error;
+    size_t memoryLimit = 0;
+    int memoryFlags = 0;
     timeout = conf.getNumber("timeout");
     ::logger = &logger;
-    /*
-     * Rehash the session table for as many sessions as we may need to hold in
-     * it.
-     */
-    sessions.rehash(conf.getNumber("maxSessions"));
     /*
      * Because UDPTrackerSession classes are fairly small, we will
      * pre-allocate as many of them as we may need so that we can later hand
-     * them out in constant time.
+     * them out in constant time. With "maxSessionMemory" set, the pool
+     * instead starts out that size and grows on demand until it takes up that
+     * many MiB.
      */
-    if (!memory.initialize(conf.getNumber("maxSessions"))) {
+    if (conf.getString("maxSessionMemory") != "") {
+      memoryLimit = conf.getNumber("maxSessionMemory") * 1048576;
+    }
+    if (conf.getNumber("hugePages") == 1) {
+      memoryFlags |= Memory <UDPTrackerSession>::HUGE_PAGES;
+    }
+    if (conf.getNumber("trimMemory") == 1) {
+      memoryFlags |= Memory <UDPTrackerSession>::TRIM;
+    }
+    if (!memory.initialize(conf.getNumber("maxSessions"), 1, memoryLimit,
+                           memoryFlags)) {
       error = memory.error();
       return 1;
     }
+    /* Size the session table for as many sessions as we may need to hold. */
+    if (!sessions.initialize(memory.maximum())) {
+      error = sessions.error();
+      return 1;
+    }
+    if (!timers.initialize()) {
+      error = timers.error();
+      return 1;
+    }
     /*
      * We will be locking the sessions hash table one bucket at a time, so
      * allocate one mutex per bucket.
@@ -322,9 +349,13 @@ extern "C" {
   }
 
   int processPacket(const Packet &packet) {
-    static FlowID flowID;
-    static size_t bucket;
-    static MessageType messageType;
+    FlowKey flowKey;
+    size_t bucket;
+    MessageType messageType;
+    FlowMap <Memory <UDPTrackerSession>::Pointer >::iterator sessionItr;
+    pair <FlowMap <Memory <UDPTrackerSession>::Pointer >::iterator, bool>
+      inserted;
+    Memory <UDPTrackerSession>::Pointer session;
     /*
      * Initial connection ID for the UDP tracker protocol. UDP tracker protocol
      * specification:
@@ -337,51 +368,39 @@ extern "C" {
      * as that is the minimum size of a valid message between a client and a
      * UDP tracker.
      *
-     * Also avoid spending time on fragmented packets. It seems that the sensor,
-     * as opposed to a module, is the ideal place for a fragment-reassembly
-     * engine, but none has been written yet.
+     * Also avoid spending time on fragmented packets. The sensor reassembles
+     * fragmented datagrams before modules see them, so the only fragments
+     * that get this far are ones it couldn't reassemble.
      */
     if (packet.payloadSize() < 16 || packet.fragmented() == true) {
       return 0;
     }
-    messageType = REQUEST;
-    flowID.set(packet.protocol(), packet.sourceIP(), packet.destinationIP(),
-               packet.sourcePort(), packet.destinationPort());
-    bucket = sessions.bucket(flowID.data());
     /*
-     * Lock the bucket this flow ID might belong to to prevent a race with
-     * flush().
+     * The flow key is the same for both directions of a flow, so requests
+     * and responses find the same session with a single lookup.
      */
-    pthread_mutex_lock(&(locks[bucket]));
-    /* Check the session table for a session with this flow ID. */
-    sessionItr = sessions.find(flowID.data());
+    flowKey.set(packet);
+    bucket = sessions.bucket(flowKey);
     /*
-     * If none exists, we shouldn't insert a new session into the session table
-     * just yet, as this packet might be part of the response to a request we
-     * saw earlier. The session created by that request would have been UDP
-     * traffic in the opposite direction of this packet and would have
-     * therefore had a flow ID with this packet's source IPs and ports swapped
-     * with this its destination IPs and ports, respectively, so we will craft
-     * that flow ID and look for it in the session table.
+     * Lock the bucket this flow key might belong to to prevent a race with
+     * flush().
      */
-    if (sessionItr == sessions.end()) {
-      messageType = RESPONSE;
-      pthread_mutex_unlock(&(locks[bucket]));
-      flowID.set(packet.protocol(), packet.destinationIP(), packet.sourceIP(),
-                 packet.destinationPort(), packet.sourcePort());
-      bucket = sessions.bucket(flowID.data());
-      /*
-       * Lock the bucket this flow ID might belong to to prevent a race with
-       * flush().
-       */
-      pthread_mutex_lock(&(locks[bucket]));
-      sessionItr = sessions.find(flowID.data());
-    }
+    pthread_mutex_lock(&(locks[bucket]));
+    /* Check the session table for a session with this flow key. */
+    sessionItr = sessions.find(flowKey);
     /*
      * If "sessionItr" is valid at this point, there is some request or
-     * response data to be parsed for an existing session.
+     * response data to be parsed for an existing session. Requests are the
+     * packets sent by the client.
      */
     if (sessionItr != sessions.end()) {
+      if (packet.sourceIP() == sessionItr -> second -> clientIP() &&
+          packet.sourcePort() == sessionItr -> second -> clientPort()) {
+        messageType = REQUEST;
+      }
+      else {
+        messageType = RESPONSE;
+      }
       switch (messageType) {
         case REQUEST:
           /* Store transaction ID. */
@@ -429,16 +448,15 @@ extern "C" {
     /*
      * Otherwise, this packet potentially contains data belonging to a new
      * session, so we will check for that, and, if it is the case, we will
-     * allocate a UDPTrackerSession class and insert it into the session table
-     * with the originally-computed flow ID as its key.
+     * allocate a UDPTrackerSession class and insert it into the session
+     * table.
      */
     else {
       pthread_mutex_unlock(&(locks[bucket]));
       if (*(uint64_t*)packet.payload() == initialConnectionID &&
           *(uint32_t*)(packet.payload() + 8) == CONNECT) {
-        /* Lock the memory allocator to prevent a race with flush(). */
         session = memory.allocate();
-        if (session == shared_ptr <UDPTrackerSession>()) {
+        if (session == Memory <UDPTrackerSession>::Pointer()) {
           if (warning == true) {
             logger -> lock();
             (*logger) << logger -> time()
@@ -449,29 +467,45 @@ extern "C" {
           return 0;
         } 
         session -> initialize(packet);
-        flowID.set(packet.protocol(), packet.sourceIP(),
-                   packet.destinationIP(), packet.sourcePort(),
-                   packet.destinationPort());
-        bucket = sessions.bucket(flowID.data());
         /*
-         * Lock the bucket this flow ID belongs to to prevent a race with
+         * Lock the bucket this flow key belongs to to prevent a race with
          * flush().
          */
         pthread_mutex_lock(&(locks[bucket]));
-        sessions.insert(make_pair(flowID.data(), session));
+        inserted = sessions.insert(make_pair(flowKey, session));
+        if (inserted.second == true) {
+          timers.schedule(flowKey, session -> time().seconds() + timeout);
+        }
         pthread_mutex_unlock(&(locks[bucket]));
+        if (inserted.first == sessions.end()) {
+          __sync_add_and_fetch(&insertFailures, 1);
+          if (insertWarning == true) {
+            logger -> lock();
+            (*logger) << logger -> time()
+                      << "BitTorrent module: session table bucket is full."
+                      << endl;
+            logger -> unlock();
+            insertWarning = false;
+          }
+        }
       }
     }
     return 0;
   }
 
-  int processHTTP(const shared_ptr <HTTPSession> session) {
-    static string path;
+  int processHTTP(const Memory <HTTPSession>::Pointer session) {
+    static const char infoHash[] = "info_hash";
+    const char *path, *queryString;
+    uint32_t pathLength, queryStringLength;
     for (size_t i = 0; i < session -> requests.size(); ++i) {
-      path = session -> requests[i].message[1];
+      /* Look at the path and query string where they are, without copying. */
+      path = session -> data(session -> requests[i].message[1]);
+      pathLength = session -> requests[i].message[1].length;
+      queryString = session -> data(session -> requests[i].message[2]);
+      queryStringLength = session -> requests[i].message[2].length;
       /* Detect HTTP torrent file downloads. */
-      if (path.length() >= 8 && strcasecmp(path.substr(path.length() - 8).c_str(),
-                                                       ".torrent") == 0) {
+      if (pathLength >= 8 &&
+          strncasecmp(path + pathLength - 8, ".torrent", 8) == 0) {
         /* Lock the SMTP client to prevent a race with flush(). */
         smtp.lock();
         smtp.subject() << "Torrent file download by "
@@ -489,7 +523,9 @@ extern "C" {
         smtp.unlock();
       }
       /* Detect HTTP tracker communication. */
-      if (session -> requests[i].message[2].find("info_hash") != string::npos) {
+      if (search(queryString, queryString + queryStringLength, infoHash,
+                 infoHash + sizeof(infoHash) - 1) !=
+          queryString + queryStringLength) {
         /* Lock the SMTP client to prevent a race with flush(). */
         smtp.lock();
         smtp.subject() << "HTTP tracker communication by "
@@ -512,60 +548,87 @@ extern "C" {
 
   int flush() {
     static time_t _time;
-    static unordered_map <string, shared_ptr <UDPTrackerSession> >::local_iterator localItr;
-    static vector <string> erase;
-    _time = time(NULL);
-    if (sessions.size() > 0) {
-      for (size_t i = 0; i < sessions.bucket_count(); ++i) {
+    static vector <FlowKey> due;
+    static FlowMap <Memory <UDPTrackerSession>::Pointer >::iterator sessionItr;
+    size_t bucket;
+    _time = sensorClock -> now();
+    /* Warn about full session table buckets at most once per flush() call. */
+    insertWarning = true;
+    timers.expire(_time, due);
+    for (size_t i = 0; i < due.size(); ++i) {
+      bucket = sessions.bucket(due[i]);
+      /*
+       * Lock the bucket of the session we will be checking to prevent a race
+       * with processPacket().
+       */
+      pthread_mutex_lock(&(locks[bucket]));
+      sessionItr = sessions.find(due[i]);
+      /* The session may have been removed since its timer was set. */
+      if (sessionItr == sessions.end()) {
+        pthread_mutex_unlock(&(locks[bucket]));
+        continue;
+      }
+      /*
+       * Remove a session from memory if it has been idle for at least as long
+       * as the configured idle timeout. Otherwise, check on it again when it
+       * might have been.
+       */
+      if (_time - sessionItr -> second -> time().seconds() >= timeout) {
         /*
-         * Lock the bucket in which we will be checking for timed-out sessions
-         * to prevent a race with processPacket().
+         * We're only interested in sessions with at least one announce or
+         * scrape request or response.
          */
-        pthread_mutex_lock(&(locks[i]));
-        for (localItr = sessions.begin(i); localItr != sessions.end(i);
-             ++localItr) {
-          /*
-           * Remove a session from memory if it has been idle for at least as
-           * long as the configured idle timeout.
-           */
-          if (_time - localItr -> second -> time().seconds() >= timeout) { 
-            /*
-             * We're only interested in sessions with at least one announce
-             * or scrape request or response.
-             */
-            if (localItr -> second -> announceRequests().size() > 0 ||
-                localItr -> second -> announceResponses().size() > 0) {
-              /* Lock the SMTP client to prevent a race with processHTTP(). */
-              smtp.lock();
-              smtp.subject() << "UDP tracker communication by "
-                             << textIP(localItr -> second -> clientIP()) << " ("
-                             << textMAC(localItr -> second -> clientMAC())
-                             << ") detected";
-              printUDP(*(localItr -> second), smtp.message());
-              if (!smtp.send()) {
-                logger -> lock();
-                (*logger) << logger -> time() << "BitTorrent: smtp::send(): "
-                          << smtp.error() << endl;
-                logger -> unlock();
-              }
-              smtp.subject().str("");
-              smtp.message().str("");
-              smtp.unlock();
-            }
-            erase.push_back(localItr -> first);
+        if (sessionItr -> second -> announceRequests().size() > 0 ||
+            sessionItr -> second -> announceResponses().size() > 0) {
+          /* Lock the SMTP client to prevent a race with processHTTP(). */
+          smtp.lock();
+          smtp.subject() << "UDP tracker communication by "
+                         << textIP(sessionItr -> second -> clientIP()) << " ("
+                         << textMAC(sessionItr -> second -> clientMAC())
+                         << ") detected";
+          printUDP(*(sessionItr -> second), smtp.message());
+          if (!smtp.send()) {
+            logger -> lock();
+            (*logger) << logger -> time() << "BitTorrent: smtp::send(): "
+                      << smtp.error() << endl;
+            logger -> unlock();
           }
+          smtp.subject().str("");
+          smtp.message().str("");
+          smtp.unlock();
         }
-        for (size_t j = 0; j < erase.size(); ++j) {
-          sessions.erase(sessions.find(erase[j]));
-        }
-        pthread_mutex_unlock(&(locks[i]));
-        erase.clear();
+        sessions.erase(sessionItr);
       }
+      else {
+        timers.schedule(due[i], sessionItr -> second -> time().seconds() +
+                                timeout);
+      }
+      pthread_mutex_unlock(&(locks[bucket]));
     }
+    due.clear();
+    /* Hand the pages of idle session slabs back to the kernel, if asked to. */
+    memory.trim();
+    return 0;
+  }
+
+  int metrics(string &text) {
+    const string labels = label("module", "bt");
+    appendMetric(text, "sensor_module_sessions", labels,
+                 (uint64_t)sessions.size());
+    appendMetric(text, "sensor_module_max_sessions", labels,
+                 (uint64_t)memory.maximum());
+    appendMemory(text, labels, memory);
+    appendMetric(text, "sensor_module_session_insert_failures", labels,
+                 insertFailures);
     return 0;
   }
 
   int finish() {
+    logger -> lock();
+    (*logger) << logger -> time() << "BitTorrent module: " << memory.highWaterMark()
+              << " of " << memory.maximum() << " sessions in use at peak, "
+              << memory.failures() << " allocation failures." << endl;
+    logger -> unlock();
     return 0;
   }
 }
@@ -26,47 +26,90 @@
 #include <cstring>
 #include <ctime>
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <tr1/unordered_map>
-#include <tr1/memory>
 
+#include <include/arena.h>
 #include <include/consumers.hpp>
-#include <include/flowID.h>
+#include <include/flowKey.h>
+#include <include/flowMap.hpp>
+#include <include/httpHeaderTable.h>
 #include <include/httpParser.h>
 #include <include/httpSession.h>
 #include <include/logger.h>
 #include <include/memory.hpp>
+#include <include/metrics.h>
 #include <include/module.h>
+#include <include/string.h>
+#include <include/timerWheel.hpp>
 
 using namespace std;
-using namespace tr1;
 
 /* Consumers of HTTP data must have a "processHTTP" function defined. */
 const char *callback = "processHTTP";
 static Consumers <HTTPSession> consumers;
 
 static http_parser_settings settings;
-static const Packet *_packet;
 /*
  * The session table is a hash table of shared pointers to HTTPSession
- * structures with flow IDs as keys.
+ * structures, keyed by flow.
+ */
+static FlowMap <Memory <HTTPSession>::Pointer > sessions;
+/*
+ * Session memory allocator. Each block holds an HTTPSession followed by the
+ * first "arenaSize" bytes of its arena, so most sessions never touch the
+ * heap, and "arenaUsage" adds up how much they used.
  */
-static unordered_map <string, shared_ptr <HTTPSession> > sessions;
-static unordered_map <string, shared_ptr <HTTPSession> >::iterator sessionItr;
-static shared_ptr <HTTPSession> session;
-/* Session memory allocator. */
 static Memory <HTTPSession> memory;
+static size_t blockSize;
+static size_t arenaSize = 2048;
+static Arena::Usage arenaUsage;
+/* IDs for header names, shared by all sessions. */
+static HTTPHeaderTable headerTable;
+/*
+ * Header names listed in "keepHeaders" or "dropHeaders", indexed by ID, and
+ * whether the list is of the ones to keep. Names without an ID are never
+ * listed.
+ */
+static vector <bool> listed;
+static bool keepListed = false;
+/* The most bytes of a header's value to keep, or 0 for all of them. */
+static size_t maxHeaderValue = 0;
+/* Bytes of headers not kept, and of values cut short. */
+static uint64_t droppedBytes = 0;
+static uint64_t truncatedBytes = 0;
 /* Locks for the session table. */
 static pthread_mutex_t *locks;
+/* When each session is next due to be checked for having timed out. */
+static TimerWheel <FlowKey> timers;
 static bool warning = true;
+/* Sessions dropped because their bucket of the session table was full. */
+static uint64_t insertFailures = 0;
+static bool insertWarning = true;
 static uint32_t timeout;
 static Logger *logger;
+/* Set by the sensor to its packet-time clock. */
+const Clock *sensorClock = NULL;
+
+/*
+ * The packet being parsed and the session it belongs to. The parser
+ * callbacks find this through the parser's "data" pointer rather than through
+ * globals, because processStream() may be running in several capture workers
+ * at once.
+ */
+struct Context {
+  const Packet *packet;
+  HTTPSession *session;
+};
 
 static int url(http_parser *parser, const char *url __attribute__((unused)),
                size_t length __attribute__((unused))) {
+  const Packet *_packet = ((Context*)(parser -> data)) -> packet;
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
+  const char *method;
   /* Fill in session's addressing information. */
   memcpy(session -> clientMAC, _packet -> sourceMAC(), ETHER_ADDR_LEN);
   memcpy(session -> serverMAC, _packet -> destinationMAC(), ETHER_ADDR_LEN);
@@ -80,46 +123,82 @@ static int url(http_parser *parser, const char *url __attribute__((unused)),
    */
   if (session -> requestState != PATH_STATE) {
     session -> requests.push_back(HTTPMessage(HTTP_REQUEST,
-                                              _packet -> time()));
+                                              _packet -> time(),
+                                              session -> arena));
   }
   /* Record request method. */
-  session -> requests.rbegin() -> message[0] = http_method_str((http_method)(parser -> method));
+  method = http_method_str((http_method)(parser -> method));
+  session -> assign(session -> requests.rbegin() -> message[0], method,
+                    strlen(method));
   session -> requestState = URL_STATE;
   return 0;
 }
 
-static int path(http_parser *parser __attribute__((unused)), const char *path,
-                size_t length) {
+static int path(http_parser *parser, const char *path, size_t length) {
+  const Packet *_packet = ((Context*)(parser -> data)) -> packet;
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
   /*
    * Add request to session and record its time if the URL callback hasn't been
    * called prior to this.
    */
   if (session -> requestState != URL_STATE) {
     session -> requests.push_back(HTTPMessage(HTTP_REQUEST,
-                                              _packet -> time()));
+                                              _packet -> time(),
+                                              session -> arena));
   }
   /* Record request path. */
-  session -> requests.rbegin() -> message[1] = string(path, length);
+  session -> assign(session -> requests.rbegin() -> message[1], path, length);
   session -> requestState = PATH_STATE;
   return 0;
 }
 
-static int queryString(http_parser *parser __attribute__((unused)),
-                       const char *queryString, size_t length) {
-  session -> requests.rbegin() -> message[2] = string(queryString, length);
+static int queryString(http_parser *parser, const char *queryString,
+                       size_t length) {
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
+  session -> assign(session -> requests.rbegin() -> message[2], queryString,
+                    length);
   return 0;
 }
 
-static int fragment(http_parser *parser __attribute__((unused)),
-                    const char *fragment, size_t length) {
-  session -> requests.rbegin() -> message[3] = string(fragment, length);
+static int fragment(http_parser *parser, const char *fragment,
+                    size_t length) {
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
+  session -> assign(session -> requests.rbegin() -> message[3], fragment,
+                    length);
   return 0;
 }
 
+/* Returns whether to keep a header, given the ID of its name. */
+static bool keep(const uint16_t name) {
+  if (name == 0 || name >= listed.size()) {
+    return !keepListed;
+  }
+  return listed[name] == keepListed;
+}
+
+/*
+ * Returns how many of "length" more bytes of a header's value to keep, given
+ * the bytes of it kept so far, and counts the rest as truncated.
+ */
+static size_t room(const HTTPSpan &value, const size_t length) {
+  size_t _room;
+  if (maxHeaderValue == 0) {
+    return length;
+  }
+  _room = (value.length < maxHeaderValue) ? maxHeaderValue - value.length : 0;
+  if (_room < length) {
+    __sync_add_and_fetch(&truncatedBytes, length - _room);
+    return _room;
+  }
+  return length;
+}
+
 static int headerField(http_parser *parser, const char *field,
                        size_t length) {
-  static HTTPMessageState *state;
-  static vector <pair <string, string> > *headers;
+  const Packet *_packet = ((Context*)(parser -> data)) -> packet;
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
+  HTTPMessageState *state = NULL;
+  HTTPMessage::Headers *headers = NULL;
   switch (parser -> type) {
     case HTTP_REQUEST:
       state = &(session -> requestState);
@@ -137,9 +216,11 @@ static int headerField(http_parser *parser, const char *field,
         session -> serverPort = _packet -> sourcePort();
       }
       state = &(session -> responseState);
-      if (*state != HEADER_FIELD_STATE && *state != HEADER_VALUE_STATE) {
+      if (*state != HEADER_FIELD_STATE && *state != HEADER_VALUE_STATE &&
+          *state != HEADER_SKIPPED_STATE) {
         session -> responses.push_back(HTTPMessage(HTTP_RESPONSE,
-                                                   _packet -> time()));
+                                                   _packet -> time(),
+                                                   session -> arena));
       }
       headers = &(session -> responses.rbegin() -> headers);
       break;
@@ -149,13 +230,13 @@ static int headerField(http_parser *parser, const char *field,
     case PATH_STATE:
     case URL_STATE:
     case COMPLETE_STATE:
-      headers -> push_back(make_pair(string(field, length), ""));
+    case HEADER_VALUE_STATE:
+    case HEADER_SKIPPED_STATE:
+      headers -> push_back(HTTPHeader());
+      session -> assign(headers -> rbegin() -> field, field, length);
       break;
     case HEADER_FIELD_STATE:
-      headers -> rbegin() -> first.append(field, length);
-      break;
-    case HEADER_VALUE_STATE:
-      headers -> push_back(make_pair(string(field, length), ""));
+      session -> append(headers -> rbegin() -> field, field, length);
       break;
   }
   *state = HEADER_FIELD_STATE;
@@ -164,8 +245,11 @@ static int headerField(http_parser *parser, const char *field,
 
 static int headerValue(http_parser *parser, const char *value,
                        size_t length) {
-  static HTTPMessageState *state;
-  static vector <pair <string, string> > *headers;
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
+  HTTPMessageState *state = NULL;
+  HTTPMessage::Headers *headers = NULL;
+  HTTPHeader *header;
+  size_t _length;
   switch (parser -> type) {
     case HTTP_REQUEST:
       state = &(session -> requestState);
@@ -178,14 +262,45 @@ static int headerValue(http_parser *parser, const char *value,
   }
   switch (*state) {
     case HEADER_FIELD_STATE:
-      headers -> rbegin() -> second = string(value, length);
+      /*
+       * The name is complete. If it has an ID, the copy of it, which is
+       * normally the last thing in the arena, is no longer needed.
+       */
+      header = &*(headers -> rbegin());
+      header -> name = headerTable.intern(header -> field.begin,
+                                          header -> field.length);
+      /*
+       * A header that isn't wanted is taken back out of the message, and
+       * none of its value is copied.
+       */
+      if (!keep(header -> name)) {
+        __sync_add_and_fetch(&droppedBytes, header -> field.length + length);
+        session -> arena.retract(header -> field.begin,
+                                 header -> field.length);
+        headers -> pop_back();
+        *state = HEADER_SKIPPED_STATE;
+        return 0;
+      }
+      if (header -> name != 0) {
+        session -> arena.retract(header -> field.begin,
+                                 header -> field.length);
+        header -> field = HTTPSpan();
+      }
+      session -> assign(header -> value, value, room(header -> value, length));
       break;
     case HEADER_VALUE_STATE:
-      headers -> rbegin() -> second.append(value, length);
+      _length = room(headers -> rbegin() -> value, length);
+      if (_length > 0) {
+        session -> append(headers -> rbegin() -> value, value, _length);
+      }
       break;
+    case HEADER_SKIPPED_STATE:
+      __sync_add_and_fetch(&droppedBytes, length);
+      return 0;
     /*
-     * "state" can only be "HEADER_FIELD_STATE" or "HEADER_VALUE_STATE" during
-     * this function call, but we have to do this to keep compilers happy.
+     * "state" can only be "HEADER_FIELD_STATE", "HEADER_VALUE_STATE" or
+     * "HEADER_SKIPPED_STATE" during this function call, but we have to do this
+     * to keep compilers happy.
      */
     default:
       break;
@@ -195,12 +310,15 @@ static int headerValue(http_parser *parser, const char *value,
 }
 
 static int headersComplete(http_parser *parser) {
-  static ostringstream message;
+  const Packet *_packet = ((Context*)(parser -> data)) -> packet;
+  HTTPSession *session = ((Context*)(parser -> data)) -> session;
+  ostringstream message;
   switch (parser -> type) {
     case HTTP_REQUEST:
       /* Record request HTTP version. */
       message << parser -> http_major << '.' << parser -> http_major;
-      session -> requests.rbegin() -> message[4] = message.str();
+      session -> assign(session -> requests.rbegin() -> message[4],
+                        message.str().data(), message.str().size());
       message.str("");
       session -> requestState = COMPLETE_STATE;
       break;
@@ -211,23 +329,29 @@ static int headersComplete(http_parser *parser) {
        * structure. However, a response is not required to contain headers, so
        * we handle that possibility here.
        */
-      if (session -> responseState != HEADER_VALUE_STATE) {
+      if (session -> responseState != HEADER_VALUE_STATE &&
+          session -> responseState != HEADER_SKIPPED_STATE) {
         session -> responses.push_back(HTTPMessage(HTTP_RESPONSE,
-                                                   _packet -> time()));
+                                                   _packet -> time(),
+                                                   session -> arena));
       }
       /* Record response HTTP version. */
       message << parser -> http_major << '.' << parser -> http_minor;
-      session -> responses.rbegin() -> message.push_back(message.str());
+      session -> responses.rbegin() -> message.push_back(HTTPSpan());
+      session -> assign(*(session -> responses.rbegin() -> message.rbegin()),
+                        message.str().data(), message.str().size());
       message.str("");
       /* Record response HTTP status code. */
       message << parser -> status_code;
-      session -> responses.rbegin() -> message.push_back(message.str());
+      session -> responses.rbegin() -> message.push_back(HTTPSpan());
+      session -> assign(*(session -> responses.rbegin() -> message.rbegin()),
+                        message.str().data(), message.str().size());
       message.str("");
       /* Remove a session from memory if this is its last message. */
       if (http_should_keep_alive(parser) == 0) {
         /*
          * The appropriate bucket in the session table has been locked in
-         * processPacket() before this function call, so there is no need to
+         * processStream() before this function call, so there is no need to
          * lock it here.
          */
         /*if (sessionItr != sessions.end()) {
@@ -244,27 +368,105 @@ static int headersComplete(http_parser *parser) {
   return 0;
 }
 
+/*
+ * Returns the time at which a session times out, which is "timeout" seconds
+ * after it started or after its latest request or response, whichever comes
+ * first.
+ */
+static uint32_t expiry(const HTTPSession &session) {
+  uint32_t _expiry = session.time.seconds() + timeout;
+  if (session.requests.size() > 0 &&
+      session.requests.rbegin() -> time.seconds() != 0) {
+    _expiry = min(_expiry, session.requests.rbegin() -> time.seconds() + timeout);
+  }
+  if (session.responses.size() > 0 &&
+      session.responses.rbegin() -> time.seconds() != 0) {
+    _expiry = min(_expiry, session.responses.rbegin() -> time.seconds() + timeout);
+  }
+  return _expiry;
+}
+
 extern "C" {
   int initialize(const Configuration &conf, Logger &logger,
                  const vector <void*> &callbacks, string &error) {
     int _error;
+    vector <string> names;
+    uint16_t name;
+    size_t memoryLimit = 0, maxHeaderNames = 1024;
+    int memoryFlags = 0;
     timeout = conf.getNumber("timeout");
     ::logger = &logger;
-    /*
-     * Rehash the session table for as many sessions as we may need to hold in
-     * it.
-     */
-    sessions.rehash(conf.getNumber("maxSessions"));
     /*
      * Because HTTPSession structures will be allocated very frequently (as
      * often as once per TCP packet with a payload, depending on this module's
      * filter string), we will pre-allocate as many of them as we may need so
-     * that we can later hand them out in constant time.
+     * that we can later hand them out in constant time. With
+     * "maxSessionMemory" set, the pool instead starts out that size and grows
+     * on demand until it takes up that many MiB.
+     */
+    if (conf.getString("maxSessionMemory") != "") {
+      memoryLimit = conf.getNumber("maxSessionMemory") * 1048576;
+    }
+    if (conf.getNumber("hugePages") == 1) {
+      memoryFlags |= Memory <HTTPSession>::HUGE_PAGES;
+    }
+    if (conf.getNumber("trimMemory") == 1) {
+      memoryFlags |= Memory <HTTPSession>::TRIM;
+    }
+    if (conf.getString("arenaSize") != "") {
+      arenaSize = conf.getNumber("arenaSize");
+    }
+    if (conf.getString("maxHeaderNames") != "") {
+      maxHeaderNames = conf.getNumber("maxHeaderNames");
+    }
+    if (!headerTable.initialize(maxHeaderNames)) {
+      error = headerTable.error();
+      return 1;
+    }
+    /*
+     * Give each listed header name an ID up front, so that whether to keep a
+     * header comes down to looking up its ID.
      */
-    if (!memory.initialize(conf.getNumber("maxSessions"))) {
+    if (conf.getString("keepHeaders") != "" &&
+        conf.getString("dropHeaders") != "") {
+      error = "only one of \"keepHeaders\" and \"dropHeaders\" may be set";
+      return 1;
+    }
+    if (conf.getString("keepHeaders") != "") {
+      explode(names, conf.getString("keepHeaders"));
+      keepListed = true;
+    }
+    else if (conf.getString("dropHeaders") != "") {
+      explode(names, conf.getString("dropHeaders"));
+    }
+    listed.assign(numKnownHeaders + 1 + maxHeaderNames, false);
+    for (size_t i = 0; i < names.size(); ++i) {
+      name = headerTable.intern(names[i].data(), names[i].length());
+      if (name == 0) {
+        error = "more header names listed than \"maxHeaderNames\" allows";
+        return 1;
+      }
+      listed[name] = true;
+    }
+    if (conf.getString("maxHeaderValue") != "") {
+      maxHeaderValue = conf.getNumber("maxHeaderValue");
+    }
+    blockSize = 1 + (arenaSize + sizeof(HTTPSession) - 1) /
+                sizeof(HTTPSession);
+    if (!memory.initialize(conf.getNumber("maxSessions"), blockSize,
+                           memoryLimit, memoryFlags)) {
       error = memory.error();
       return 1;
     }
+    /* Size the session table for as many sessions as we may need to hold. */
+    if (!sessions.initialize(memory.maximum())) {
+      error = sessions.error();
+      return 1;
+    }
+    if (!timers.initialize()) {
+      error = timers.error();
+      return 1;
+    }
     /*
      * We will be locking the sessions hash table one bucket at a time, so
      * allocate one mutex per bucket.
@@ -295,69 +497,60 @@ extern "C" {
     return 0;
   }
 
-  int processPacket(const Packet &packet) {
+  /*
+   * Called with each run of a connection's data in order, or with "data" set
+   * to NULL when the sensor gives up on "length" bytes of it.
+   */
+  int processStream(const Packet &packet, const u_char *data,
+                    const size_t &length) {
     /*
-     * The flow ID uniquely identifies a session between a client and server.
+     * The flow key uniquely identifies a session between a client and server.
      */
-    static FlowID flowID;
-    static size_t parser, bucket;
-    static int parsed;
+    FlowKey flowKey;
+    size_t parser, bucket;
+    size_t parsed;
+    FlowMap <Memory <HTTPSession>::Pointer >::iterator sessionItr;
+    pair <FlowMap <Memory <HTTPSession>::Pointer >::iterator, bool> inserted;
+    Memory <HTTPSession>::Pointer session;
+    Context context;
     /*
-     * Avoid spending time on packets without payloads. The TCP handshake
-     * consists of three such packets, for example.
-     *
-     * Also avoid spending time on fragmented packets. It seems that the
-     * sensor, as opposed to a module, is the ideal place for a
-     * fragment-reassembly engine, but none has been written yet.
+     * The flow key is the same for both directions of a flow, so packets
+     * going either way find the same session with a single lookup.
      */
-    if (packet.payloadSize() == 0 || packet.fragmented() == true) {
-      return 0;
-    }
-    parser = 0;
-    flowID.set(packet.protocol(), packet.sourceIP(), packet.destinationIP(),
-               packet.sourcePort(), packet.destinationPort());
-    bucket = sessions.bucket(flowID.data());
+    flowKey.set(packet);
+    bucket = sessions.bucket(flowKey);
     /*
-     * Lock the bucket this flow ID might belong to to prevent a race with
+     * Lock the bucket this flow key might belong to to prevent a race with
      * flush().
      */
     pthread_mutex_lock(&(locks[bucket]));
-    /* Check the session table for a session with this flow ID. */
-    sessionItr = sessions.find(flowID.data());
+    /* Check the session table for a session with this flow key. */
+    sessionItr = sessions.find(flowKey);
     /*
-     * If none exists, we shouldn't insert a new session into the session table
-     * just yet, as this packet might be part of the response to a request we
-     * saw earlier. The session created by that request would have been TCP
-     * traffic in the opposite direction of this packet and would have
-     * therefore had a flow ID with this packet's source IPv4 addresses and
-     * ports swapped with this its destination IPv4 addresses and ports,
-     * respectively, so we will craft that flow ID and look for it in the
-     * session table.
+     * The parsers can't pick up after a hole in the data, so the session is
+     * given up on. A later request on the same connection starts a new one.
      */
-    if (sessionItr == sessions.end()) {
+    if (data == NULL) {
+      if (sessionItr != sessions.end()) {
+        sessions.erase(sessionItr);
+      }
       pthread_mutex_unlock(&(locks[bucket]));
-      parser = 1;
-      flowID.set(packet.protocol(), packet.destinationIP(), packet.sourceIP(),
-                 packet.destinationPort(), packet.sourcePort());
-      bucket = sessions.bucket(flowID.data());
-      /*
-       * Lock the bucket this flow ID might belong to to prevent a race with
-       * flush().
-       */
-      pthread_mutex_lock(&(locks[bucket]));
-      sessionItr = sessions.find(flowID.data());
+      return 0;
     }
     /*
      * If "sessionItr" is valid at this point, there is some request or
-     * response data to be parsed for an existing session.
+     * response data to be parsed for an existing session. Data going the same
+     * way as the packet that started the session goes to the first parser,
+     * and data going the other way to the second.
      */
     if (sessionItr != sessions.end()) {
-      session = sessionItr -> second;
-      _packet = &packet;
+      parser = (packet.direction() == sessionItr -> second -> direction) ? 0 : 1;
+      context.packet = &packet;
+      context.session = sessionItr -> second.get();
+      sessionItr -> second -> parsers[parser].data = &context;
       parsed = http_parser_execute(&(sessionItr -> second -> parsers[parser]),
-                                   &settings, (const char*)packet.payload(),
-                                   packet.payloadSize());
-      if (parsed != packet.payloadSize()) {
+                                   &settings, (const char*)data, length);
+      if (parsed != length) {
         if (sessionItr != sessions.end()) {
           sessions.erase(sessionItr);
         }
@@ -369,7 +562,7 @@ extern "C" {
     /*
      * Otherwise, this packet potentially contains data belonging to a new
      * session, so we will allocate an HTTPSession structure and attempt to
-     * parse the packet's payload. If the parser determines that the packet
+     * parse the data. If the parser determines that the packet
      * contains valid request or response data:
      *
      * - If the packet contains only complete responses, the session will be
@@ -378,13 +571,12 @@ extern "C" {
      *   will.
      *
      * - Otherwise, the HTTPSession structure will be inserted into the session
-     *   table with the originally-computed flow ID as its key.
+     *   table.
      */
     else {
       pthread_mutex_unlock(&(locks[bucket]));
-      /* Lock the memory allocator to prevent a race with flush(). */
       session = memory.allocate();
-      if (session == shared_ptr <HTTPSession>()) {
+      if (session == Memory <HTTPSession>::Pointer()) {
         if (warning == true) {
           logger -> lock();
           (*logger) << logger -> time()
@@ -394,81 +586,135 @@ extern "C" {
         }
         return 0;
       }
-      _packet = &packet;
+      session -> arena.initialize((char*)(session.get() + 1),
+                                  (blockSize - 1) * sizeof(HTTPSession),
+                                  arenaSize, &arenaUsage);
+      session -> headerTable = &headerTable;
+      context.packet = &packet;
+      context.session = session.get();
+      session -> parsers[0].data = &context;
       session -> time = packet.time();
+      session -> direction = packet.direction();
       parsed = http_parser_execute(&(session -> parsers[0]), &settings,
-                                   (const char*)packet.payload(),
-                                   packet.payloadSize());
-      if (parsed != packet.payloadSize()) {
+                                   (const char*)data, length);
+      if (parsed != length) {
         return 0;
       }
-      flowID.set(packet.protocol(), packet.sourceIP(),
-                 packet.destinationIP(), packet.sourcePort(),
-                 packet.destinationPort());
-      bucket = sessions.bucket(flowID.data());
       /*
-       * Lock the bucket this flow ID belongs to to prevent a race with
+       * Lock the bucket this flow key belongs to to prevent a race with
        * flush().
        */
       pthread_mutex_lock(&(locks[bucket]));
-      sessionItr = sessions.insert(make_pair(flowID.data(), session)).first;
+      inserted = sessions.insert(make_pair(flowKey, session));
+      if (inserted.second == true) {
+        timers.schedule(flowKey, expiry(*session));
+      }
       pthread_mutex_unlock(&(locks[bucket]));
+      /* The session is dropped if its bucket of the session table is full. */
+      if (inserted.first == sessions.end()) {
+        __sync_add_and_fetch(&insertFailures, 1);
+        if (insertWarning == true) {
+          logger -> lock();
+          (*logger) << logger -> time()
+                    << "HTTP module: session table bucket is full." << endl;
+          logger -> unlock();
+          insertWarning = false;
+        }
+      }
     }
     return 0;
   }
 
   int flush() {
     static time_t _time;
-    static unordered_map <string, shared_ptr <HTTPSession> >::local_iterator localItr;
-    static vector <pair <string, shared_ptr <HTTPSession> > > erase;
-    _time = time(NULL);
+    static vector <FlowKey> due;
+    static FlowMap <Memory <HTTPSession>::Pointer >::iterator sessionItr;
+    static uint32_t _expiry;
+    size_t bucket;
+    _time = sensorClock -> now();
     /*
      * To avoid cluttering the log, only warn about the session table being
      * full a maximum of once per flush() call.
      */
     warning = true;
-    if (sessions.size() > 0) {
-      for (size_t i = 0; i < sessions.bucket_count(); ++i) {
+    insertWarning = true;
+    timers.expire(_time, due);
+    for (size_t i = 0; i < due.size(); ++i) {
+      bucket = sessions.bucket(due[i]);
+      /*
+       * Lock the bucket of the session we will be checking to prevent a race
+       * with processStream().
+       */
+      pthread_mutex_lock(&(locks[bucket]));
+      sessionItr = sessions.find(due[i]);
+      /* The session may have been removed since its timer was set. */
+      if (sessionItr != sessions.end()) {
+        _expiry = expiry(*(sessionItr -> second));
         /*
-         * Lock the bucket in which we will be checking for timed-out sessions
-         * to prevent a race with processPacket().
+         * Remove a session from memory if it has been idle for at least as
+         * long as the configured idle timeout. Otherwise, check on it again
+         * when it might have been.
          */
-        pthread_mutex_lock(&(locks[i]));
-        for (localItr = sessions.begin(i); localItr != sessions.end(i);
-             ++localItr) {
-          /*
-           * Remove a session from memory if it has been idle for at last as
-           * long as the configured idle timeout.
-           */
-          if ((localItr -> second -> requests.size() > 0 &&
-               localItr -> second -> requests.rbegin() -> time.seconds() != 0 &&
-               _time - localItr -> second -> requests.rbegin() -> time.seconds() >= timeout) ||
-              (localItr -> second -> responses.size() > 0 &&
-               localItr -> second -> responses.rbegin() -> time.seconds() != 0 &&
-               _time - localItr -> second -> responses.rbegin() -> time.seconds() >= timeout) ||
-               _time - localItr -> second -> time.seconds() >= timeout) {
-              erase.push_back(make_pair(localItr -> first, localItr -> second));
-          }
-        }
-        for (size_t j = 0; j < erase.size(); ++j) { 
+        if (_expiry <= (uint32_t)_time) {
           /*
            * We're only interested in doing anything with sessions with at
            * least one request or response.
            */
-          if (erase[j].second -> requests.size() > 0 ||
-              erase[j].second -> responses.size() > 0) {
-            consumers.consume(erase[j].second);
+          if (sessionItr -> second -> requests.size() > 0 ||
+              sessionItr -> second -> responses.size() > 0) {
+            consumers.consume(sessionItr -> second);
           }
-          sessions.erase(sessions.find(erase[j].first));
+          sessions.erase(sessionItr);
+        }
+        else {
+          timers.schedule(due[i], _expiry);
         }
-        pthread_mutex_unlock(&(locks[i]));
-        erase.clear();
       }
-    } 
+      pthread_mutex_unlock(&(locks[bucket]));
+    }
+    due.clear();
+    /* Hand the pages of idle session slabs back to the kernel, if asked to. */
+    memory.trim();
+    return 0;
+  }
+
+  int metrics(string &text) {
+    const string labels = label("module", "http");
+    appendMetric(text, "sensor_module_sessions", labels,
+                 (uint64_t)sessions.size());
+    appendMetric(text, "sensor_module_max_sessions", labels,
+                 (uint64_t)memory.maximum());
+    appendMemory(text, labels, memory);
+    appendMetric(text, "sensor_module_session_insert_failures", labels,
+                 insertFailures);
+    appendMetric(text, "sensor_module_arenas_released", labels,
+                 arenaUsage.arenas);
+    appendMetric(text, "sensor_module_arena_bytes", labels, arenaUsage.bytes);
+    appendMetric(text, "sensor_module_arena_chunks", labels,
+                 arenaUsage.chunks);
+    appendMetric(text, "sensor_module_header_names", labels,
+                 (uint64_t)headerTable.size());
+    appendMetric(text, "sensor_module_header_name_overflows", labels,
+                 headerTable.overflows());
+    appendMetric(text, "sensor_module_header_bytes_dropped", labels,
+                 droppedBytes);
+    appendMetric(text, "sensor_module_header_bytes_truncated", labels,
+                 truncatedBytes);
     return 0;
   }
 
   int finish() {
+    logger -> lock();
+    (*logger) << logger -> time() << "HTTP module: " << memory.highWaterMark()
+              << " of " << memory.maximum() << " sessions in use at peak, "
+              << memory.failures() << " allocation failures." << endl;
+    if (arenaUsage.arenas > 0) {
+      (*logger) << logger -> time() << "HTTP module: sessions used "
+                << arenaUsage.bytes / arenaUsage.arenas << " bytes of "
+                << arenaSize << " reserved on average, and allocated "
+                << arenaUsage.chunks << " more chunks." << endl;
+    }
+    logger -> unlock();
     return 0;
   }
 }
@@ -24,19 +24,47 @@
 
 #include <string>
 #include <vector>
-#include <tr1/memory>
 
 #include <include/configuration.h>
+#include <include/httpHeaders.h>
 #include <include/httpSession.h>
 #include <include/logger.h>
+#include <include/memory.hpp>
+#include <include/metrics.h>
 #include <include/writer.hpp>
 
 using namespace std;
-using namespace tr1;
 
 static uint32_t timeout;
 static Writer <HTTPSession> writer;
-static uint8_t version = 1;
+static uint8_t version = 2;
+
+/*
+ * Writes the size of a span of the session's bytes, followed by the bytes
+ * themselves, straight from the session.
+ */
+static void span(Writer <HTTPSession>::Record &record,
+                 const HTTPSession &session, const HTTPSpan &span) {
+  record += htonl(span.length);
+  record.append(session.data(span), span.length);
+}
+
+/*
+ * Writes a header. Well-known names are written as their 16-bit numbers from
+ * httpHeaders.h; other names, including those that only the HTTP module's
+ * header table has numbers for, are written as 0 followed by the name.
+ */
+static void header(Writer <HTTPSession>::Record &record,
+                   const HTTPSession &session, const HTTPHeader &header) {
+  if (header.name != 0 && header.name <= numKnownHeaders) {
+    record += htons(header.name);
+  }
+  else {
+    record += htons((uint16_t)0);
+    span(record, session, session.name(header));
+  }
+  span(record, session, header.value);
+}
 
 /* Converts a session in memory to on-disk format. */
 static void makeRecord(Writer <HTTPSession>::Record &record,
@@ -70,22 +98,12 @@ static void makeRecord(Writer <HTTPSession>::Record &record,
     /* Number of message components. */
     record += htonl((uint32_t)session.requests[i].message.size());
     for (size_t j = 0; j < session.requests[i].message.size(); ++j) {
-      /* Message component size. */
-      record += htonl((uint32_t)session.requests[i].message[j].size());
-      /* Message compnent. */
-      record += session.requests[i].message[j];
+      span(record, session, session.requests[i].message[j]);
     }
     /* Number of headers. */
     record += htonl((uint32_t)session.requests[i].headers.size());
     for (size_t j = 0; j < session.requests[i].headers.size(); ++j) {
-      /* Header field size. */
-      record += htonl((uint32_t)session.requests[i].headers[j].first.size());
-      /* Header field. */
-      record += session.requests[i].headers[j].first;
-      /* Header value size. */
-      record += htonl((uint32_t)session.requests[i].headers[j].second.size());
-      /* Header value. */
-      record += session.requests[i].headers[j].second;
+      header(record, session, session.requests[i].headers[j]);
     }
   }
   /* Responses. */
@@ -99,22 +117,12 @@ static void makeRecord(Writer <HTTPSession>::Record &record,
     /* Number of message components. */
     record += htonl((uint32_t)session.responses[i].message.size());
     for (size_t j = 0; j < session.responses[i].message.size(); ++j) {
-      /* Message component size. */
-      record += htonl((uint32_t)session.responses[i].message[j].size());
-      /* Message compnent. */
-      record += session.responses[i].message[j];
+      span(record, session, session.responses[i].message[j]);
     }
     /* Number of headers. */
     record += htonl((uint32_t)session.responses[i].headers.size());
     for (size_t j = 0; j < session.responses[i].headers.size(); ++j) {
-      /* Header field size. */
-      record += htonl((uint32_t)session.responses[i].headers[j].first.size());
-      /* Header field. */
-      record += session.responses[i].headers[j].first;
-      /* Header value size. */
-      record += htonl((uint32_t)session.responses[i].headers[j].second.size());
-      /* Header value. */
-      record += session.responses[i].headers[j].second;
+      header(record, session, session.responses[i].headers[j]);
     }
   }
 }
@@ -131,7 +139,7 @@ extern "C" {
     return 0;
   }
 
-  int processHTTP(const shared_ptr <HTTPSession> session) {
+  int processHTTP(const Memory <HTTPSession>::Pointer session) {
     writer.write(session, session -> time.seconds());
     return 0;
   }
@@ -145,6 +153,15 @@ extern "C" {
     return 0;
   }
 
+  int metrics(string &text) {
+    const string labels = label("module", "httpLog");
+    appendMetric(text, "sensor_module_writer_queued", labels,
+                 (uint64_t)writer.queued());
+    appendSummary(text, "sensor_module_db_write_seconds", labels,
+                  writer.writeLatency(), 1e-9);
+    return 0;
+  }
+
   int finish() {
     return 0;
   }
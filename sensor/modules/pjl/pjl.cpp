@@ -27,32 +27,28 @@
 #include <cstring>
 
 #include <string>
-#include <vector>
-#include <tr1/memory>
 
 #include <include/configuration.h>
-#include <include/flowID.h>
+#include <include/flowTable.h>
 #include <include/logger.h>
 #include <include/memory.hpp>
+#include <include/metrics.h>
 #include <include/module.h>
 #include <include/writer.hpp>
 
 #include "pjlSession.h"
 
 using namespace std;
-using namespace tr1;
 
 /*
- * The session table is a hash table of shared pointers to PJLSession
- * structures with flow IDs as keys.
+ * Each connection's session lives in the sensor's flow table, as a shared
+ * pointer to a PJLSession structure that is null until the connection's
+ * first data arrives. The sensor only ever touches a flow from the worker
+ * that owns it, so sessions need no locks of their own.
  */
-static unordered_map <string, shared_ptr <PJLSession> > sessions;
-static unordered_map <string, shared_ptr <PJLSession> >::iterator itr;
-static shared_ptr <PJLSession> session;
+FlowSlot flowSlot = { sizeof(Memory <PJLSession>::Pointer), 0 };
 /* Session memory allocator. */
 static Memory <PJLSession> memory;
-/* Locks for the session table. */
-static pthread_mutex_t *locks;
 //static uint64_t bufferSize;
 static uint32_t timeout;
 static Logger *logger;
@@ -140,37 +136,35 @@ static void parse(PJLSession &session) {
 
 extern "C" {
   int initialize(const Configuration &conf, Logger &logger, string &error) {
-    int _error;
+    size_t memoryLimit = 0;
+    int memoryFlags = 0;
     timeout = conf.getNumber("timeout");
     ::logger = &logger;
     /*
-     * Rehash the session table for as many sessions as we may need to hold in
-     * it.
+     * Pre-allocate "maxSessions" sessions, or, with "maxSessionMemory" set,
+     * start out with that many and grow on demand until the pool takes up
+     * that many MiB.
      */
-    sessions.rehash(conf.getNumber("maxSessions"));
-    if (!memory.initialize(conf.getNumber("maxSessions"))) {
+    if (conf.getString("maxSessionMemory") != "") {
+      memoryLimit = conf.getNumber("maxSessionMemory") * 1048576;
+    }
+    if (conf.getNumber("hugePages") == 1) {
+      memoryFlags |= Memory <PJLSession>::HUGE_PAGES;
+    }
+    if (conf.getNumber("trimMemory") == 1) {
+      memoryFlags |= Memory <PJLSession>::TRIM;
+    }
+    if (!memory.initialize(conf.getNumber("maxSessions"), 1, memoryLimit,
+                           memoryFlags)) {
       error = memory.error();
       return 1;
     }
     //bufferSize = conf.getNumber("maxBufferSize") * 1024 * 1024;
     /*
-     * We will be locking the sessions hash table one bucket at a time, so
-     * allocate one mutex per bucket.
+     * Sessions are written out when the sensor forgets their flows, which may
+     * be a while after they start, so keep each hour's database open for
+     * "timeout" seconds past the end of the hour.
      */
-    locks = new(nothrow) pthread_mutex_t[sessions.bucket_count()];
-    if (locks == NULL) {
-      error = "malloc(): ";
-      error += strerror(errno);
-      return 1;
-    }
-    for (size_t i = 0; i < sessions.bucket_count(); ++i) {
-      _error = pthread_mutex_init(&(locks[i]), NULL);
-      if (_error != 0) {
-        error = "pthread_mutex_init(): ";
-        error += strerror(_error);
-        return 1;
-      }
-    }
     if (!writer.initialize(conf.getString("data"), "pjl", timeout,
                            &makeRecord)) {
       error = writer.error();
@@ -179,38 +173,25 @@ extern "C" {
     return 0;
   }
 
-  int processPacket(const Packet &packet) {
-    /*
-     * The flow ID uniquely identifies a session between a client and server.
-     */
-    static FlowID flowID;
-    static size_t bucket;
-    static const u_char *start, *end;
-    /*
-     * Avoid spending time on packets without payloads. The TCP handshake
-     * consists of three such packets, for example.
-     *
-     * Also avoid spending time on fragmented packets. It seems that the
-     * sensor, as opposed to a module, is the ideal place for a
-     * fragment-reassembly engine, but none has been written yet.
-     */
-    if (packet.payloadSize() == 0 || packet.fragmented() == true) {
+  /*
+   * Called with each run of a connection's data in order, or with "data" set
+   * to NULL when the sensor gives up on "length" bytes of it.
+   */
+  int processStream(const Packet &packet, const u_char *data,
+                    const size_t &length) {
+    const u_char *start, *end;
+    Memory <PJLSession>::Pointer *_session;
+    _session = (Memory <PJLSession>::Pointer*)packet.state(flowSlot);
+    if (_session == NULL) {
       return 0;
     }
-    flowID.set(packet.protocol(), packet.sourceIP(), packet.destinationIP(),
-               packet.sourcePort(), packet.destinationPort());
-    bucket = sessions.bucket(flowID.data());
-    /*
-     * Lock the bucket this flow ID might belong to to prevent a race with
-     * flush().
-     */
-    pthread_mutex_lock(&(locks[bucket]));
-    /* Check the session table for a session with this flow ID. */
-    itr = sessions.find(flowID.data());
-    if (itr == sessions.end()) {
+    Memory <PJLSession>::Pointer &session = *_session;
+    if (session == Memory <PJLSession>::Pointer()) {
+      if (data == NULL) {
+        return 0;
+      }
       session = memory.allocate();
-      if (session == shared_ptr <PJLSession>()) {
-        pthread_mutex_unlock(&(locks[bucket]));
+      if (session == Memory <PJLSession>::Pointer()) {
         if (sessionWarning == true) {
           logger -> lock();
           (*logger) << logger -> time()
@@ -220,55 +201,66 @@ extern "C" {
         }
         return 0;
       }
-      itr = sessions.insert(make_pair(flowID.data(), session)).first;
-      itr -> second -> startTime = packet.time();
-      memcpy(itr -> second -> clientMAC, packet.sourceMAC(), ETHER_ADDR_LEN);
-      memcpy(itr -> second -> serverMAC, packet.destinationMAC(),
-             ETHER_ADDR_LEN);
-      itr -> second -> clientIP = packet.sourceIP();
-      itr -> second -> serverIP = packet.destinationIP();
-      itr -> second -> clientPort = packet.sourcePort();
-      itr -> second -> serverPort = packet.destinationPort();
-      itr -> second -> size = 0;
-      itr -> second -> pages = 0;
-      itr -> second -> outOfMemory = 0;
+      session -> startTime = packet.time();
+      memcpy(session -> clientMAC, packet.sourceMAC(), ETHER_ADDR_LEN);
+      memcpy(session -> serverMAC, packet.destinationMAC(), ETHER_ADDR_LEN);
+      session -> clientIP = packet.sourceIP();
+      session -> serverIP = packet.destinationIP();
+      session -> clientPort = packet.sourcePort();
+      session -> serverPort = packet.destinationPort();
+      session -> size = 0;
+      session -> pages = 0;
+      session -> outOfMemory = 0;
     }
-    itr -> second -> lastUpdate = packet.time().seconds();
-    itr -> second -> size += packet.payloadSize();
-    end = packet.payload();
-    end = (const u_char*)memchr(packet.payload(), '\n', packet.payloadSize());
+    session -> size += length;
+    /*
+     * The line that spans a hole is lost, but the job's size still counts the
+     * missing bytes.
+     */
+    if (data == NULL) {
+      session -> line.clear();
+      return 0;
+    }
+    end = (const u_char*)memchr(data, '\n', length);
     if (end == NULL) {
-      itr -> second -> line.append((const char*)packet.payload(),
-                                   packet.payloadSize());
+      session -> line.append((const char*)data, length);
     }
     else {
-      start = packet.payload();
+      start = data;
       while (end != NULL) {
-        itr -> second -> line.append((const char*)start, end - start);
-        parse(*(itr -> second));
-        itr -> second -> line.clear();
-        if (end < packet.payload() + packet.payloadSize() - 1) {
+        session -> line.append((const char*)start, end - start);
+        parse(*session);
+        session -> line.clear();
+        if (end < data + length - 1) {
           start = end + 1;
-          end = (const u_char*)memchr(start, '\n',
-                                      packet.payload() + packet.payloadSize() - start);
+          end = (const u_char*)memchr(start, '\n', data + length - start);
         }
         else {
-          pthread_mutex_unlock(&(locks[bucket]));
           return 0;
         }
       }
-      itr -> second -> line.append((const char*)start,
-                                   packet.payload() + packet.payloadSize() - start);
+      session -> line.append((const char*)start, data + length - start);
     }
-    pthread_mutex_unlock(&(locks[bucket]));
     return 0;
   }
 
+  /*
+   * Called by the sensor when it forgets a connection or starts it over, at
+   * which point the job is over and can be written out.
+   */
+  void releaseFlow(u_char *state) {
+    Memory <PJLSession>::Pointer &session =
+      *(Memory <PJLSession>::Pointer*)state;
+    if (session == Memory <PJLSession>::Pointer()) {
+      return;
+    }
+    parse(*session);
+    session -> line.clear();
+    writer.write(session, session -> startTime.seconds());
+    session = Memory <PJLSession>::Pointer();
+  }
+
   int flush() {
-    static time_t _time;
-    static unordered_map <string, shared_ptr <PJLSession> >::local_iterator localItr;
-    static vector <string> erase;
-    _time = time(NULL);
     /*
      * To avoid cluttering the log, only warn about the session table being
      * full, and not having any more job buffer memory, a maximum of once per
@@ -276,34 +268,8 @@ extern "C" {
      */
     sessionWarning = true;
     bufferWarning = true;
-    if (sessions.size() > 0) {
-      for (size_t i = 0; i < sessions.bucket_count(); ++i) {
-        /*
-         * Lock the bucket in which we will be checking for timed-out sessions
-         * to prevent a race with processPacket().
-         */
-        pthread_mutex_lock(&(locks[i]));
-        for (localItr = sessions.begin(i); localItr != sessions.end(i);
-             ++localItr) {
-          /*
-           * Remove a session from memory if it has been idle for at last as
-           * long as the configured idle timeout.
-           */
-          if (_time - localItr -> second -> lastUpdate >= timeout) {
-            parse(*(localItr -> second));
-            localItr -> second -> line.clear();
-            writer.write(localItr -> second,
-                         localItr -> second -> startTime.seconds());
-            erase.push_back(localItr -> first);
-          }
-        }
-        for (size_t j = 0; j < erase.size(); ++j) {
-          sessions.erase(sessions.find(erase[j]));
-        }
-        pthread_mutex_unlock(&(locks[i]));
-        erase.clear();
-      }
-    }
+    /* Hand the pages of idle session slabs back to the kernel, if asked to. */
+    memory.trim();
     /*
      * Write everything in Berkeley DB's cache to disk so that we don't lose
      * too much data in the event of a crash or power failure.
@@ -312,7 +278,28 @@ extern "C" {
     return 0;
   }
 
+  int metrics(string &text) {
+    const string labels = label("module", "pjl");
+    appendMetric(text, "sensor_module_sessions", labels,
+                 (uint64_t)memory.size());
+    appendMetric(text, "sensor_module_max_sessions", labels,
+                 (uint64_t)memory.maximum());
+    appendMemory(text, labels, memory);
+    appendMetric(text, "sensor_module_writer_queued", labels,
+                 (uint64_t)writer.queued());
+    appendSummary(text, "sensor_module_db_write_seconds", labels,
+                  writer.writeLatency(), 1e-9);
+    return 0;
+  }
+
   int finish() {
+    /* The sensor has released every flow by now, so write out their jobs. */
+    writer.finish();
+    logger -> lock();
+    (*logger) << logger -> time() << "PJL module: " << memory.highWaterMark()
+              << " of " << memory.maximum() << " sessions in use at peak, "
+              << memory.failures() << " allocation failures." << endl;
+    logger -> unlock();
     return 0;
   }
 }
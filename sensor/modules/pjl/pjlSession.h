@@ -49,7 +49,6 @@ struct PJLSession {
   uint32_t serverIP;
   uint16_t clientPort;
   uint16_t serverPort;
-  uint32_t lastUpdate;
   uint32_t size;
   std::string line;
   std::string computer;
@@ -36,24 +36,25 @@
 #include <sstream>
 #include <string>
 #include <vector>
-#include <tr1/memory>
-#include <tr1/unordered_map>
 
 #include <include/address.h>
+#include <include/clock.h>
 #include <include/configuration.h>
 #include <include/dns.h>
 #include <include/endian.h>
+#include <include/flowMap.hpp>
 #include <include/logger.h>
 #include <include/memory.hpp>
+#include <include/metrics.h>
 #include <include/packet.h>
 #include <include/smtp.h>
+#include <include/timerWheel.hpp>
 #include <include/string.h>
 
 #include "mail.hpp"
 #include "stats.hpp"
 
 using namespace std;
-using namespace tr1;
 
 /*
  * A prefix tree of internal networks whose IPv4s addresses we'll be
@@ -64,15 +65,28 @@ map <uint32_t, uint32_t> networks;
  * The stats table is a hash table of shared pointers to Stats structures with
  * IPv4 addresses as keys.
  */
-static unordered_map <uint32_t, shared_ptr <Stats> > addressStats;
+static FlowMap <Memory <Stats>::Pointer, uint32_t> addressStats;
 /* Stats memory allocator. */
 static Memory <Stats> memory;
 /* Locks for the stats table. */
 static pthread_mutex_t *locks;
+/* When each address is next due to be checked for having gone idle. */
+static TimerWheel <uint32_t> timers;
+/*
+ * Addresses that have seen packets since the last flush, which are the only
+ * ones whose rates need checking, and the lock for the list.
+ */
+static vector <uint32_t> active;
+static pthread_mutex_t activeLock;
 static bool warning = true;
+/* Addresses dropped because their bucket of the stats table was full. */
+static uint64_t insertFailures = 0;
+static bool insertWarning = true;
 static uint32_t timeout, threshold, mailInterval, lastFlush, numPackets;
 static string interface;
 static Logger *logger;
+/* Set by the sensor to its packet-time clock. */
+const Clock *sensorClock = NULL;
 
 static SMTP smtp;
 
@@ -152,13 +166,16 @@ extern "C" {
     mailInterval = conf.getNumber("mailInterval");
     interface = conf.getString("interface");
     numPackets = conf.getNumber("numPackets");
-    lastFlush = time(NULL);
+    lastFlush = sensorClock -> now();
     ::logger = &logger;
     /*
-     * Rehash the address stats table for as many IPv4 addresses as we may need
+     * Size the address stats table for as many IPv4 addresses as we may need
      * to hold in it.
      */
-    addressStats.rehash(conf.getNumber("maxIPs"));
+    if (!addressStats.initialize(conf.getNumber("maxIPs"))) {
+      error = addressStats.error();
+      return 1;
+    }
     /*
      * Because Stats structures are fairly small, we will pre-allocate as many
      * of them as we may need so that we can later hand them out in constant
@@ -168,6 +185,16 @@ extern "C" {
       error = memory.error();
       return 1;
     }
+    if (!timers.initialize()) {
+      error = timers.error();
+      return 1;
+    }
+    _error = pthread_mutex_init(&activeLock, NULL);
+    if (_error != 0) {
+      error = "pthread_mutex_init(): ";
+      error += strerror(_error);
+      return 1;
+    }
     /*
      * We will be locking the stats hash table one bucket at a time, so
      * allocate one mutex per bucket.
@@ -211,160 +238,253 @@ extern "C" {
    * in logarithmic time.
    */
   bool internal(const map <uint32_t, uint32_t> &networks, const uint32_t &ip) {
-    static map <uint32_t, uint32_t>::const_iterator itr;
-    itr = --networks.upper_bound(ip);
+    map <uint32_t, uint32_t>::const_iterator itr = --networks.upper_bound(ip);
     return (ip >= itr -> first && ip <= itr -> second);
   }
 
-  int processPacket(const Packet &packet) {
-    static size_t bucket;
-    static unordered_map <uint32_t, shared_ptr <Stats> >::iterator itr;
-    static shared_ptr <Stats> stats;
+  /*
+   * Finds the internal address of a packet, if it has one, and whether the
+   * packet is leaving or entering our networks.
+   */
+  static bool address(const Packet &packet, uint32_t &ip, bool &outgoing) {
     if (internal(networks, ntohl(packet.sourceIP())) == true) {
-      bucket = addressStats.bucket(packet.sourceIP());
-      pthread_mutex_lock(&(locks[bucket]));
-      itr = addressStats.find(packet.sourceIP());
+      ip = packet.sourceIP();
+      outgoing = true;
+      return true;
+    }
+    if (internal(networks, ntohl(packet.destinationIP())) == true) {
+      ip = packet.destinationIP();
+      outgoing = false;
+      return true;
+    }
+    return false;
+  }
+
+  /*
+   * Adds a packet to the stats of an internal address. The lock for the
+   * address's bucket must be held.
+   */
+  static void update(const uint32_t &ip, const bool &outgoing,
+                     const Packet &packet) {
+    FlowMap <Memory <Stats>::Pointer, uint32_t>::iterator itr;
+    Memory <Stats>::Pointer stats;
+    itr = addressStats.find(ip);
+    if (itr == addressStats.end()) {
+      stats = memory.allocate();
+      if (stats == Memory <Stats>::Pointer()) {
+        if (warning == true) {
+          logger -> lock();
+          (*logger) << "PPS module: stats table is full." << endl;
+          logger -> unlock();
+          warning = false;
+        }
+        return;
+      }
+      itr = addressStats.insert(make_pair(ip, stats)).first;
       if (itr == addressStats.end()) {
-        stats = memory.allocate();
-        if (stats == shared_ptr <Stats>()) {        
-          if (warning == true) {
-            logger -> lock();
-            (*logger) << "PPS module: stats table is full." << endl;
-            logger -> unlock();
-            warning = false;
-          }
-          pthread_mutex_unlock(&(locks[bucket]));
-          return 0;
+        __sync_add_and_fetch(&insertFailures, 1);
+        if (insertWarning == true) {
+          logger -> lock();
+          (*logger) << "PPS module: stats table bucket is full." << endl;
+          logger -> unlock();
+          insertWarning = false;
         }
-        itr = addressStats.insert(make_pair(packet.sourceIP(), stats)).first;
+        return;
       }
-      itr -> second -> lastUpdate = packet.time().seconds();
+      timers.schedule(ip, packet.time().seconds() + timeout);
+    }
+    /* Counters are zeroed by every flush. */
+    if (itr -> second -> incomingPackets == 0 &&
+        itr -> second -> outgoingPackets == 0) {
+      pthread_mutex_lock(&activeLock);
+      active.push_back(ip);
+      pthread_mutex_unlock(&activeLock);
+    }
+    itr -> second -> lastUpdate = packet.time().seconds();
+    if (outgoing == true) {
       ++(itr -> second -> outgoingPackets);
       itr -> second -> outgoingBytes += packet.capturedSize();
-      pthread_mutex_unlock(&(locks[bucket]));
     }
     else {
-      if (internal(networks, ntohl(packet.destinationIP())) == true) {
-        bucket = addressStats.bucket(packet.destinationIP());
-        pthread_mutex_lock(&(locks[bucket]));
-        itr = addressStats.find(packet.destinationIP());
-        if (itr == addressStats.end()) {
-          stats = memory.allocate();
-          if (stats == shared_ptr <Stats>()) {
-            if (warning == true) {
-              logger -> lock();
-              (*logger) << "PPS module: stats table is full." << endl;
-              logger -> unlock();
-              warning = false;
-            }
-            pthread_mutex_unlock(&(locks[bucket]));
-            return 0;
-          }
-          itr = addressStats.insert(make_pair(packet.destinationIP(), stats)).first;
+      ++(itr -> second -> incomingPackets);
+      itr -> second -> incomingBytes += packet.capturedSize();
+    }
+  }
+
+  int processPacket(const Packet &packet) {
+    uint32_t ip;
+    bool outgoing;
+    size_t bucket;
+    if (address(packet, ip, outgoing) == true) {
+      bucket = addressStats.bucket(ip);
+      pthread_mutex_lock(&(locks[bucket]));
+      update(ip, outgoing, packet);
+      pthread_mutex_unlock(&(locks[bucket]));
+    }
+    return 0;
+  }
+
+  /*
+   * Like processPacket(), but a bucket's lock is kept while consecutive
+   * packets keep hashing to it, as bursts to and from one host do.
+   */
+  int processPackets(const Packet *packets, size_t count) {
+    uint32_t ip;
+    bool outgoing, locked = false;
+    size_t bucket, lockedBucket = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (address(packets[i], ip, outgoing) == false) {
+        continue;
+      }
+      bucket = addressStats.bucket(ip);
+      if (locked == false || bucket != lockedBucket) {
+        if (locked == true) {
+          pthread_mutex_unlock(&(locks[lockedBucket]));
         }
-        itr -> second -> lastUpdate = packet.time().seconds();
-        ++(itr -> second -> incomingPackets); 
-        itr -> second -> incomingBytes += packet.capturedSize();
-        pthread_mutex_unlock(&(locks[bucket]));
+        pthread_mutex_lock(&(locks[bucket]));
+        lockedBucket = bucket;
+        locked = true;
       }
+      update(ip, outgoing, packets[i]);
+    }
+    if (locked == true) {
+      pthread_mutex_unlock(&(locks[lockedBucket]));
     }
     return 0;
   }
 
   int flush() {
     static time_t _time;
-    static unordered_map <uint32_t, shared_ptr <Stats> >::local_iterator localItr;
-    static vector <uint32_t> erase;
+    static vector <uint32_t> addresses, due;
+    static FlowMap <Memory <Stats>::Pointer, uint32_t>::iterator itr;
     static uint64_t incomingPPS, outgoingPPS;
     static queue <PPSMail> mailQueue;
     static vector <string> ptrRecords;
     static string ip, _ptrRecords;
     static ostringstream command;
-    _time = time(NULL);
-    if (addressStats.size() > 0) {
-      for (size_t i = 0; i < addressStats.bucket_count(); ++i) {
+    size_t bucket;
+    _time = sensorClock -> now();
+    /*
+     * A replay starts the clock only once its first packet has been read, so
+     * measure the first interval from then.
+     */
+    if (lastFlush == 0) {
+      lastFlush = sensorClock -> start();
+    }
+    /* Rates can't be computed if no time has passed. */
+    if (_time <= lastFlush) {
+      return 0;
+    }
+    pthread_mutex_lock(&activeLock);
+    addresses.swap(active);
+    pthread_mutex_unlock(&activeLock);
+    for (size_t i = 0; i < addresses.size(); ++i) {
+      bucket = addressStats.bucket(addresses[i]);
+      /*
+       * Lock the bucket of the address whose rates we will be checking to
+       * prevent a race with processPacket().
+       */
+      pthread_mutex_lock(&(locks[bucket]));
+      itr = addressStats.find(addresses[i]);
+      if (itr != addressStats.end()) {
+        incomingPPS = itr -> second -> incomingPackets / (_time - lastFlush);
+        outgoingPPS = itr -> second -> outgoingPackets / (_time - lastFlush);
+        if ((incomingPPS >= threshold || outgoingPPS >= threshold) &&
+            _time - itr -> second -> lastEmail >= mailInterval) {
+          mailQueue.push(PPSMail(itr -> first, incomingPPS, outgoingPPS,
+                                 itr -> second -> incomingBytes,
+                                 itr -> second -> outgoingBytes));
+          itr -> second -> lastEmail = _time;
+        }
+        itr -> second -> incomingPackets = 0;
+        itr -> second -> outgoingPackets = 0;
+        itr -> second -> incomingBytes = 0;
+        itr -> second -> outgoingBytes = 0;
+      }
+      pthread_mutex_unlock(&(locks[bucket]));
+      while (!mailQueue.empty()) {
+        ip = textIP(mailQueue.front().ip());
+        smtp.subject() << threshold << " Packets/s Threshold Exceeded ("
+                       << mailQueue.front().incomingPPS() << " packets/s in, "
+                       << mailQueue.front().outgoingPPS()
+                       << " packets/s out) by " << ip;
+        smtp.message() << "The IPv4 address " << ip; 
+        getPTRRecords(ptrRecords, mailQueue.front().ip());
+        if (ptrRecords.size() > 0) {
+          _ptrRecords = implode(ptrRecords, ", ");
+          ptrRecords.clear();
+          smtp.subject() << " (" << _ptrRecords << ")";
+          smtp.message() << " (" << _ptrRecords << ")";
+        }
+        smtp.message() << " has exceeded the configured threshold of "
+                       << threshold << " packets/s in one direction." << endl
+                       << endl << pad("Incoming packet rate:", 3)
+                       << mailQueue.front().incomingPPS() << "/s" << endl
+                       << pad("Outgoing packet rate:", 3)
+                       << mailQueue.front().outgoingPPS() << "/s" << endl
+                       << pad("Incoming data rate:", 3)
+                       << size(mailQueue.front().incomingBytes() / (_time - lastFlush))
+                       << "/s" << endl << pad("Outgoing data rate:", 3)
+                       << size(mailQueue.front().outgoingBytes() / (_time - lastFlush))
+                       << "/s" << endl << endl << "Another e-mail about this "
+                       << "IPv4 will not be sent for " << mailInterval
+                       << " seconds." << endl << endl;
+        command << "tcpdump -c " << numPackets << " -n -i " << interface
+                << " host " << ip;
+        smtp.message() << "# " << command.str() << endl << endl;
+        shell(smtp.message(), command.str());
+        command.str("");
+        mailQueue.pop();
+        if (!smtp.send()) {
+          logger -> lock();
+          (*logger) << logger -> time() << "PPS: smtp::send(): "
+                    << smtp.error() << endl;
+          logger -> unlock();
+        }
+        smtp.subject().str("");
+        smtp.message().str("");
+      }
+    }
+    addresses.clear();
+    timers.expire(_time, due);
+    for (size_t i = 0; i < due.size(); ++i) {
+      bucket = addressStats.bucket(due[i]);
+      pthread_mutex_lock(&(locks[bucket]));
+      itr = addressStats.find(due[i]);
+      if (itr != addressStats.end()) {
         /*
-         * Lock the bucket in which we will be checking for timed-out IPv4
-         * addresses to prevent a race with processPacket().
+         * Remove an IPv4 address from memory if it has been idle for at least
+         * as long as the configured idle timeout. Otherwise, check on it
+         * again when it might have been.
          */
-        pthread_mutex_lock(&(locks[i]));
-        for (localItr = addressStats.begin(i); localItr != addressStats.end(i);
-             ++localItr) {
-          /*
-           * Remove an IPv4 address from memory if it has been idle for at
-           * least as long as the configured idle timeout.
-           */
-          if (_time - localItr -> second -> lastUpdate >= timeout) {
-            erase.push_back(localItr -> first);
-          }
-          incomingPPS = localItr -> second -> incomingPackets / (_time - lastFlush);
-          outgoingPPS = localItr -> second -> outgoingPackets / (_time - lastFlush);
-          if ((incomingPPS >= threshold || outgoingPPS >= threshold) &&
-              _time - localItr -> second -> lastEmail >= mailInterval) {
-            mailQueue.push(PPSMail(localItr -> first, incomingPPS, outgoingPPS,
-                                   localItr -> second -> incomingBytes,
-                                   localItr -> second -> outgoingBytes));
-            localItr -> second -> lastEmail = _time; 
-          }
-          localItr -> second -> incomingPackets = 0;
-          localItr -> second -> outgoingPackets = 0;
-          localItr -> second -> incomingBytes = 0;
-          localItr -> second -> outgoingBytes = 0;
+        if (_time - itr -> second -> lastUpdate >= timeout) {
+          addressStats.erase(itr);
         }
-        for (size_t j = 0; j < erase.size(); ++j) {
-          addressStats.erase(addressStats.find(erase[j]));
-        }
-        pthread_mutex_unlock(&(locks[i]));
-        while (!mailQueue.empty()) {
-          ip = textIP(mailQueue.front().ip());
-          smtp.subject() << threshold << " Packets/s Threshold Exceeded ("
-                         << mailQueue.front().incomingPPS() << " packets/s in, "
-                         << mailQueue.front().outgoingPPS()
-                         << " packets/s out) by " << ip;
-          smtp.message() << "The IPv4 address " << ip; 
-          getPTRRecords(ptrRecords, mailQueue.front().ip());
-          if (ptrRecords.size() > 0) {
-            _ptrRecords = implode(ptrRecords, ", ");
-            ptrRecords.clear();
-            smtp.subject() << " (" << _ptrRecords << ")";
-            smtp.message() << " (" << _ptrRecords << ")";
-          }
-          smtp.message() << " has exceeded the configured threshold of "
-                         << threshold << " packets/s in one direction." << endl
-                         << endl << pad("Incoming packet rate:", 3)
-                         << mailQueue.front().incomingPPS() << "/s" << endl
-                         << pad("Outgoing packet rate:", 3)
-                         << mailQueue.front().outgoingPPS() << "/s" << endl
-                         << pad("Incoming data rate:", 3)
-                         << size(mailQueue.front().incomingBytes() / (_time - lastFlush))
-                         << "/s" << endl << pad("Outgoing data rate:", 3)
-                         << size(mailQueue.front().outgoingBytes() / (_time - lastFlush))
-                         << "/s" << endl << endl << "Another e-mail about this "
-                         << "IPv4 will not be sent for " << mailInterval
-                         << " seconds." << endl << endl;
-          command << "tcpdump -c " << numPackets << " -n -i " << interface
-                  << " host " << ip;
-          smtp.message() << "# " << command.str() << endl << endl;
-          shell(smtp.message(), command.str());
-          command.str("");
-          mailQueue.pop();
-          if (!smtp.send()) {
-            logger -> lock();
-            (*logger) << logger -> time() << "PPS: smtp::send(): "
-                      << smtp.error() << endl;
-            logger -> unlock();
-          }
-          smtp.subject().str("");
-          smtp.message().str("");
+        else {
+          timers.schedule(due[i], itr -> second -> lastUpdate + timeout);
         }
-        erase.clear();
       }
+      pthread_mutex_unlock(&(locks[bucket]));
     }
+    due.clear();
     lastFlush = _time;
     return 0;
   }
 
+  int metrics(string &text) {
+    const string labels = label("module", "pps");
+    appendMemory(text, labels, memory);
+    appendMetric(text, "sensor_module_session_insert_failures", labels,
+                 insertFailures);
+    return 0;
+  }
+
   int finish() {
+    logger -> lock();
+    (*logger) << logger -> time() << "PPS module: " << memory.highWaterMark()
+              << " of " << memory.capacity() << " addresses in use at peak, "
+              << memory.failures() << " allocation failures." << endl;
+    logger -> unlock();
     return 0;
   }
 }
@@ -24,28 +24,42 @@
 
 #include <cerrno>
 #include <csignal>
+#include <cstdio>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <limits>
 #include <map>
 
-#ifdef __FreeBSD__
-#include <sys/ioctl.h>
-#endif
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/types.h>
 
 #include <dlfcn.h>
 #include <pcap.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include <include/capture.h>
+#include <include/classifier.h>
+#include <include/clock.h>
 #include <include/configuration.h>
+#include <include/defragmenter.h>
+#include <include/flowTable.h>
+#include <include/histogram.h>
 #include <include/module.h>
 #include <include/logger.h>
+#include <include/metrics.h>
+#include <include/metricsServer.h>
 #include <include/packet.h>
+#include <include/packetBatch.h>
+#include <include/packetPool.h>
+#include <include/packetQueue.h>
 #include <include/string.h>
+#include <include/tcpReassembler.h>
 
 using namespace std;
 
@@ -54,63 +68,1072 @@ string pidFileName = "/var/run/netSensor.pid";
 Logger logger;
 vector <Module> modules;
 map <string, size_t> moduleIndex;
+Classifier classifier;
+/*
+ * Time as seen by the modules, which follows packet timestamps and falls back
+ * to the wall clock while there is no traffic.
+ */
+Clock sensorClock;
+/* The modules that consume packets, in the order given to the classifier. */
+vector <size_t> consumers;
 pthread_t flushThread;
 bool capture = true;
 size_t flushInterval;
+/*
+ * Packets are handed to modules in batches of up to "batchSize" packets if
+ * any module exports processPackets().
+ */
+size_t batchSize = 64;
+bool batching = false;
+/*
+ * When replaying capture files, flush() is called from the capture path
+ * whenever the packets' own clock passes "nextFlush", instead of from a
+ * thread that follows the wall clock.
+ */
+bool replay = false;
+uint32_t nextFlush = 0;
+/*
+ * Flows are only tracked if some module keeps state in the flow table, in
+ * which case "flowStateSize" is the combined size of every module's slot.
+ */
+size_t maxFlows = 65536, flowStateSize = 0;
+uint32_t flowTimeout = 300;
+bool tracking = false;
+/* The modules that export releaseFlow(). */
+vector <size_t> flowReleasers;
+/*
+ * IPv4 fragments are reassembled before modules see them, unless
+ * "maxDatagrams" is 0.
+ */
+size_t maxDatagrams = 1024;
+uint32_t fragmentTimeout = 30;
+Defragmenter::Policy fragmentPolicy = Defragmenter::FIRST;
+/*
+ * The consumers that export processStream(), which get TCP data in order
+ * from each worker's reassembler. The reassembler keeps its state in
+ * "streamSlot" of the flow table, and buffers at most "maxStreamMemory" MiB
+ * across all workers and "maxStreamBuffer" KiB for any one direction of a
+ * connection.
+ */
+uint64_t streamConsumers = 0;
+FlowSlot streamSlot = { 0, 0 };
+size_t maxStreamMemory = 64, maxStreamBuffer = 256;
+/* The consumers that export processPacket(). */
+uint64_t packetConsumers = 0;
+/*
+ * Modules whose configurations name a "thread" run on a thread of that name
+ * instead of on the capture workers, so a slow one holds up neither capture
+ * nor the others. "threadedConsumers" is the mask of consumers that do. Each
+ * worker feeds each module thread through a ring of "moduleQueueSize" MiB,
+ * and "working" is cleared once the workers are done, for the module threads
+ * to empty their rings and exit.
+ */
+uint64_t threadedConsumers = 0;
+size_t moduleQueueSize = 16;
+volatile bool working = true;
+/*
+ * Buffers for the packets that modules retain, up to "maxPacketMemory" MiB.
+ * The pool is left uninitialized, and retains nothing, if that is 0.
+ */
+PacketPool packetPool;
+size_t maxPacketMemory = 64;
+/*
+ * The sensor's counters are written to "statisticsFile", if one is
+ * configured, every flush interval, and served to whatever connects to
+ * "metricsAddress", if one is configured; see metricsServer.h. Module calls
+ * are only timed if either is.
+ */
+string statisticsFile;
+bool timing = false;
+string metricsAddress;
+MetricsServer metricsServer;
+/* Serializes reading the capture sources' kernel counts. */
+pthread_mutex_t statisticsLock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * If "latencySampling" is nonzero, every latencySampling-th call to a
+ * module's processPacket(), processPackets() or processStream() on each
+ * thread is timed into the module's entry in "callLatency", which is indexed
+ * like "consumers", and every call to its flush() into "flushLatency", which
+ * is indexed like "modules". Both are logged every flush interval and on
+ * SIGUSR2.
+ */
+size_t latencySampling = 0;
+vector <Histogram> callLatency;
+vector <Histogram> flushLatency;
+volatile sig_atomic_t latencyRequested = 0;
+
+/*
+ * Counts kept by each thread that handles packets. Only that thread writes
+ * them, so they need no locking, and exportMetrics() adds them up across
+ * threads. The per-module counts are indexed like "consumers": "packets" are
+ * packets handed to the module, "segments" are runs of stream data and gaps,
+ * and "cycles" are spent in the module's callbacks.
+ */
+struct Counters {
+  volatile uint64_t captured;
+  volatile uint64_t decoded;
+  /* Packets that Packet::initialize() rejected. */
+  volatile uint64_t malformed;
+  volatile uint64_t packets[64];
+  volatile uint64_t segments[64];
+  volatile uint64_t cycles[64];
+  /* Module calls since the last one timed for "callLatency". */
+  size_t sinceSample;
+};
+
+/*
+ * Counts for the main thread, when it reads packets to hand to the workers.
+ */
+Counters distributorCounters;
+/*
+ * Fragments carry no ports to hash, so the main thread reassembles them
+ * before handing packets out, lest a fragmented datagram go to a different
+ * worker than the rest of its flow. Workers that it feeds don't defragment.
+ */
+Defragmenter distributorDefragmenter;
+
+/*
+ * A capture worker. Each worker either reads from its own ring, which the
+ * kernel feeds through a fanout group, or from a queue that the main thread
+ * fills when the capture backend can't spread traffic by itself. In both
+ * cases, every packet of a given flow goes to the same worker.
+ */
+struct Worker {
+  pthread_t thread;
+  size_t index;
+  int cpu;
+  Capture *source;
+  PacketQueue queue;
+  PacketBatch batch;
+  FlowTable flows;
+  Defragmenter defragmenter;
+  TCPReassembler reassembler;
+  /*
+   * Packets that the main thread has queued for the worker, or dropped
+   * because the queue was full, and packets that the worker has finished
+   * with.
+   */
+  volatile uint64_t queued;
+  volatile uint64_t drops;
+  volatile uint64_t processed;
+  Counters counters;
+};
+
+/*
+ * A ring that carries copies of packets, and of the stream data that the
+ * reassembler finds in them, from one worker to one module thread. Its depth
+ * is "queued" less "processed".
+ */
+struct Ring {
+  PacketQueue queue;
+  volatile uint64_t queued;
+  volatile uint64_t drops;
+  volatile uint64_t maxDepth;
+  volatile uint64_t processed;
+};
+
+/*
+ * A thread that runs a group of modules. It has one ring for each worker,
+ * indexed like the workers, so every ring has a single producer, and it
+ * empties them in turn. The packets of a flow all come from one worker, so
+ * they reach its modules in the order that the worker saw them.
+ */
+struct ModuleThread {
+  pthread_t thread;
+  std::string name;
+  /* The consumers it runs, as a mask like the classifier's. */
+  uint64_t consumers;
+  vector <Ring*> rings;
+  Counters counters;
+};
+
+vector <Worker*> workers;
+vector <ModuleThread*> moduleThreads;
+/* The capture sources whose kernel counts exportMetrics() reports. */
+vector <Capture*> sources;
+
+/* What stream() needs to know about the packet that it was called for. */
+struct Delivery {
+  Worker *worker;
+  uint64_t matches;
+};
+
+/*
+ * The capture and module thread loops, instantiated for the datalink type of
+ * the capture source; see selectDecoders().
+ */
+void *(*workFunction)(void*) = NULL;
+void (*distributeFunction)(Capture&, const vector <Worker*>&) = NULL;
+void *(*serveFunction)(void*) = NULL;
 
 void signalHandler(int signal) {
   switch (signal) {
     case SIGUSR1:
       break;
+    case SIGUSR2:
+      latencyRequested = 1;
+      break;
+    case SIGINT:
     case SIGTERM:
       logger.lock();
-      logger << logger.time() << "Caught SIGTERM; exiting." << endl;
+      logger << logger.time() << "Caught " << ((signal == SIGINT) ? "SIGINT"
+                                                                 : "SIGTERM")
+             << "; exiting." << endl;
       logger.unlock();
       capture = false;
       break;
   }
 }
 
+/*
+ * Called by a worker's flow table for a flow that it is about to forget or
+ * start over, to have the modules and the reassembler let go of whatever
+ * they hold for it.
+ */
+void releaseFlow(Flow &flow, void *worker) {
+  for (size_t i = 0; i < flowReleasers.size(); ++i) {
+    Module &module = modules[flowReleasers[i]];
+    module.releaseFlow(flow.state() + module.flowSlot() -> offset);
+  }
+  if (streamConsumers != 0) {
+    TCPReassembler::release(flow, &(((Worker*)worker) -> reassembler));
+  }
+}
+
+void flushModules() {
+  uint64_t start;
+  for (size_t i = 0; i < modules.size(); ++i) {
+    if (latencySampling == 0) {
+      modules[i].flush();
+      continue;
+    }
+    start = cycles();
+    modules[i].flush();
+    flushLatency[i].record(cycles() - start);
+  }
+}
+
+/* Logs the percentiles of a latency histogram, if it has any samples. */
+void logLatency(const string &name, const string &calls,
+                const Histogram &histogram) {
+  if (histogram.count() == 0) {
+    return;
+  }
+  logger.lock();
+  logger << logger.time() << "Module " << name << ": " << histogram.count()
+         << " sampled " << calls << " calls took at most "
+         << histogram.percentile(50) << " cycles at the median, "
+         << histogram.percentile(90) << " at the 90th percentile, "
+         << histogram.percentile(99) << " at the 99th, "
+         << histogram.percentile(99.9) << " at the 99.9th and "
+         << histogram.maximum() << " in all." << endl;
+  logger.unlock();
+}
+
+void logLatencies() {
+  if (latencySampling == 0) {
+    return;
+  }
+  for (size_t i = 0; i < consumers.size(); ++i) {
+    logLatency(modules[consumers[i]].name(), "packet", callLatency[i]);
+  }
+  for (size_t i = 0; i < modules.size(); ++i) {
+    logLatency(modules[i].name(), "flush()", flushLatency[i]);
+  }
+}
+
+/*
+ * Appends the sensor's counters, and those of any modules that export
+ * "metrics", to "text" in Prometheus' text format. It is called from the
+ * flush() thread and the metrics server's, and only reads counters that the
+ * threads handling packets update without locking. The capture sources'
+ * kernel counts are read under "statisticsLock", because reading them
+ * resets the kernel's own.
+ */
+void exportMetrics(string &text) {
+  vector <const Counters*> counters;
+  vector <uint64_t> packets(consumers.size(), 0),
+                    segments(consumers.size(), 0),
+                    moduleCycles(consumers.size(), 0);
+  uint64_t captured = 0, decoded = 0, malformed = 0, queueDrops = 0,
+           received = 0, dropped = 0, ifDropped = 0, _received, _dropped,
+           _ifDropped, processed;
+  bool kernel = false;
+  string labels;
+  char worker[24];
+  counters.push_back(&distributorCounters);
+  for (size_t i = 0; i < workers.size(); ++i) {
+    counters.push_back(&(workers[i] -> counters));
+    queueDrops += workers[i] -> drops;
+  }
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    counters.push_back(&(moduleThreads[i] -> counters));
+  }
+  for (size_t i = 0; i < counters.size(); ++i) {
+    captured += counters[i] -> captured;
+    decoded += counters[i] -> decoded;
+    malformed += counters[i] -> malformed;
+    for (size_t j = 0; j < consumers.size(); ++j) {
+      packets[j] += counters[i] -> packets[j];
+      segments[j] += counters[i] -> segments[j];
+      moduleCycles[j] += counters[i] -> cycles[j];
+    }
+  }
+  pthread_mutex_lock(&statisticsLock);
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (sources[i] -> statistics(_received, _dropped, _ifDropped)) {
+      received += _received;
+      dropped += _dropped;
+      ifDropped += _ifDropped;
+      kernel = true;
+    }
+  }
+  pthread_mutex_unlock(&statisticsLock);
+  appendMetric(text, "sensor_time", "", (uint64_t)time(NULL));
+  if (kernel == true) {
+    appendMetric(text, "sensor_capture_received", "", received);
+    appendMetric(text, "sensor_capture_dropped", "", dropped);
+    appendMetric(text, "sensor_capture_interface_dropped", "", ifDropped);
+  }
+  appendMetric(text, "sensor_packets_captured", "", captured);
+  appendMetric(text, "sensor_packets_decoded", "", decoded);
+  appendMetric(text, "sensor_packets_malformed", "", malformed);
+  appendMetric(text, "sensor_worker_queue_dropped", "", queueDrops);
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    for (size_t j = 0; j < moduleThreads[i] -> rings.size(); ++j) {
+      const Ring &ring = *(moduleThreads[i] -> rings[j]);
+      /* Read "processed" first, so that it can't pass "queued". */
+      processed = ring.processed;
+      snprintf(worker, sizeof(worker), "%lu", (unsigned long)j);
+      labels = label("thread", moduleThreads[i] -> name) + ',' +
+               label("worker", worker);
+      appendMetric(text, "sensor_ring_depth", labels,
+                   ring.queued - processed);
+      appendMetric(text, "sensor_ring_dropped", labels, ring.drops);
+    }
+  }
+  if (packetPool) {
+    appendMetric(text, "sensor_packet_pool_bytes", "",
+                 (uint64_t)packetPool.size());
+    appendMetric(text, "sensor_packet_pool_limit_bytes", "",
+                 (uint64_t)packetPool.limit());
+    appendMetric(text, "sensor_packet_pool_pressure", "",
+                 packetPool.pressure());
+    appendMetric(text, "sensor_packet_pool_failures", "",
+                 packetPool.failures());
+  }
+  for (size_t i = 0; i < consumers.size(); ++i) {
+    labels = label("module", modules[consumers[i]].name());
+    appendMetric(text, "sensor_module_packets", labels, packets[i]);
+    appendMetric(text, "sensor_module_segments", labels, segments[i]);
+    appendMetric(text, "sensor_module_cycles", labels, moduleCycles[i]);
+    if (latencySampling != 0) {
+      appendSummary(text, "sensor_module_call_cycles", labels,
+                    callLatency[i], 1);
+    }
+  }
+  for (size_t i = 0; i < modules.size(); ++i) {
+    if (latencySampling != 0) {
+      appendSummary(text, "sensor_module_flush_cycles",
+                    label("module", modules[i].name()), flushLatency[i], 1);
+    }
+    if (modules[i].metrics != NULL) {
+      modules[i].metrics(text);
+    }
+  }
+}
+
+/*
+ * Writes the sensor's counters to the statistics file. The file is written
+ * under another name and renamed over the old one, so readers never see half
+ * of it.
+ */
+void writeStatistics() {
+  ofstream file;
+  string temporaryFile = statisticsFile + ".tmp", text;
+  if (statisticsFile.empty()) {
+    return;
+  }
+  exportMetrics(text);
+  file.open(temporaryFile.c_str());
+  if (!file) {
+    logger.lock();
+    logger << logger.time() << "open(): " << temporaryFile << ": "
+           << strerror(errno) << endl;
+    logger.unlock();
+    return;
+  }
+  file << text;
+  file.close();
+  if (!file) {
+    logger.lock();
+    logger << logger.time() << "write(): " << temporaryFile << ": "
+           << strerror(errno) << endl;
+    logger.unlock();
+    return;
+  }
+  if (rename(temporaryFile.c_str(), statisticsFile.c_str()) == -1) {
+    logger.lock();
+    logger << logger.time() << "rename(): " << temporaryFile << ": "
+           << strerror(errno) << endl;
+    logger.unlock();
+  }
+}
+
 void *flush(void*) {
   while (capture == true) {
-    sleep(flushInterval);
-    for (size_t i = 0; i < modules.size(); ++i) {
-      modules[i].flush();
+    /* Check for SIGUSR2 every second. */
+    for (size_t i = 0; i < flushInterval && capture == true; ++i) {
+      sleep(1);
+      if (latencyRequested != 0) {
+        latencyRequested = 0;
+        logLatencies();
+      }
+    }
+    sensorClock.tick();
+    flushModules();
+    writeStatistics();
+    logLatencies();
+  }
+  return NULL;
+}
+
+/*
+ * Returns whether a replay has reached the next time to flush modules,
+ * judging by the timestamp of the packet about to be processed.
+ */
+bool flushDue(const pcap_pkthdr &pcapHeader) {
+  if (nextFlush == 0) {
+    nextFlush = pcapHeader.ts.tv_sec + flushInterval;
+    return false;
+  }
+  if ((uint32_t)pcapHeader.ts.tv_sec < nextFlush) {
+    return false;
+  }
+  nextFlush = pcapHeader.ts.tv_sec + flushInterval;
+  return true;
+}
+
+/* Binds the calling thread to a CPU, if one was configured for it. */
+void pin(const int &cpu) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  int error;
+  if (cpu < 0) {
+    return;
+  }
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (error != 0) {
+    logger.lock();
+    logger << logger.time() << "pthread_setaffinity_np(): CPU " << cpu << ": "
+           << strerror(error) << endl;
+    logger.unlock();
+  }
+#else
+  (void)cpu;
+#endif
+}
+
+/*
+ * Queues a packet for a module thread, with the stream data that it carries,
+ * if any. A replay waits for room in the ring, but a live capture drops the
+ * packet for that thread instead of falling behind.
+ */
+void push(Ring &ring, const Packet &packet, const uint64_t &tag,
+          const u_char *data, const size_t &length) {
+  pcap_pkthdr pcapHeader;
+  uint64_t depth;
+  pcapHeader.ts.tv_sec = packet.time().seconds();
+  pcapHeader.ts.tv_usec = packet.time().microseconds();
+  pcapHeader.caplen = packet.capturedSize();
+  pcapHeader.len = packet.size();
+  while (true) {
+    if (ring.queue.push(pcapHeader, packet.packet(), tag, data, length)) {
+      ++ring.queued;
+      depth = ring.queued - ring.processed;
+      if (depth > ring.maxDepth) {
+        ring.maxDepth = depth;
+      }
+      return;
+    }
+    if (replay == false || capture == false) {
+      ++ring.drops;
+      return;
+    }
+    usleep(100);
+  }
+}
+
+/*
+ * Queues a packet for each module thread that runs any of the consumers in
+ * "matches". Stream data is passed as it would be to processStream(), and
+ * a packet queued without any is for processPacket().
+ */
+void enqueue(const Worker &worker, const Packet &packet,
+             const uint64_t &matches, const u_char *data,
+             const size_t &length) {
+  uint64_t tag;
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    tag = matches & moduleThreads[i] -> consumers;
+    if (tag != 0) {
+      push(*(moduleThreads[i] -> rings[worker.index]), packet, tag, data,
+           length);
+    }
+  }
+}
+
+/* Decides whether to time this module call for "callLatency". */
+inline bool sample(Counters &counters) {
+  if (latencySampling == 0 || ++(counters.sinceSample) < latencySampling) {
+    return false;
+  }
+  counters.sinceSample = 0;
+  return true;
+}
+
+/*
+ * Call consumer "i"'s callbacks and count what they were handed, and, if
+ * statistics are being written, the cycles that they took.
+ */
+void deliver(Counters &counters, const size_t &i, const Packet &packet) {
+  uint64_t start, elapsed;
+  bool sampled = sample(counters);
+  ++(counters.packets[i]);
+  if (timing == false && sampled == false) {
+    modules[consumers[i]].processPacket(packet);
+    return;
+  }
+  start = cycles();
+  modules[consumers[i]].processPacket(packet);
+  elapsed = cycles() - start;
+  counters.cycles[i] += elapsed;
+  if (sampled == true) {
+    callLatency[i].record(elapsed);
+  }
+}
+
+/* A batch is recorded in "callLatency" as what it took per packet. */
+void deliver(Counters &counters, const size_t &i, const Packet *packets,
+             const size_t &count) {
+  uint64_t start, elapsed;
+  bool sampled = sample(counters);
+  counters.packets[i] += count;
+  if (timing == false && sampled == false) {
+    modules[consumers[i]].processPackets(packets, count);
+    return;
+  }
+  start = cycles();
+  modules[consumers[i]].processPackets(packets, count);
+  elapsed = cycles() - start;
+  counters.cycles[i] += elapsed;
+  if (sampled == true) {
+    callLatency[i].record(elapsed / count);
+  }
+}
+
+void deliver(Counters &counters, const size_t &i, const Packet &packet,
+             const u_char *data, const size_t &length) {
+  uint64_t start, elapsed;
+  bool sampled = sample(counters);
+  ++(counters.segments[i]);
+  if (timing == false && sampled == false) {
+    modules[consumers[i]].processStream(packet, data, length);
+    return;
+  }
+  start = cycles();
+  modules[consumers[i]].processStream(packet, data, length);
+  elapsed = cycles() - start;
+  counters.cycles[i] += elapsed;
+  if (sampled == true) {
+    callLatency[i].record(elapsed);
+  }
+}
+
+/*
+ * Hands a run of reassembled TCP data to the stream consumers that matched
+ * the packet, or queues it for the module threads that run them.
+ */
+void stream(const Packet &packet, const u_char *data, const size_t &length,
+            void *_delivery) {
+  const Delivery &delivery = *(Delivery*)_delivery;
+  uint64_t matches = delivery.matches & ~threadedConsumers;
+  for (size_t i = 0; matches != 0; ++i, matches >>= 1) {
+    if ((matches & 1) != 0) {
+      deliver(delivery.worker -> counters, i, packet, data, length);
+    }
+  }
+  if ((delivery.matches & threadedConsumers) != 0) {
+    enqueue(*(delivery.worker), packet, delivery.matches & threadedConsumers,
+            data, length);
+  }
+}
+
+/*
+ * Checks which modules are interested in a packet and calls each interested
+ * module's processPacket() function with it, or queues it for the module's
+ * thread, then feeds it through the reassembler for those that want its
+ * connection's data.
+ */
+template <int linkType>
+void dispatch(Worker &worker, Packet &packet, const pcap_pkthdr &pcapHeader,
+              const u_char *pcapPacket) {
+  uint64_t matches, threadMatches;
+  Delivery delivery;
+  if (packet.initialize <linkType>(pcapHeader, pcapPacket) == false) {
+    ++(worker.counters.malformed);
+  }
+  else {
+    ++(worker.counters.decoded);
+    matches = classifier.classify <linkType>(pcapHeader, pcapPacket);
+    if (tracking == true && matches != 0) {
+      packet.setFlow(worker.flows.find(packet));
+    }
+    delivery.worker = &worker;
+    delivery.matches = matches & streamConsumers;
+    threadMatches = matches & threadedConsumers & packetConsumers;
+    matches &= ~threadedConsumers;
+    for (size_t i = 0; matches != 0; ++i, matches >>= 1) {
+      if ((matches & 1) != 0 && modules[consumers[i]].processPacket != NULL) {
+        deliver(worker.counters, i, packet);
+      }
+    }
+    if (threadMatches != 0) {
+      enqueue(worker, packet, threadMatches, NULL, 0);
+    }
+    if (delivery.matches != 0) {
+      worker.reassembler.process(packet, &stream, &delivery);
+    }
+  }
+}
+
+/*
+ * Hands a worker's batch of packets to the modules that want them: all at
+ * once to modules that export processPackets(), and one at a time to the
+ * rest, including those on module threads.
+ */
+void process(Worker &worker) {
+  PacketBatch &batch = worker.batch;
+  const Packet *packets;
+  size_t count;
+  uint64_t threadMatches;
+  Delivery delivery;
+  if (tracking == true) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].setFlow(worker.flows.find(batch[i]));
+    }
+  }
+  for (size_t i = 0; i < consumers.size(); ++i) {
+    if ((threadedConsumers & ((uint64_t)1 << i)) != 0) {
+      continue;
+    }
+    if (modules[consumers[i]].processPackets != NULL) {
+      packets = batch.select((uint64_t)1 << i, count);
+      if (count > 0) {
+        deliver(worker.counters, i, packets, count);
+      }
+    }
+    else if (modules[consumers[i]].processPacket != NULL) {
+      for (size_t j = 0; j < batch.size(); ++j) {
+        if ((batch.matches(j) & ((uint64_t)1 << i)) != 0) {
+          deliver(worker.counters, i, batch[j]);
+        }
+      }
+    }
+  }
+  if ((threadedConsumers & packetConsumers) != 0) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+      threadMatches = batch.matches(i) & threadedConsumers & packetConsumers;
+      if (threadMatches != 0) {
+        enqueue(worker, batch[i], threadMatches, NULL, 0);
+      }
+    }
+  }
+  if (streamConsumers != 0) {
+    delivery.worker = &worker;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      delivery.matches = batch.matches(i) & streamConsumers;
+      if (delivery.matches != 0) {
+        worker.reassembler.process(batch[i], &stream, &delivery);
+      }
+    }
+  }
+  batch.clear();
+}
+
+/*
+ * A module thread's loop, which is instantiated for each link type like
+ * work(), since it decodes the packets in its rings again.
+ */
+template <int linkType>
+void *serve(void *_thread) {
+  ModuleThread &thread = *(ModuleThread*)_thread;
+  Packet packet;
+  pcap_pkthdr pcapHeader;
+  const u_char *pcapPacket, *data;
+  uint64_t tag;
+  size_t length;
+  bool idle, done;
+  while (true) {
+    /* Anything queued before the workers were done is in the rings by now. */
+    done = (working == false);
+    __sync_synchronize();
+    idle = true;
+    for (size_t i = 0; i < thread.rings.size(); ++i) {
+      Ring &ring = *(thread.rings[i]);
+      /* Take a bounded run from each ring, so that none of them waits long. */
+      for (size_t j = 0; j < 64; ++j) {
+        pcapPacket = ring.queue.front(pcapHeader, tag, data, length);
+        if (pcapPacket == NULL) {
+          break;
+        }
+        idle = false;
+        if (packet.initialize <linkType>(pcapHeader, pcapPacket) == true) {
+          for (size_t k = 0; tag != 0; ++k, tag >>= 1) {
+            if ((tag & 1) == 0) {
+              continue;
+            }
+            if (length == 0) {
+              deliver(thread.counters, k, packet);
+            }
+            else {
+              deliver(thread.counters, k, packet, data, length);
+            }
+          }
+        }
+        ring.queue.pop();
+        ++(ring.processed);
+      }
+    }
+    if (idle == true) {
+      if (done == true) {
+        break;
+      }
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+/* Waits for the module threads to finish with the packets queued for them. */
+void drainRings() {
+  __sync_synchronize();
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    for (size_t j = 0; j < moduleThreads[i] -> rings.size(); ++j) {
+      while (capture == true &&
+             moduleThreads[i] -> rings[j] -> processed !=
+             moduleThreads[i] -> rings[j] -> queued) {
+        usleep(1000);
+      }
+    }
+  }
+}
+
+/*
+ * A worker's capture loop. It is instantiated for each link type the sensor
+ * decodes, and main() starts the one for its capture source.
+ */
+template <int linkType>
+void *work(void *_worker) {
+  Worker &worker = *(Worker*)_worker;
+  Packet packet;
+  pcap_pkthdr pcapHeader;
+  const u_char *pcapPacket, *datagram;
+  uint64_t matches, popped = 0;
+  uint32_t expired = 0;
+  bool reassembled;
+  /*
+   * Frames in a ring stay where they are until the block holding them is
+   * handed back to the kernel, so they can be batched without copying them,
+   * as long as the batch is processed before that happens.
+   */
+  bool inPlace = (worker.source != NULL &&
+                  worker.source -> type() == RING_CAPTURE);
+  pin(worker.cpu);
+  while (capture == true) {
+    if (worker.source != NULL) {
+      pcapPacket = worker.source -> next(pcapHeader);
+    }
+    else {
+      pcapPacket = worker.queue.front(pcapHeader);
+    }
+    /*
+     * The flow table otherwise only looks for idle flows when it creates new
+     * ones, so have it check every second, even while no traffic arrives.
+     */
+    if (tracking == true && sensorClock.now() != expired) {
+      expired = sensorClock.now();
+      worker.flows.expire(expired);
+    }
+    if (pcapPacket == NULL) {
+      /* Don't sit on a partial batch while there is no traffic. */
+      if (batching == true && worker.batch.size() > 0) {
+        process(worker);
+      }
+      if (worker.source == NULL) {
+        worker.processed += popped;
+        popped = 0;
+        usleep(1000);
+      }
+      else if (worker.source -> done() == true) {
+        break;
+      }
+      continue;
+    }
+    /* Packets from a queue were counted when they were captured. */
+    if (worker.source != NULL) {
+      ++(worker.counters.captured);
+    }
+    sensorClock.advance(pcapHeader.ts.tv_sec);
+    /* A replay read directly by this worker flushes modules as it goes. */
+    if (replay == true && worker.source != NULL && flushDue(pcapHeader)) {
+      if (batching == true && worker.batch.size() > 0) {
+        process(worker);
+      }
+      drainRings();
+      flushModules();
+      writeStatistics();
+      latencyRequested = 0;
+      logLatencies();
+    }
+    /*
+     * Fragments are held back until their datagrams are complete, unless the
+     * main thread has already done so. A reassembled datagram lives in the
+     * defragmenter, so it is always copied into a batch.
+     */
+    datagram = pcapPacket;
+    if (maxDatagrams > 0 && worker.source != NULL) {
+      datagram = worker.defragmenter.defragment <linkType>(pcapHeader,
+                                                            pcapPacket);
+    }
+    reassembled = (datagram != pcapPacket);
+    if (batching == true) {
+      /* Batched packets are only decoded if some module wants them. */
+      if (datagram != NULL) {
+        matches = classifier.classify <linkType>(pcapHeader, datagram);
+        if (matches != 0) {
+          if (worker.batch.add <linkType>(pcapHeader, datagram, matches,
+                                          !inPlace || reassembled)) {
+            ++(worker.counters.decoded);
+          }
+          else {
+            ++(worker.counters.malformed);
+          }
+        }
+      }
+      if (worker.batch.full() ||
+          (inPlace == true && worker.source -> pending() == 0)) {
+        process(worker);
+      }
+    }
+    else if (datagram != NULL) {
+      dispatch <linkType>(worker, packet, pcapHeader, datagram);
+    }
+    if (worker.source == NULL) {
+      worker.queue.pop();
+      /* Batched packets aren't finished with until the batch is processed. */
+      if (batching == true && worker.batch.size() > 0) {
+        ++popped;
+      }
+      else {
+        worker.processed += popped + 1;
+        popped = 0;
+      }
     }
   }
+  if (batching == true && worker.batch.size() > 0) {
+    process(worker);
+  }
+  /* Let modules write out what they still hold for each flow. */
+  if (tracking == true) {
+    worker.flows.clear();
+  }
   return NULL;
 }
 
+/*
+ * Waits for every worker to finish with the packets queued for it, and then
+ * for the module threads, so that a replay can flush modules at the same
+ * point in the packet stream no matter how far behind the workers are.
+ */
+void drain(const vector <Worker*> &workers) {
+  for (size_t i = 0; i < workers.size(); ++i) {
+    while (capture == true && workers[i] -> processed != workers[i] -> queued) {
+      usleep(1000);
+    }
+  }
+  drainRings();
+}
+
+/*
+ * Reads packets from a capture source that the workers can't share and
+ * queues each for the worker that handles its flow. Fragments are reassembled
+ * first, so that a datagram is queued whole for the same worker as the rest
+ * of its flow. Packets are decoded here only to find their flows; the workers
+ * decode them again from their own copies. Like work(), it is instantiated
+ * for each link type.
+ */
+template <int linkType>
+void distribute(Capture &source, const vector <Worker*> &workers) {
+  Packet packet;
+  pcap_pkthdr pcapHeader;
+  const u_char *pcapPacket;
+  Worker *worker;
+  while (capture == true) {
+    if ((pcapPacket = source.next(pcapHeader)) == NULL) {
+      if (source.done() == true) {
+        break;
+      }
+      continue;
+    }
+    ++(distributorCounters.captured);
+    if (maxDatagrams > 0) {
+      pcapPacket = distributorDefragmenter.defragment <linkType>(pcapHeader,
+                                                                 pcapPacket);
+      if (pcapPacket == NULL) {
+        continue;
+      }
+    }
+    if (packet.initialize <linkType>(pcapHeader, pcapPacket) == false) {
+      ++(distributorCounters.malformed);
+      continue;
+    }
+    sensorClock.advance(pcapHeader.ts.tv_sec);
+    if (replay == true && flushDue(pcapHeader)) {
+      drain(workers);
+      flushModules();
+      writeStatistics();
+      latencyRequested = 0;
+      logLatencies();
+    }
+    worker = workers[packet.flowHash() % workers.size()];
+    /* A replay waits for room in the queue rather than drop packets. */
+    while (true) {
+      if (worker -> queue.push(pcapHeader, pcapPacket) == true) {
+        ++(worker -> queued);
+        break;
+      }
+      if (replay == false || capture == false) {
+        ++(worker -> drops);
+        break;
+      }
+      usleep(100);
+    }
+  }
+  if (replay == true) {
+    drain(workers);
+    capture = false;
+  }
+}
+
+/*
+ * Picks the instantiations of the capture loops for a capture's datalink
+ * type. Returns false if the sensor has no decoder for it.
+ */
+bool selectDecoders(const int &datalink) {
+  switch (datalink) {
+    case DLT_EN10MB:
+      workFunction = &work <DLT_EN10MB>;
+      distributeFunction = &distribute <DLT_EN10MB>;
+      serveFunction = &serve <DLT_EN10MB>;
+      return true;
+    case DLT_LINUX_SLL:
+      workFunction = &work <DLT_LINUX_SLL>;
+      distributeFunction = &distribute <DLT_LINUX_SLL>;
+      serveFunction = &serve <DLT_LINUX_SLL>;
+      return true;
+    case DLT_RAW:
+#ifdef DLT_IPV4
+    case DLT_IPV4:
+    case DLT_IPV6:
+#endif
+      workFunction = &work <DLT_RAW>;
+      distributeFunction = &distribute <DLT_RAW>;
+      serveFunction = &serve <DLT_RAW>;
+      return true;
+  }
+  return false;
+}
+
+/* Logs what the defragmenter of thread "name" did, if it saw any fragments. */
+void report(const string &name, const Defragmenter &defragmenter) {
+  if (defragmenter.reassembled() > 0 || defragmenter.timeouts() > 0 ||
+      defragmenter.evictions() > 0 || defragmenter.drops() > 0) {
+    logger.lock();
+    logger << logger.time() << name << " reassembled "
+           << defragmenter.reassembled() << " datagrams; "
+           << defragmenter.timeouts() << " timed out, "
+           << defragmenter.evictions() << " were evicted and "
+           << defragmenter.drops() << " fragments were dropped." << endl;
+    logger.unlock();
+  }
+}
+
+/*
+ * Logs what a worker's defragmenter did, if it saw any fragments, and what
+ * its TCP reassembler did, if it had to do more than pass data through.
+ */
+void report(const size_t &i, const Worker &worker) {
+  const TCPReassembler &reassembler = worker.reassembler;
+  char name[32];
+  snprintf(name, sizeof(name), "Worker %lu", (unsigned long)i);
+  report(name, worker.defragmenter);
+  if (reassembler.outOfOrder() > 0 || reassembler.retransmissions() > 0 ||
+      reassembler.gaps() > 0) {
+    logger.lock();
+    logger << logger.time() << "Worker " << i << " buffered "
+           << reassembler.outOfOrder() << " out-of-order TCP segments, "
+           << "skipped " << reassembler.retransmissions()
+           << " retransmitted ones and gave up on " << reassembler.gaps()
+           << " holes." << endl;
+    logger.unlock();
+  }
+}
+
+/*
+ * Logs how far each of a module thread's rings fell behind, and how many
+ * packets it dropped because it was full.
+ */
+void report(const ModuleThread &thread) {
+  for (size_t i = 0; i < thread.rings.size(); ++i) {
+    logger.lock();
+    logger << logger.time() << "Module thread \"" << thread.name << "\" was "
+           << "at most " << thread.rings[i] -> maxDepth << " packets behind "
+           << "worker " << i << " and dropped " << thread.rings[i] -> drops
+           << " of its packets because its ring was full." << endl;
+    logger.unlock();
+  }
+}
+
 void cleanup(const pid_t &pid, const std::string &pidFileName) {
   kill(pid, SIGUSR1);
   unlink(pidFileName.c_str());
 }
 
 int main(int argc, char *argv[]) {
-  string configFileName = "sensor.conf", filter;
+  string configFileName = "sensor.conf", filter, threadName;
   Configuration conf;
   ofstream pidFile;
-  vector <string> moduleNames, dependencies, filters;
+  vector <string> moduleNames, dependencies, filters, cpus, replayFiles;
   map <string, size_t>::iterator itr;
-  pcap_t *pcapDescriptor;
-  char option, errorBuffer[PCAP_ERRBUF_SIZE], cwd[MAXPATHLEN];
-  bpf_program bpfProgram;
-#ifdef __FreeBSD__
-  u_int immediate = 1;
-#endif
+  Capture source;
+  size_t numWorkers = 1, queueSize = 16, j;
+  double speed = 0;
+  uint16_t fanoutGroup;
+  char option, cwd[MAXPATHLEN];
   sigset_t mask;
   pid_t pid;
   pthread_t flushThread;
-  const u_char *pcapPacket;
-  pcap_pkthdr pcapHeader;
-  Packet packet;
   int error;
   if (signal(SIGTERM, signalHandler) == SIG_ERR ||
-      signal(SIGUSR1, signalHandler) == SIG_ERR) {
+      signal(SIGINT, signalHandler) == SIG_ERR ||
+      signal(SIGUSR1, signalHandler) == SIG_ERR ||
+      signal(SIGUSR2, signalHandler) == SIG_ERR) {
     cerr << argv[0] << ": signal(): " << strerror(errno) << endl;
     return 1;
   }
-  while ((option = getopt(argc, argv, "c:p:")) != -1) {
+  while ((option = getopt(argc, argv, "c:p:r:s:")) != -1) {
     switch (option) { 
       case 'c':
         configFileName = optarg;
@@ -118,6 +1141,22 @@ int main(int argc, char *argv[]) {
       case 'p':
         pidFileName = optarg;
         break;
+      /*
+       * Replay a pcap file, or every file in a directory, instead of
+       * capturing from the configured interface. May be given more than
+       * once.
+       */
+      case 'r':
+        replayFiles.push_back(optarg);
+        replay = true;
+        break;
+      /*
+       * Pace a replay by its timestamps, sped up by the given factor. The
+       * default of 0 replays as fast as possible.
+       */
+      case 's':
+        speed = strtod(optarg, NULL);
+        break;
       default:
         return 1;
     }
@@ -151,7 +1190,7 @@ int main(int argc, char *argv[]) {
       return 1;
     }
   }
-  if (conf.getString("interface") == "") {
+  if (replay == false && conf.getString("interface") == "") {
     cerr << argv[0] << ": no interface specified" << endl;
     return 1;
   }
@@ -160,6 +1199,65 @@ int main(int argc, char *argv[]) {
     return 1;
   }
   flushInterval = conf.getNumber("flushInterval");
+  if (conf.getString("workers") != "") {
+    numWorkers = conf.getNumber("workers");
+    if (numWorkers == 0) {
+      cerr << argv[0] << ": " << conf.fileName() << ": at least one worker "
+           << "is required" << endl;
+      return 1;
+    }
+  }
+  if (conf.getString("cpus") != "") {
+    cpus = explode(conf.getString("cpus"));
+  }
+  if (conf.getString("workerQueueSize") != "") {
+    queueSize = conf.getNumber("workerQueueSize");
+  }
+  if (conf.getString("batchSize") != "") {
+    batchSize = conf.getNumber("batchSize");
+  }
+  if (conf.getString("maxFlows") != "") {
+    maxFlows = conf.getNumber("maxFlows");
+  }
+  if (conf.getString("flowTimeout") != "") {
+    flowTimeout = conf.getNumber("flowTimeout");
+  }
+  if (conf.getString("maxDatagrams") != "") {
+    maxDatagrams = conf.getNumber("maxDatagrams");
+  }
+  if (conf.getString("fragmentTimeout") != "") {
+    fragmentTimeout = conf.getNumber("fragmentTimeout");
+  }
+  if (conf.getString("maxStreamMemory") != "") {
+    maxStreamMemory = conf.getNumber("maxStreamMemory");
+  }
+  if (conf.getString("maxStreamBuffer") != "") {
+    maxStreamBuffer = conf.getNumber("maxStreamBuffer");
+  }
+  if (conf.getString("moduleQueueSize") != "") {
+    moduleQueueSize = conf.getNumber("moduleQueueSize");
+  }
+  if (conf.getString("maxPacketMemory") != "") {
+    maxPacketMemory = conf.getNumber("maxPacketMemory");
+  }
+  if (conf.getString("statisticsFile") != "") {
+    statisticsFile = conf.getString("statisticsFile");
+    timing = true;
+  }
+  if (conf.getString("metricsAddress") != "") {
+    metricsAddress = conf.getString("metricsAddress");
+    timing = true;
+  }
+  if (conf.getString("latencySampling") != "") {
+    latencySampling = conf.getNumber("latencySampling");
+  }
+  if (conf.getString("fragmentPolicy") != "" &&
+      !Defragmenter::policy(conf.getString("fragmentPolicy"),
+                            fragmentPolicy)) {
+    cerr << argv[0] << ": " << conf.fileName() << ": unknown fragment "
+         << "policy \"" << conf.getString("fragmentPolicy") << "\"" << endl;
+    return 1;
+  }
   moduleNames = explode(conf.getString("modules"));
   /* Load modules. */
   for (size_t i = 0; i < moduleNames.size(); ++i) {
@@ -170,6 +1268,15 @@ int main(int argc, char *argv[]) {
       return 1;
     }
     moduleIndex.insert(make_pair(moduleNames[i], i));
+    /* Lay out the modules' per-flow state one after another. */
+    if (modules[i].flowSlot() != NULL && modules[i].flowSlot() -> size > 0) {
+      modules[i].flowSlot() -> offset = flowStateSize;
+      flowStateSize += (modules[i].flowSlot() -> size + 7) & ~(size_t)7;
+      tracking = true;
+      if (modules[i].releaseFlow != NULL) {
+        flowReleasers.push_back(i);
+      }
+    }
   }
   /* Check dependencies and set callbacks. */
   for (size_t i = 0; i < modules.size(); ++i) {
@@ -180,11 +1287,20 @@ int main(int argc, char *argv[]) {
         if (dependencies[j] == "packet") {
           modules[i].processPacket = (processPacketFunction)dlsym(modules[i].handle(),
                                                                   "processPacket");
-          if (modules[i].processPacket == NULL) {
+          modules[i].processStream = (processStreamFunction)dlsym(modules[i].handle(),
+                                                                  "processStream");
+          if (modules[i].processPacket == NULL &&
+              modules[i].processStream == NULL) {
             cerr << argv[0] << ": " << modules[i].fileName() << ": no "
-                 << "\"processPacket\" callback defined" << endl;
+                 << "\"processPacket\" or \"processStream\" callback "
+                 << "defined" << endl;
             return 1;
           }
+          modules[i].processPackets = (processPacketsFunction)dlsym(modules[i].handle(),
+                                                                    "processPackets");
+          if (modules[i].processPackets != NULL && batchSize > 1) {
+            batching = true;
+          }
         }
         /* Check dependencies on other modules. */
         else {
@@ -218,19 +1334,13 @@ int main(int argc, char *argv[]) {
       }
     }
   }
-  pcapDescriptor = pcap_open_live(conf.getString("interface").c_str(),
-                                  std::numeric_limits <uint16_t>::max(), 1, 0,
-                                  errorBuffer);
-  if (pcapDescriptor == NULL) {
-    cerr << argv[0] << ": " << errorBuffer << endl;
-    return 1;
-  }
   /*
    * The pcap filter string we will use to capture traffic is formed by
    * combining the filter strings of all modules that will consume packets.
    */
   for (size_t i = 0; i < modules.size(); ++i) {
-    if (modules[i].processPacket != NULL &&
+    if ((modules[i].processPacket != NULL ||
+         modules[i].processStream != NULL) &&
         modules[i].conf().getString("filter") != "") {
       filters.push_back(modules[i].conf().getString("filter"));
     }
@@ -241,140 +1351,443 @@ int main(int argc, char *argv[]) {
       filter += " or ";
     }
   }
+  if (replay == true) {
+    if (!source.initialize(replayFiles, filter, speed)) {
+      cerr << argv[0] << ": " << source.error() << endl;
+      return 1;
+    }
+  }
+  else {
+    if (!source.initialize(conf, filter)) {
+      cerr << argv[0] << ": " << source.error() << endl;
+      return 1;
+    }
+  }
   /*
-   * Older versions of libpcap expect the third argument of pcap_compile()
-   * to be of type "char*".
+   * Packets are decoded according to the capture source's datalink type,
+   * and module filters are compiled for it.
    */
- if (pcap_compile(pcapDescriptor, &bpfProgram, (char*)filter.c_str(), 1,
-                  0) == -1) {
-    cerr << argv[0] << ": pcap_compile(): " << pcap_geterr(pcapDescriptor)
+  if (!selectDecoders(source.datalink())) {
+    cerr << argv[0] << ": unsupported link type " << source.datalink()
          << endl;
     return 1;
   }
-  if (pcap_setfilter(pcapDescriptor, &bpfProgram) == -1) {
-    cerr << argv[0] << ": pcap_setfilter(): " << pcap_geterr(pcapDescriptor)
-         << endl;
+  /*
+   * Once a packet has been captured, the classifier decides which modules'
+   * filters it matches, all at once.
+   */
+  for (size_t i = 0; i < modules.size(); ++i) {
+    if (modules[i].processPacket != NULL ||
+        modules[i].processStream != NULL) {
+      if (modules[i].compile(source.datalink()) != 0) {
+        cerr << argv[0] << ": " << modules[i].error() << endl;
+        return 1;
+      }
+      if (!classifier.add(modules[i].conf().getString("filter"),
+                          modules[i].bpfProgram())) {
+        cerr << argv[0] << ": " << modules[i].fileName() << ": "
+             << classifier.error() << endl;
+        return 1;
+      }
+      if (modules[i].processPacket != NULL) {
+        packetConsumers |= (uint64_t)1 << consumers.size();
+      }
+      if (modules[i].processStream != NULL) {
+        streamConsumers |= (uint64_t)1 << consumers.size();
+      }
+      /*
+       * Modules on their own threads get packets after the workers are done
+       * with them, and can't use the workers' flow tables.
+       */
+      if (modules[i].conf().getString("thread") != "") {
+        if (modules[i].flowSlot() != NULL &&
+            modules[i].flowSlot() -> size > 0) {
+          cerr << argv[0] << ": " << modules[i].fileName() << ": modules that "
+               << "keep per-flow state can't run on their own threads" << endl;
+          return 1;
+        }
+        threadName = modules[i].conf().getString("thread");
+        for (j = 0; j < moduleThreads.size(); ++j) {
+          if (moduleThreads[j] -> name == threadName) {
+            break;
+          }
+        }
+        if (j == moduleThreads.size()) {
+          moduleThreads.push_back(new ModuleThread);
+          moduleThreads[j] -> name = threadName;
+          moduleThreads[j] -> consumers = 0;
+        }
+        moduleThreads[j] -> consumers |= (uint64_t)1 << consumers.size();
+        threadedConsumers |= (uint64_t)1 << consumers.size();
+      }
+      consumers.push_back(i);
+    }
+  }
+  if (latencySampling > 0) {
+    callLatency.resize(consumers.size());
+    flushLatency.resize(modules.size());
+  }
+  /* The reassembler's state goes after the modules' in the flow table. */
+  if (streamConsumers != 0) {
+    streamSlot.size = TCPReassembler::stateSize();
+    streamSlot.offset = flowStateSize;
+    flowStateSize += (streamSlot.size + 7) & ~(size_t)7;
+    tracking = true;
+  }
+  if (tracking == true && maxFlows == 0) {
+    cerr << argv[0] << ": " << conf.fileName() << ": modules keep per-flow "
+         << "state, but \"maxFlows\" is 0" << endl;
     return 1;
   }
-/* If running on FreeBSD, put the BPF device into immediate mode. */
-#ifdef __FreeBSD__
-    if (ioctl(pcap_fileno(pcapDescriptor), BIOCIMMEDIATE, &immediate) == -1) {
-      cerr << argv[0] << ": ioctl(): " << strerror(errno) << endl;
+  /*
+   * A single worker reads from the capture source directly. With more than
+   * one, a ring backend gets one ring per worker, all joined to the same
+   * fanout group, which reassembles fragments before hashing them. Any other
+   * backend is read by the main thread, which reassembles fragments itself
+   * and hashes each packet's flow to pick a worker queue for it.
+   */
+  fanoutGroup = getpid() & 0xffff;
+  if (maxDatagrams > 0 && numWorkers > 1 && source.type() != RING_CAPTURE &&
+      !distributorDefragmenter.initialize(maxDatagrams, fragmentTimeout,
+                                          fragmentPolicy)) {
+    cerr << argv[0] << ": " << distributorDefragmenter.error() << endl;
+    return 1;
+  }
+  for (size_t i = 0; i < numWorkers; ++i) {
+    workers.push_back(new Worker);
+    workers[i] -> index = i;
+    workers[i] -> cpu = -1;
+    workers[i] -> queued = 0;
+    workers[i] -> drops = 0;
+    workers[i] -> processed = 0;
+    if (cpus.size() > 0) {
+      workers[i] -> cpu = strtol(cpus[i % cpus.size()].c_str(), NULL, 10);
+    }
+    if (numWorkers == 1) {
+      workers[i] -> source = &source;
+    }
+    else if (source.type() == RING_CAPTURE) {
+      if (i == 0) {
+        workers[i] -> source = &source;
+      }
+      else {
+        workers[i] -> source = new Capture;
+        if (!workers[i] -> source -> initialize(conf, filter)) {
+          cerr << argv[0] << ": " << workers[i] -> source -> error() << endl;
+          return 1;
+        }
+      }
+      if (!workers[i] -> source -> fanout(fanoutGroup)) {
+        cerr << argv[0] << ": " << workers[i] -> source -> error() << endl;
+        return 1;
+      }
+    }
+    else {
+      workers[i] -> source = NULL;
+      if (!workers[i] -> queue.initialize(queueSize * 1024 * 1024)) {
+        cerr << argv[0] << ": " << workers[i] -> queue.error() << endl;
+        return 1;
+      }
+    }
+    if (batching == true && !workers[i] -> batch.initialize(batchSize)) {
+      cerr << argv[0] << ": " << workers[i] -> batch.error() << endl;
+      return 1;
+    }
+    /* Every worker sees its own share of the flows. */
+    if (tracking == true &&
+        !workers[i] -> flows.initialize(max(maxFlows / numWorkers, (size_t)1),
+                                        flowStateSize, flowTimeout)) {
+      cerr << argv[0] << ": " << workers[i] -> flows.error() << endl;
+      return 1;
+    }
+    if (streamConsumers != 0) {
+      if (!workers[i] -> reassembler.initialize(streamSlot,
+                                                maxStreamMemory * 1048576 /
+                                                numWorkers,
+                                                maxStreamBuffer * 1024)) {
+        cerr << argv[0] << ": " << workers[i] -> reassembler.error() << endl;
+        return 1;
+      }
+    }
+    if (tracking == true &&
+        (streamConsumers != 0 || flowReleasers.size() > 0)) {
+      workers[i] -> flows.setRelease(&releaseFlow, workers[i]);
+    }
+    if (maxDatagrams > 0 && workers[i] -> source != NULL &&
+        !workers[i] -> defragmenter.initialize(max(maxDatagrams / numWorkers,
+                                                   (size_t)1),
+                                               fragmentTimeout,
+                                               fragmentPolicy)) {
+      cerr << argv[0] << ": " << workers[i] -> defragmenter.error() << endl;
+      return 1;
+    }
+    for (j = 0; j < moduleThreads.size(); ++j) {
+      moduleThreads[j] -> rings.push_back(new Ring);
+      if (!moduleThreads[j] -> rings[i] -> queue.initialize(moduleQueueSize *
+                                                            1024 * 1024)) {
+        cerr << argv[0] << ": " << moduleThreads[j] -> rings[i] -> queue.error()
+             << endl;
+        return 1;
+      }
+      moduleThreads[j] -> rings[i] -> queued = 0;
+      moduleThreads[j] -> rings[i] -> drops = 0;
+      moduleThreads[j] -> rings[i] -> maxDepth = 0;
+      moduleThreads[j] -> rings[i] -> processed = 0;
+    }
+  }
+  for (size_t i = 0; i < workers.size(); ++i) {
+    memset((void*)&(workers[i] -> counters), 0, sizeof(Counters));
+    if (workers[i] -> source != NULL) {
+      sources.push_back(workers[i] -> source);
+    }
+  }
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    memset((void*)&(moduleThreads[i] -> counters), 0, sizeof(Counters));
+  }
+  if (sources.size() == 0) {
+    sources.push_back(&source);
+  }
+  /* Replays run in the foreground. */
+  if (replay == false) {
+    if (sigfillset(&mask) == -1) {
+      cerr << argv[0] << ": sigfillset(): " << strerror(errno) << endl;
       return 1;
     }
-#endif
-  if (sigfillset(&mask) == -1) {
-    cerr << argv[0] << ": sigfillset(): " << strerror(errno) << endl;
-    return 1;
+    if (sigdelset(&mask, SIGUSR1) == -1) {
+      cerr << argv[0] << ": sigdelset(): " << strerror(errno) << endl;
+      return 1;
+    }
+    pid = fork();
+    if (pid < 0) {
+      cerr << ": fork(): " << strerror(errno) << "; exiting" << endl;
+      return 1;
+    }
+    /* If this is the parent process, wait for SIGUSR1 from the child. */
+    if (pid != 0) {
+      sigsuspend(&mask);
+      return 0;
+    }
   }
-  if (sigdelset(&mask, SIGUSR1) == -1) {
-    cerr << argv[0] << ": sigdelset(): " << strerror(errno) << endl;
-    return 1;
+  /*
+   * A live capture starts the clock at the current time. A replay starts it
+   * at the time of its first packet.
+   */
+  if (replay == false) {
+    sensorClock.advance(time(NULL));
+    sensorClock.tick();
   }
-  pid = fork();
-  if (pid < 0) {
-    cerr << ": fork(): " << strerror(errno) << "; exiting" << endl;
+  if (maxPacketMemory > 0 &&
+      !packetPool.initialize(maxPacketMemory * 1048576)) {
+    cerr << argv[0] << ": " << packetPool.error() << endl;
     return 1;
   }
-  /* If this is the parent process, wait for SIGUSR1 from the child. */
-  if (pid != 0) {
-    sigsuspend(&mask);
-    return 0;
-  }
   /* Initialize modules. */
   for (size_t i = 0; i < modules.size(); ++i) {
-    if (modules[i].initialize(logger) != 0) {
+    if (modules[i].initialize(logger, sensorClock, packetPool) != 0) {
       cerr << argv[0] << ": " << modules[i].fileName() << ": "
            << modules[i].error() << endl;
       return 1;
     }
   }
-  /* Start flush() thread. */
-  error = pthread_create(&flushThread, NULL, &flush, NULL);
-  if (error != 0) {
-    cerr << argv[0] << ": pthread_create(): " << strerror(error) << endl;
+  if (metricsAddress != "" &&
+      !metricsServer.initialize(metricsAddress, &exportMetrics)) {
+    cerr << argv[0] << ": " << metricsServer.error() << endl;
     return 1;
   }
-  /*
-   * If we are not given an absolute path to the PID file, form an absolute
-   * path by prepending the current working directory to it, so that we can
-   * unlink it later.
-   */
-  if (pidFileName[0] != '/') {
-    if (getcwd(cwd, MAXPATHLEN) == NULL) {
-      cerr << argv[0] << ": getcwd(): " << strerror(errno) << endl;
+  if (replay == false) {
+    /* Start flush() thread. */
+    error = pthread_create(&flushThread, NULL, &flush, NULL);
+    if (error != 0) {
+      cerr << argv[0] << ": pthread_create(): " << strerror(error) << endl;
+      return 1;
+    }
+    /*
+     * If we are not given an absolute path to the PID file, form an absolute
+     * path by prepending the current working directory to it, so that we can
+     * unlink it later.
+     */
+    if (pidFileName[0] != '/') {
+      if (getcwd(cwd, MAXPATHLEN) == NULL) {
+        cerr << argv[0] << ": getcwd(): " << strerror(errno) << endl;
+        return 1;
+      }
+      pidFileName = '/' + pidFileName;
+      pidFileName = cwd + pidFileName;
+    }
+    /* Likewise for the statistics file, which is written from "/". */
+    if (statisticsFile != "" && statisticsFile[0] != '/') {
+      if (getcwd(cwd, MAXPATHLEN) == NULL) {
+        cerr << argv[0] << ": getcwd(): " << strerror(errno) << endl;
+        return 1;
+      }
+      statisticsFile = '/' + statisticsFile;
+      statisticsFile = cwd + statisticsFile;
+    }
+    /* Write daemonized child's PID to the PID file. */
+    pidFile.open(pidFileName.c_str());
+    if (!pidFile) {
+      cerr << argv[0] << ": open(): " << pidFileName << ": " << strerror(errno)
+           << "; exiting" << endl;
+      kill(getppid(), SIGUSR1);
+      return 1;
+    }
+    pidFile << getpid() << endl;
+    pidFile.close();
+    if (chdir("/") != 0) {
+      cerr << argv[0] << ": chdir(): /: " << strerror(errno) << endl;
+      cleanup(getppid(), pidFileName);
+      return 1;
+    }
+    /* Close unneeded file descriptors. */
+    if (close(STDIN_FILENO) != 0) {
+      cerr << argv[0] << ": close(): STDIN_FILENO: " << strerror(errno)
+           << endl;
+      cleanup(getppid(), pidFileName);
+      return 1;
+    }
+    if (close(STDOUT_FILENO) != 0) {
+      cerr << argv[0] << ": close(): STDOUT_FILENO: " << strerror(errno)
+           << endl;
+      cleanup(getppid(), pidFileName);
+      return 1;
+    }
+    if (kill(getppid(), SIGUSR1) == -1) {
+      cerr << argv[0] << ": kill(): " << strerror(errno) << endl;
+      cleanup(getppid(), pidFileName);
+      return 1;
+    }
+    if (close(STDERR_FILENO) != 0) {
+      cerr << argv[0] << ": close(): STDERR_FILENO: " << strerror(errno)
+           << endl;
+      unlink(pidFileName.c_str());
       return 1;
     }
-    pidFileName = '/' + pidFileName;
-    pidFileName = cwd + pidFileName;
   }
-  /* Write daemonized child's PID to the PID file. */
-  pidFile.open(pidFileName.c_str());
-  if (!pidFile) {
-    cerr << argv[0] << ": open(): " << pidFileName << ": " << strerror(errno)
-         << "; exiting" << endl;
-    kill(getppid(), SIGUSR1);
-    return 1;
+  else {
+    /* There is no PID file to remove after a replay. */
+    pidFileName.clear();
   }
-  pidFile << getpid() << endl;
-  pidFile.close();
-  if (chdir("/") != 0) {
-    cerr << argv[0] << ": chdir(): /: " << strerror(errno) << endl;
-    cleanup(getppid(), pidFileName);
+  logger.lock();
+  logger << logger.time() << programName << " starting." << endl;
+  logger.unlock();
+  if (metricsServer && !metricsServer.start()) {
+    logger.lock();
+    logger << logger.time() << metricsServer.error() << "; exiting." << endl;
+    logger.unlock();
+    unlink(pidFileName.c_str());
     return 1;
   }
-  /* Close unneeded file descriptors. */
-  if (close(STDIN_FILENO) != 0) {
-    cerr << argv[0] << ": close(): STDIN_FILENO: " << strerror(errno) << endl;
-    cleanup(getppid(), pidFileName);
-    return 1;
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    error = pthread_create(&(moduleThreads[i] -> thread), NULL, serveFunction,
+                           moduleThreads[i]);
+    if (error != 0) {
+      logger.lock();
+      logger << logger.time() << "pthread_create(): " << strerror(error)
+             << "; exiting." << endl;
+      logger.unlock();
+      unlink(pidFileName.c_str());
+      return 1;
+    }
   }
-  if (close(STDOUT_FILENO) != 0) {
-    cerr << argv[0] << ": close(): STDOUT_FILENO: " << strerror(errno)
-         << endl;
-    cleanup(getppid(), pidFileName);
-    return 1;
+  if (workers.size() == 1) {
+    workFunction(workers[0]);
   }
-  if (kill(getppid(), SIGUSR1) == -1) {
-    cerr << argv[0] << ": kill(): " << strerror(errno) << endl;
-    cleanup(getppid(), pidFileName);
-    return 1;
+  else {
+    for (size_t i = 0; i < workers.size(); ++i) {
+      error = pthread_create(&(workers[i] -> thread), NULL, workFunction,
+                             workers[i]);
+      if (error != 0) {
+        logger.lock();
+        logger << logger.time() << "pthread_create(): " << strerror(error)
+               << "; exiting." << endl;
+        logger.unlock();
+        unlink(pidFileName.c_str());
+        return 1;
+      }
+    }
+    if (source.type() != RING_CAPTURE) {
+      distributeFunction(source, workers);
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+      error = pthread_join(workers[i] -> thread, NULL);
+      if (error != 0) {
+        logger.lock();
+        logger << logger.time() << "pthread_join(): " << strerror(error)
+               << "; exiting." << endl;
+        logger.unlock();
+        unlink(pidFileName.c_str());
+        return 1;
+      }
+      if (workers[i] -> drops > 0) {
+        logger.lock();
+        logger << logger.time() << "Worker " << i << " dropped "
+               << workers[i] -> drops << " packets because its queue "
+               << "was full." << endl;
+        logger.unlock();
+      }
+    }
   }
-  if (close(STDERR_FILENO) != 0) {
-    cerr << argv[0] << ": close(): STDERR_FILENO: " << strerror(errno)
-         << endl;
-    unlink(pidFileName.c_str());
-    return 1;
+  /* Let the module threads catch up with the workers before they exit. */
+  working = false;
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    error = pthread_join(moduleThreads[i] -> thread, NULL);
+    if (error != 0) {
+      logger.lock();
+      logger << logger.time() << "pthread_join(): " << strerror(error)
+             << "; exiting." << endl;
+      logger.unlock();
+      unlink(pidFileName.c_str());
+      return 1;
+    }
   }
-  logger.lock();
-  logger << logger.time() << programName << " starting." << endl;
-  logger.unlock();
+  /* Allow the flush() thread to exit gracefully. */
+  if (replay == false) {
+    error = pthread_join(flushThread, NULL);
+    if (error != 0) {
+      logger.lock();
+      logger << logger.time() << "pthread_join(): " << strerror(error)
+             << "; exiting." << endl;
+      logger.unlock();
+      unlink(pidFileName.c_str());
+      return 1;
+    }
+  }
+  else {
+    if (!source) {
+      logger.lock();
+      logger << logger.time() << source.error() << endl;
+      logger.unlock();
+    }
+  }
+  metricsServer.stop();
   /*
-   * For each packet received, check which modules are interested in it and
-   * call each interested module's processPacket() function with it.
+   * Nothing else reads the counters once the flush() thread and the metrics
+   * server are gone.
    */
-  while (capture == true) {
-    if ((pcapPacket = pcap_next(pcapDescriptor, &pcapHeader)) != NULL) {
-      if (packet.initialize(pcapHeader, pcapPacket) == true) {
-        for (size_t i = 0; i < modules.size(); ++i) {
-          if (modules[i].processPacket != NULL &&
-              bpf_filter(modules[i].bpfProgram().bf_insns, (u_char*)pcapPacket,
-              pcapHeader.len, pcapHeader.caplen) != 0) {
-            modules[i].processPacket(packet);
-          }
-        }
-      }
+  writeStatistics();
+  logLatencies();
+  report("The main thread", distributorDefragmenter);
+  for (size_t i = 0; i < workers.size(); ++i) {
+    report(i, *(workers[i]));
+    if (workers[i] -> source != &source) {
+      delete workers[i] -> source;
     }
+    delete workers[i];
   }
-  /* Allow the flush() thread to exit gracefully. */
-  error = pthread_join(flushThread, NULL);
-  if (error != 0) {
+  for (size_t i = 0; i < moduleThreads.size(); ++i) {
+    report(*(moduleThreads[i]));
+    for (j = 0; j < moduleThreads[i] -> rings.size(); ++j) {
+      delete moduleThreads[i] -> rings[j];
+    }
+    delete moduleThreads[i];
+  }
+  if (packetPool.pressure() > 0 || packetPool.failures() > 0) {
     logger.lock();
-    logger << logger.time() << "pthread_join(): " << strerror(error)
-           << "; exiting." << endl;
+    logger << logger.time() << "The packet pool filled up "
+           << packetPool.pressure() << " times, and "
+           << packetPool.failures() << " packets could not be retained."
+           << endl;
     logger.unlock();
-    unlink(pidFileName.c_str());
-    return 1;
   }
   /* Call each module's finish() function. */
   for (size_t i = 0; i < modules.size(); ++i) {
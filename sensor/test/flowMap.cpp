@@ -0,0 +1,98 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Fills a FlowMap bucket to the last slot and empties it again in random
+ * order, checking after each erase that every remaining entry can still be
+ * found. erase() used to look for a free slot that a full bucket doesn't
+ * have, and never returned.
+ */
+
+#include <cstdlib>
+
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+
+#include <include/flowMap.hpp>
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+  /* Small enough that the table is a single bucket. */
+  FlowMap <uint32_t, uint32_t> flowMap;
+  FlowMap <uint32_t, uint32_t>::iterator itr;
+  vector <uint32_t> keys;
+  size_t numKeys = 0;
+  if (argc != 1) {
+    cerr << "usage: " << argv[0] << endl;
+    return 1;
+  }
+  if (!flowMap.initialize(1) || flowMap.bucket_count() != 1) {
+    cerr << argv[0] << ": FlowMap is not a single bucket" << endl;
+    return 1;
+  }
+  srandom(0);
+  for (uint32_t key = 1; flowMap.insert(make_pair(key, key)).second == true;
+       ++key) {
+    keys.push_back(key);
+  }
+  numKeys = keys.size();
+  if (flowMap.size() != numKeys) {
+    cerr << argv[0] << ": size() is " << flowMap.size() << " with "
+         << numKeys << " entries" << endl;
+    return 1;
+  }
+  while (keys.size() > 0) {
+    swap(keys[random() % keys.size()], keys.back());
+    itr = flowMap.find(keys.back());
+    if (itr == flowMap.end() || itr -> second != keys.back()) {
+      cerr << argv[0] << ": lost key " << keys.back() << endl;
+      return 1;
+    }
+    flowMap.erase(itr);
+    if (flowMap.find(keys.back()) != flowMap.end()) {
+      cerr << argv[0] << ": erased key " << keys.back() << " is still there"
+           << endl;
+      return 1;
+    }
+    keys.pop_back();
+    for (size_t i = 0; i < keys.size(); ++i) {
+      itr = flowMap.find(keys[i]);
+      if (itr == flowMap.end() || itr -> second != keys[i]) {
+        cerr << argv[0] << ": lost key " << keys[i] << " after erasing"
+             << endl;
+        return 1;
+      }
+    }
+  }
+  if (flowMap.size() != 0) {
+    cerr << argv[0] << ": size() is " << flowMap.size() << " when empty"
+         << endl;
+    return 1;
+  }
+  cout << "Filled and emptied a bucket of " << numKeys << " entries." << endl;
+  return 0;
+}
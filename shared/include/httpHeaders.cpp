@@ -0,0 +1,97 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cctype>
+#include <cstring>
+
+#include <strings.h>
+
+#include "httpHeaders.h"
+
+static const char *names[numKnownHeaders + 1] = {
+  NULL,
+  "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language",
+  "Accept-Ranges", "Access-Control-Allow-Origin", "Age", "Allow",
+  "Authorization", "Cache-Control", "Connection", "Content-Disposition",
+  "Content-Encoding", "Content-Language", "Content-Length", "Content-Location",
+  "Content-Range", "Content-Security-Policy", "Content-Type", "Cookie", "DNT",
+  "Date", "ETag", "Expect", "Expires", "From", "Host", "If-Match",
+  "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since",
+  "Keep-Alive", "Last-Modified", "Link", "Location", "Origin", "P3P", "Pragma",
+  "Proxy-Authenticate", "Proxy-Authorization", "Proxy-Connection", "Range",
+  "Referer", "Refresh", "Retry-After", "Server", "Set-Cookie",
+  "Strict-Transport-Security", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+  "Upgrade-Insecure-Requests", "User-Agent", "Vary", "Via", "WWW-Authenticate",
+  "Warning", "X-Content-Type-Options", "X-Forwarded-For", "X-Forwarded-Proto",
+  "X-Frame-Options", "X-Powered-By", "X-Requested-With", "X-XSS-Protection"
+};
+
+/*
+ * Maps the hash of each name in "names" to its index. The hash has no
+ * collisions among those names; check that it still doesn't when adding any.
+ */
+static const uint8_t slots[256] = {
+  47,  0,  0, 63,  0,  0,  0, 10,  0, 62,  0,  0,  0,  0,  0,  0,
+  65,  0, 19, 61, 66,  0,  0,  0,  0,  0, 50,  9,  0,  0,  0, 41,
+   0,  0,  0, 30, 48,  0,  0,  0,  0,  3,  0, 49,  0,  0,  0, 17,
+  22,  0,  0,  0, 55,  0,  0, 21,  2,  0,  0,  0, 15,  4,  0,  5,
+  20,  0,  0, 57,  0,  0,  0,  0, 26,  0,  0,  0,  0, 34,  0,  0,
+   0,  0, 13,  0,  0,  0,  0,  0,  1,  0,  0,  0,  0,  0,  0,  0,
+  35,  0,  0,  8,  0,  0, 14, 46,  0,  0,  0,  0,  0,  0, 39,  0,
+  24,  0,  0,  0,  0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  27,  0, 28, 38,  0,  0,  0,  0,  0, 43, 16,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0, 25,  0, 29, 37,  0,  0,  0,
+   0,  0,  0,  0,  0, 18,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0, 11,  0,  0,  0, 33,  6,  0,  0,
+   0,  0, 58,  0,  0,  0,  0,  0,  0, 32,  0,  0,  0,  7,  0,  0,
+   0,  0,  0, 44,  0, 12,  0,  0, 64,  0,  0,  0,  0,  0, 40, 45,
+  42,  0,  0,  0, 56, 53,  0,  0,  0, 59,  0, 54,  0,  0,  0, 51,
+   0,  0, 23,  0,  0, 52,  0,  0, 36,  0,  0,  0,  0,  0, 60,  0
+};
+
+static size_t hash(const char *name, const size_t length) {
+  return (length * 29 + tolower((unsigned char)name[0]) * 6 +
+          tolower((unsigned char)name[length - 1]) * 4 +
+          tolower((unsigned char)name[length / 2]) * 4) & 255;
+}
+
+uint16_t knownHeader(const char *name, const size_t length) {
+  uint16_t id;
+  if (length == 0) {
+    return 0;
+  }
+  id = slots[hash(name, length)];
+  if (id != 0 && strlen(names[id]) == length &&
+      strncasecmp(name, names[id], length) == 0) {
+    return id;
+  }
+  return 0;
+}
+
+const char *knownHeaderName(const uint16_t id) {
+  if (id == 0 || id > numKnownHeaders) {
+    return NULL;
+  }
+  return names[id];
+}
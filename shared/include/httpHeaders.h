@@ -0,0 +1,52 @@
+/*
+ * Copyright 2011 Boris Kochergin. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#include <cstddef>
+
+#include <stdint.h>
+
+/*
+ * A fixed table of well-known HTTP header names, numbered from 1 to
+ * "numKnownHeaders". The numbers are written to disk in place of the names,
+ * so names may only ever be added to the end of the table.
+ */
+const uint16_t numKnownHeaders = 66;
+
+/*
+ * Given a header name, returns its number in the table, ignoring case, or 0
+ * if it isn't in the table. The lookup is a perfect hash of the name's
+ * length and three of its characters, followed by one comparison.
+ */
+uint16_t knownHeader(const char *name, const size_t length);
+
+/*
+ * Given a number from 1 to "numKnownHeaders", returns the name, in its usual
+ * capitalization. Otherwise, returns NULL.
+ */
+const char *knownHeaderName(const uint16_t id);
+
+#endif
@@ -38,6 +38,7 @@
 
 #include <include/address.h>
 #include <include/berkeleyDB.h>
+#include <include/httpHeaders.h>
 #include <include/options.h>
 #include <include/timeStamp.h>
 
@@ -66,12 +67,15 @@ string pad(const string _string, size_t length) {
 
 void print(const char *data) {
   static TimeStamp time;
-  static const char *clientMAC, *serverMAC;
+  static const char *clientMAC, *serverMAC, *name;
+  static uint8_t version;
+  static uint16_t header;
   static uint32_t *clientIP, *serverIP, ip, length, numMessages, total;
   static uint16_t *clientPort, *serverPort;
   static vector <HTTPMessage> messages;
   static size_t position;
   static bool match;
+  version = *data;
   clientMAC = data + 1;
   serverMAC = data + 7;
   clientIP = (uint32_t*)(data + 13);
@@ -195,10 +199,26 @@ void print(const char *data) {
     total = ntohl(*(uint32_t*)(data + position));
     position += 4;
     for (size_t j = 0; j < total; ++j) {
-      length = ntohl(*(uint32_t*)(data + position));
-      position += 4;
-      messages[i].headers.push_back(make_pair(string(data + position, length), ""));
-      position += length;
+      /*
+       * Since version 2, well-known header names are written as their
+       * numbers, and other names are preceded by a 0.
+       */
+      if (version >= 2) {
+        header = ntohs(*(uint16_t*)(data + position));
+        position += 2;
+        if (header != 0) {
+          name = knownHeaderName(header);
+          messages[i].headers.push_back(make_pair((name != NULL) ? name : "",
+                                                  ""));
+        }
+      }
+      if (version < 2 || header == 0) {
+        length = ntohl(*(uint32_t*)(data + position));
+        position += 4;
+        messages[i].headers.push_back(make_pair(string(data + position,
+                                                       length), ""));
+        position += length;
+      }
       length = ntohl(*(uint32_t*)(data + position));
       position += 4;
       messages[i].headers.rbegin() -> second = string(data + position, length);